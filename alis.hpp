@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_HPP
+#define ALIS_HPP 1
+
+/*
+ * Header-only C++ layer over arena.h, arena_mgmt.h and map.h.
+ * Arena, Reservation and View own an arena, a ticket and a mapping
+ * respectively and are move-only. With C++17, MemoryResource lets pmr
+ * containers allocate from mapped tickets.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+extern "C" {
+#include "arena.h"
+#include "arena_mgmt.h"
+#include "map.h"
+}
+
+#include <cerrno>
+#include <memory>
+#include <new>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define ALIS_HAVE_PMR 1
+#endif
+#endif
+
+namespace alis {
+
+[[noreturn]] inline void throw_errno(const char *what)
+{
+	throw std::system_error(errno ? errno : ENOMEM, std::generic_category(), what);
+}
+
+/* A mapping of a reservation's data pages, unmapped on destruction */
+class View {
+public:
+	View() noexcept : addr_(nullptr), len_(0) {}
+	View(void *addr, size_t len) noexcept : addr_(addr), len_(len) {}
+	View(View &&o) noexcept : addr_(o.addr_), len_(o.len_)
+	{
+		o.addr_ = nullptr;
+		o.len_ = 0;
+	}
+	View &operator=(View &&o) noexcept
+	{
+		if (this != &o) {
+			reset();
+			std::swap(addr_, o.addr_);
+			std::swap(len_, o.len_);
+		}
+		return *this;
+	}
+	View(const View &) = delete;
+	View &operator=(const View &) = delete;
+	~View() { reset(); }
+
+	void *data() const noexcept { return addr_; }
+	size_t size() const noexcept { return len_; }
+	unsigned char *begin() const noexcept { return static_cast<unsigned char *>(addr_); }
+	unsigned char *end() const noexcept { return begin() + len_; }
+	explicit operator bool() const noexcept { return addr_ != nullptr; }
+
+	void reset() noexcept
+	{
+		if (addr_ != nullptr) {
+			alis_unmap(addr_, len_);
+			addr_ = nullptr;
+			len_ = 0;
+		}
+	}
+
+private:
+	void *addr_;
+	size_t len_;
+};
+
+/*
+ * A ticket in an arena, released on destruction.
+ * The arena must outlive the Reservation: reset or detach it before the
+ * Arena it came from is destroyed. Views of it may outlive both.
+ */
+class Reservation {
+public:
+	Reservation() noexcept : arena_(nullptr), ticket_(0) {}
+	Reservation(struct ::Arena *arena, ticketid_t ticket) noexcept
+		: arena_(arena), ticket_(ticket) {}
+	Reservation(Reservation &&o) noexcept : arena_(o.arena_), ticket_(o.ticket_)
+	{
+		o.ticket_ = 0;
+	}
+	Reservation &operator=(Reservation &&o) noexcept
+	{
+		if (this != &o) {
+			reset();
+			arena_ = o.arena_;
+			ticket_ = o.ticket_;
+			o.ticket_ = 0;
+		}
+		return *this;
+	}
+	Reservation(const Reservation &) = delete;
+	Reservation &operator=(const Reservation &) = delete;
+	~Reservation() { reset(); }
+
+	ticketid_t ticket() const noexcept { return ticket_; }
+	struct ::Arena *arena() const noexcept { return arena_; }
+	explicit operator bool() const noexcept { return ticket_ != 0; }
+
+	size_t pages() const
+	{
+		return ticket_ ? alis_arena_get_data(arena_, ticket_, nullptr, 0) : 0;
+	}
+	size_t size() const { return pages() * arena_->page_size; }
+
+	std::vector<off_t> data_offsets() const
+	{
+		return collect<off_t>(alis_arena_get_data);
+	}
+	std::vector<off_t> guard_offsets() const
+	{
+		return collect<off_t>(alis_arena_get_guard);
+	}
+	std::vector<physaddr_t> data_physaddrs() const
+	{
+		return collect<physaddr_t>(alis_arena_get_data_physaddr);
+	}
+	std::vector<physaddr_t> guard_physaddrs() const
+	{
+		return collect<physaddr_t>(alis_arena_get_guard_physaddr);
+	}
+
+	/* Map the data pages contiguously, aligned to `align' bytes (or 0) */
+	View map(size_t align = 0) const
+	{
+		std::vector<off_t> offs = data_offsets();
+		void *p = alis_map(nullptr, align, arena_->mfd, offs.data(), offs.size(),
+		                   arena_->page_size);
+		if (p == MAP_FAILED) {
+			throw_errno("alis_map");
+		}
+		return View(p, offs.size() * arena_->page_size);
+	}
+
+	/* Give up ownership without releasing the ticket */
+	ticketid_t detach() noexcept
+	{
+		ticketid_t t = ticket_;
+		ticket_ = 0;
+		return t;
+	}
+
+	void reset() noexcept
+	{
+		if (ticket_) {
+			alis_arena_release(arena_, ticket_);
+			ticket_ = 0;
+		}
+	}
+
+private:
+	template <typename T>
+	std::vector<T> collect(size_t (*get)(struct ::Arena *, ticketid_t, T *, size_t)) const
+	{
+		if (!ticket_) {
+			return std::vector<T>();
+		}
+		/* Guard pages shared by row blocks are counted once per block */
+		std::vector<T> out(get(arena_, ticket_, nullptr, 0), T(-1));
+		get(arena_, ticket_, out.data(), out.size());
+		size_t n = out.size();
+		while (n > 0 && out[n - 1] == T(-1)) {
+			n--;
+		}
+		out.resize(n);
+		return out;
+	}
+
+	struct ::Arena *arena_;
+	ticketid_t ticket_;
+};
+
+/* A MasterArena, destroyed on destruction; its address is stable across moves */
+class Arena {
+public:
+	Arena(struct MemorySystem *msys, size_t size_hint, size_t max_cont_rows = 0,
+	      const struct ArenaOptions *opts = nullptr)
+		: ma_(new struct MasterArena()), stats_()
+	{
+		if (alis_arena_create_opts(msys, size_hint, max_cont_rows, opts,
+		                           ma_.get(), &stats_) != 0)
+		{
+			throw_errno("alis_arena_create");
+		}
+	}
+	Arena(Arena &&) noexcept = default;
+	Arena &operator=(Arena &&o) noexcept
+	{
+		if (this != &o) {
+			destroy();
+			ma_ = std::move(o.ma_);
+			stats_ = o.stats_;
+		}
+		return *this;
+	}
+	Arena(const Arena &) = delete;
+	Arena &operator=(const Arena &) = delete;
+	~Arena() { destroy(); }
+
+	struct MasterArena *master() const noexcept { return ma_.get(); }
+	struct ::Arena *get() const noexcept { return &(ma_->arena); }
+	const struct ArenaStats &stats() const noexcept { return stats_; }
+	size_t page_size() const noexcept { return ma_->arena.page_size; }
+	size_t free_pages() const noexcept
+	{
+		const struct ::Arena *a = get();
+		return a->rb_top ? a->rb_pgtotals[a->rb_top - 1] : 0;
+	}
+
+	/* Returns an empty Reservation if the arena cannot satisfy `size' */
+	Reservation try_reserve(size_t size,
+	                        enum ArenaPolicy policy = ARENA_POLICY_BESTFIT) noexcept
+	{
+		return Reservation(get(), alis_arena_reserve_policy(get(), size, policy));
+	}
+	Reservation reserve(size_t size, enum ArenaPolicy policy = ARENA_POLICY_BESTFIT)
+	{
+		Reservation r = try_reserve(size, policy);
+		if (!r) {
+			throw std::bad_alloc();
+		}
+		return r;
+	}
+
+private:
+	void destroy() noexcept
+	{
+		if (ma_) {
+			alis_arena_destroy(ma_.get());
+			ma_.reset();
+		}
+	}
+
+	std::unique_ptr<struct MasterArena> ma_;
+	struct ArenaStats stats_;
+};
+
+#ifdef ALIS_HAVE_PMR
+/*
+ * Monotonic memory_resource over mapped tickets of one arena: allocations
+ * are carved out of the current mapping and a new ticket of at least
+ * `chunk_size' bytes is reserved and mapped when it runs out. Deallocation
+ * is a no-op; release() or destruction returns every ticket to the arena.
+ * The Arena must outlive the resource.
+ */
+class MemoryResource : public std::pmr::memory_resource {
+public:
+	explicit MemoryResource(Arena &arena, size_t chunk_size = 2 * 1024 * 1024,
+	                        enum ArenaPolicy policy = ARENA_POLICY_BESTFIT)
+		: arena_(arena), chunk_size_(chunk_size), policy_(policy),
+		  cur_(nullptr), end_(nullptr) {}
+	MemoryResource(const MemoryResource &) = delete;
+	MemoryResource &operator=(const MemoryResource &) = delete;
+
+	void release() noexcept
+	{
+		chunks_.clear();
+		cur_ = nullptr;
+		end_ = nullptr;
+	}
+
+	/* Bytes mapped from the arena so far */
+	size_t mapped() const noexcept
+	{
+		size_t n = 0;
+		for (const Chunk &c : chunks_) {
+			n += c.view.size();
+		}
+		return n;
+	}
+
+protected:
+	void *do_allocate(size_t bytes, size_t align) override
+	{
+		unsigned char *p = align_up(cur_, align);
+		if (cur_ == nullptr || p + bytes > end_) {
+			grow(bytes + align);
+			p = align_up(cur_, align);
+		}
+		cur_ = p + bytes;
+		return p;
+	}
+
+	void do_deallocate(void *, size_t, size_t) override {}
+
+	bool do_is_equal(const std::pmr::memory_resource &o) const noexcept override
+	{
+		return this == &o;
+	}
+
+private:
+	struct Chunk {
+		Reservation resv;
+		View view;
+	};
+
+	static unsigned char *align_up(unsigned char *p, size_t align)
+	{
+		const uintptr_t v = reinterpret_cast<uintptr_t>(p);
+		return reinterpret_cast<unsigned char *>((v + align - 1) & ~(uintptr_t)(align - 1));
+	}
+
+	void grow(size_t min_bytes)
+	{
+		Reservation r = arena_.reserve(min_bytes > chunk_size_ ? min_bytes : chunk_size_,
+		                               policy_);
+		View v = r.map();
+		chunks_.push_back(Chunk{std::move(r), std::move(v)});
+		/* Only once the chunk is kept: a throwing push_back leaves cur_ as it was */
+		cur_ = chunks_.back().view.begin();
+		end_ = chunks_.back().view.end();
+	}
+
+	Arena &arena_;
+	const size_t chunk_size_;
+	const enum ArenaPolicy policy_;
+	std::vector<Chunk> chunks_;
+	unsigned char *cur_;
+	unsigned char *end_;
+};
+#endif /* ALIS_HAVE_PMR */
+
+} /* namespace alis */
+
+#endif /* alis.hpp */
@@ -15,15 +15,27 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+#define _GNU_SOURCE
 
 #include "arena.h"
+#include "arena_int.h"
+#include "bitset.h"
 #include "ceildiv.h"
 #include "mergeheap.h"
+#include "nstime.h"
+#include "stats_int.h"
 
 #include <ramses/binsearch.h>
 
 #include <alloca.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Larger merge heaps go on the heap rather than the stack */
+#define MHEAP_STACK_MAX (64 * 1024)
 
 
 static int rb_data_pgcnt_cmp(const void *rba, const void *rbb)
@@ -35,7 +47,7 @@ static int rb_data_pgcnt_cmp(const void *rba, const void *rbb)
 
 static heapkey_t ape_phys_key(const void *ape)
 {
-	return (heapkey_t)((struct ArenaPageEntry *)ape)->pa;
+	return (heapkey_t)((struct ArenaPageEntry *)ape)->pfn;
 }
 
 
@@ -51,7 +63,349 @@ void arena_update_totals(struct Arena *a, size_t start)
 	}
 }
 
-ticketid_t alis_arena_reserve(struct Arena *a, size_t size)
+static size_t min(size_t a, size_t b)
+{
+	return (a <= b) ? a : b;
+}
+
+static struct ArenaPageEntry *row_pgents(const struct Arena *a, size_t r)
+{
+	const struct ArenaRow *row = &(a->rows[r]);
+	return ((row->flags & ARENA_ROW_GUARD) ? a->guard_pgents : a->data_pgents) +
+	       row->pgents_off;
+}
+
+static size_t rb_guard_pgcnt(const struct Arena *a, const struct RowBlock *rb)
+{
+	return a->rows[rb->row_off - 1].pgcnt + a->rows[rb->row_off + rb->row_cnt].pgcnt;
+}
+
+/* Make room for `n' more row blocks; returns 0 on success */
+static int rb_grow(struct Arena *a, size_t n)
+{
+	if (a->rb_top + n <= a->rb_cap) {
+		return 0;
+	}
+	const size_t cap = a->rb_cap + (a->rb_cap / 2) + n;
+	struct RowBlock *rbs = realloc(a->rb_stack, cap * sizeof(*rbs));
+	if (rbs == NULL) {
+		return 1;
+	}
+	a->rb_stack = rbs;
+	size_t *totals = realloc(a->rb_pgtotals, cap * sizeof(*totals));
+	if (totals == NULL) {
+		return 1;
+	}
+	a->rb_pgtotals = totals;
+	ticketid_t *tickmap = realloc(a->rb_tickmap, cap * sizeof(*tickmap));
+	if (tickmap == NULL) {
+		return 1;
+	}
+	a->rb_tickmap = tickmap;
+	a->rb_cap = cap;
+	return 0;
+}
+
+static void rb_remove(struct Arena *a, size_t i)
+{
+	memmove(&(a->rb_stack[i]), &(a->rb_stack[i + 1]),
+	        (a->rb_top - i - 1) * sizeof(*a->rb_stack));
+	memmove(&(a->rb_tickmap[i]), &(a->rb_tickmap[i + 1]),
+	        (a->rb_top - i - 1) * sizeof(*a->rb_tickmap));
+	a->rb_top--;
+}
+
+/* Insert into a free slot, keeping rb_stack sorted by size; returns the index */
+static size_t rb_insert(struct Arena *a, const struct RowBlock *rb, ticketid_t t)
+{
+	size_t i = a->rb_top;
+	for (; i > 0 && a->rb_stack[i - 1].data_pgcnt > rb->data_pgcnt; i--) {
+		a->rb_stack[i] = a->rb_stack[i - 1];
+		a->rb_tickmap[i] = a->rb_tickmap[i - 1];
+	}
+	a->rb_stack[i] = *rb;
+	a->rb_tickmap[i] = t;
+	a->rb_top++;
+	return i;
+}
+
+/* Index of the row block whose rows start (or end, if `end') at `row' */
+static size_t rb_find(const struct Arena *a, size_t row, int end)
+{
+	for (size_t i = 0; i < a->rb_top; i++) {
+		const struct RowBlock *rb = &(a->rb_stack[i]);
+		if ((end ? rb->row_off + rb->row_cnt : rb->row_off) == row) {
+			return i;
+		}
+	}
+	return a->rb_top;
+}
+
+/*
+ * Huge pages are written through a mapping, as hugetlbfs does not support
+ * write(2); base pages are written with pwrite, which needs no TLB shootdown.
+ */
+static int fill_guard_row(const struct Arena *a, size_t r)
+{
+	const struct ArenaPageEntry *pgents = row_pgents(a, r);
+	if (a->page_size > (size_t)sysconf(_SC_PAGESIZE)) {
+		for (size_t i = 0; i < a->rows[r].pgcnt; i++) {
+			void *page = mmap(NULL, a->page_size, PROT_WRITE, MAP_SHARED, a->mfd,
+			                  ape_mfd_off(a, &pgents[i]));
+			if (page == MAP_FAILED) {
+				return 1;
+			}
+			memset(page, ARENA_GUARD_BYTE, a->page_size);
+			munmap(page, a->page_size);
+		}
+		return 0;
+	}
+	unsigned char *page = malloc(a->page_size);
+	if (page == NULL) {
+		return 1;
+	}
+	memset(page, ARENA_GUARD_BYTE, a->page_size);
+	int ret = 0;
+	for (size_t i = 0; i < a->rows[r].pgcnt && !ret; i++) {
+		ret = pwrite(a->mfd, page, a->page_size, ape_mfd_off(a, &pgents[i])) !=
+		      (ssize_t)a->page_size;
+	}
+	free(page);
+	return ret;
+}
+
+/*
+ * Cut `head' down to its fewest leading rows holding `need' pages. The row
+ * after them becomes a guard row and the rows past it are stored in `tail'.
+ * A row without pages of its own, all of them claimed through other rows,
+ * cannot serve as guard row.
+ * Returns 0 if the block was cut, 1 if it has to be taken whole.
+ */
+static int cut_block(struct Arena *a, struct RowBlock *head, size_t need,
+                     struct RowBlock *tail)
+{
+	size_t keep = 0;
+	size_t kept_pgcnt = 0;
+	while (keep < head->row_cnt && kept_pgcnt < need) {
+		kept_pgcnt += a->rows[head->row_off + keep].pgcnt;
+		keep++;
+	}
+	if (keep + 1 >= head->row_cnt) {
+		return 1;
+	}
+	const size_t cut = head->row_off + keep;
+	if (a->rows[cut].pgcnt == 0) {
+		return 1;
+	}
+	*tail = ((struct RowBlock){
+		.data_pgcnt = head->data_pgcnt - kept_pgcnt - a->rows[cut].pgcnt,
+		.data_pgents_off = a->rows[cut + 1].pgents_off,
+		.row_off = cut + 1,
+		.row_cnt = head->row_cnt - keep - 1,
+		.bank = head->bank,
+		.free_since = head->free_since
+	});
+	if (tail->data_pgcnt == 0 || fill_guard_row(a, cut)) {
+		return 1;
+	}
+	a->rows[cut].flags |= ARENA_ROW_CUT;
+	head->data_pgcnt = kept_pgcnt;
+	head->row_cnt = keep;
+	head->guard_pgcnt = rb_guard_pgcnt(a, head);
+	tail->guard_pgcnt = rb_guard_pgcnt(a, tail);
+	return 0;
+}
+
+/*
+ * Shrink the row block at `rbi' with cut_block, returning the rows cut off to
+ * the free pool; the pages given up are subtracted from `*allocd'.
+ * Returns the lowest rb_stack index touched, or rb_top if the block was left
+ * alone.
+ */
+static size_t split_block(struct Arena *a, size_t rbi, size_t need, size_t *allocd)
+{
+	struct RowBlock head = a->rb_stack[rbi];
+	struct RowBlock tail;
+	if (rb_grow(a, 1) || cut_block(a, &head, need, &tail)) {
+		return a->rb_top;
+	}
+	*allocd -= a->rb_stack[rbi].data_pgcnt - head.data_pgcnt;
+
+	const ticketid_t t = a->rb_tickmap[rbi];
+	rb_remove(a, rbi);
+	size_t lo = min(rbi, rb_insert(a, &head, t));
+	return min(lo, rb_insert(a, &tail, 0));
+}
+
+/*
+ * Merge the free row blocks at `li' and `ri', which lie on either side of a
+ * cut row. Returns the lowest rb_stack index touched.
+ */
+static size_t merge_blocks(struct Arena *a, size_t li, size_t ri)
+{
+	struct RowBlock m = a->rb_stack[li];
+	const struct RowBlock *right = &(a->rb_stack[ri]);
+	const size_t cut = m.row_off + m.row_cnt;
+	assert(right->row_off == cut + 1 && (a->rows[cut].flags & ARENA_ROW_CUT));
+	a->rows[cut].flags &= ~ARENA_ROW_CUT;
+	m.data_pgcnt += a->rows[cut].pgcnt + right->data_pgcnt;
+	m.row_cnt += 1 + right->row_cnt;
+	m.guard_pgcnt = rb_guard_pgcnt(a, &m);
+	if (right->free_since > m.free_since) {
+		m.free_since = right->free_since;
+	}
+
+	rb_remove(a, (li > ri) ? li : ri);
+	rb_remove(a, min(li, ri));
+	return min(min(li, ri), rb_insert(a, &m, 0));
+}
+
+/*
+ * Merge the free row block starting at `row' with free neighbours across cut
+ * rows. Returns the lowest rb_stack index touched, or rb_top.
+ */
+static size_t coalesce(struct Arena *a, size_t row)
+{
+	size_t lo = a->rb_top;
+	size_t i = rb_find(a, row, 0);
+	if (i == a->rb_top || a->rb_tickmap[i] != 0) {
+		return lo;
+	}
+	if (a->rows[row - 1].flags & ARENA_ROW_CUT) {
+		size_t l = rb_find(a, row - 1, 1);
+		if (l < a->rb_top && a->rb_tickmap[l] == 0) {
+			row = a->rb_stack[l].row_off;
+			lo = merge_blocks(a, l, i);
+			i = rb_find(a, row, 0);
+		}
+	}
+	const size_t end = a->rb_stack[i].row_off + a->rb_stack[i].row_cnt;
+	if (a->rows[end].flags & ARENA_ROW_CUT) {
+		size_t r = rb_find(a, end + 1, 0);
+		if (r < a->rb_top && a->rb_tickmap[r] == 0) {
+			lo = min(lo, merge_blocks(a, i, r));
+		}
+	}
+	return lo;
+}
+
+static int rb_row_off_cmp(const void *rba, const void *rbb)
+{
+	size_t a = ((struct RowBlock *)rba)->row_off;
+	size_t b = ((struct RowBlock *)rbb)->row_off;
+	return (a == b) ? 0 : ((a < b) ? -1 : 1);
+}
+
+/* Whether guard row `r' has a page that is also a data page */
+static int guard_shared(const struct Arena *a, size_t r)
+{
+	const struct ArenaRow *row = &(a->rows[r]);
+	if (a->guard_shared == NULL) {
+		return 0;
+	}
+	for (size_t i = row->pgents_off; i < row->pgents_off + row->pgcnt; i++) {
+		if (bitset_test(a->guard_shared, i)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Whether guard rows `r' and `r + 1', the post guard of one row block and the
+ * pre guard of the next, hold the same pages, i.e. the blocks are a row apart,
+ * and none of them belongs to a row block as well.
+ */
+static int guard_pair(const struct Arena *a, size_t r)
+{
+	const struct ArenaRow *post = &(a->rows[r]);
+	const struct ArenaRow *pre = &(a->rows[r + 1]);
+	return (post->flags & pre->flags & ARENA_ROW_GUARD) &&
+	       post->pgcnt > 0 && post->pgcnt == pre->pgcnt &&
+	       memcmp(row_pgents(a, r), row_pgents(a, r + 1),
+	              post->pgcnt * sizeof(struct ArenaPageEntry)) == 0 &&
+	       !guard_shared(a, r) && !guard_shared(a, r + 1);
+}
+
+static void set_lent(struct Arena *a, size_t r, int lent)
+{
+	struct ArenaRow *row = &(a->rows[r]);
+	row->flags = lent ? (row->flags | ARENA_ROW_LENT) : (row->flags & ~ARENA_ROW_LENT);
+	if (row->flags & ARENA_ROW_GUARD) {
+		for (size_t i = row->pgents_off; i < row->pgents_off + row->pgcnt; i++) {
+			if (lent) {
+				bitset_set(a->guard_lent, i);
+			} else {
+				bitset_clear(a->guard_lent, i);
+			}
+		}
+	}
+}
+
+/*
+ * Lend `ticket' the guard rows between its row blocks that lie one row apart:
+ * a cut row, or the post and pre guard rows holding the same pages.
+ */
+static void lend_rows(struct Arena *a, ticketid_t ticket)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < a->rb_top; i++) {
+		n += (a->rb_tickmap[i] == ticket);
+	}
+	struct RowBlock *rbs = (n > 1) ? malloc(n * sizeof(*rbs)) : NULL;
+	if (rbs == NULL) {
+		return;
+	}
+	n = 0;
+	for (size_t i = 0; i < a->rb_top; i++) {
+		if (a->rb_tickmap[i] == ticket) {
+			rbs[n++] = a->rb_stack[i];
+		}
+	}
+	qsort(rbs, n, sizeof(*rbs), rb_row_off_cmp);
+	for (size_t k = 0; k + 1 < n; k++) {
+		const size_t end = rbs[k].row_off + rbs[k].row_cnt;
+		if (rbs[k + 1].row_off == end + 1 && (a->rows[end].flags & ARENA_ROW_CUT)) {
+			set_lent(a, end, 1);
+		} else if (rbs[k + 1].row_off == end + 2 && guard_pair(a, end)) {
+			if (a->guard_lent == NULL) {
+				a->guard_lent = calloc(bitset_words(a->guard_pgents_size),
+				                       sizeof(*a->guard_lent));
+				if (a->guard_lent == NULL) {
+					continue;
+				}
+			}
+			set_lent(a, end, 1);
+			set_lent(a, end + 1, 1);
+		}
+	}
+	free(rbs);
+}
+
+/* Turn the rows lent on either side of `rb' back into guard rows */
+static void unlend_rows(struct Arena *a, const struct RowBlock *rb)
+{
+	const size_t pre = rb->row_off - 1;
+	const size_t end = rb->row_off + rb->row_cnt;
+	size_t posts[2];
+	size_t n = 0;
+	if (a->rows[pre].flags & ARENA_ROW_LENT) {
+		posts[n++] = (a->rows[pre].flags & ARENA_ROW_GUARD) ? pre - 1 : pre;
+	}
+	if (a->rows[end].flags & ARENA_ROW_LENT) {
+		posts[n++] = end;
+	}
+	for (size_t k = 0; k < n; k++) {
+		set_lent(a, posts[k], 0);
+		if (a->rows[posts[k]].flags & ARENA_ROW_GUARD) {
+			set_lent(a, posts[k] + 1, 0);
+		}
+		/* Wipe what the ticket stored there */
+		(void) fill_guard_row(a, posts[k]);
+	}
+}
+
+static ticketid_t reserve(struct Arena *a, size_t size)
 {
 	size_t pgcnt;
 	if (size) {
@@ -67,28 +421,30 @@ ticketid_t alis_arena_reserve(struct Arena *a, size_t size)
 		if (a->rb_stack[a->rb_top - 1].data_pgcnt <= pgcnt) {
 			sp = a->rb_top - 1;
 		} else {
-			struct RowBlock refrb = {pgcnt, 0, 0, 0};
+			struct RowBlock refrb = {.data_pgcnt = pgcnt};
 			bool found = binsearch(&refrb, a->rb_stack, a->rb_top,
 			                       sizeof(*a->rb_stack), rb_data_pgcnt_cmp, &sp);
-			if (!found) {
-				while (a->rb_pgtotals[sp] < pgcnt) {
-					sp++;
-				}
-				if ((a->rb_stack[sp+1].data_pgcnt / pgcnt) <
-				    (pgcnt / a->rb_stack[sp].data_pgcnt))
-				{
-					sp++;
-				}
+			/* A block of the exact size may be taken already */
+			while (a->rb_pgtotals[sp] < pgcnt) {
+				sp++;
+			}
+			if (!found && sp + 1 < a->rb_top &&
+			    (a->rb_stack[sp+1].data_pgcnt / pgcnt) <
+			    (pgcnt / a->rb_stack[sp].data_pgcnt))
+			{
+				sp++;
 			}
 		}
 		/* Perform reservation */
 		size_t allocd = 0;
+		size_t last = sp;
 		a->last_ticket++;
 		ticketid_t tkid = a->last_ticket;
 		while (allocd < pgcnt) {
 			if (a->rb_tickmap[sp] == 0) {
 				allocd += a->rb_stack[sp].data_pgcnt;
 				a->rb_tickmap[sp] = tkid;
+				last = sp;
 			}
 			if (sp == 0) {
 				break;
@@ -97,20 +453,460 @@ ticketid_t alis_arena_reserve(struct Arena *a, size_t size)
 			}
 		}
 		assert(allocd >= pgcnt);
+		/* Give back the unneeded rows of the last block taken */
+		if (allocd > pgcnt) {
+			const size_t need = a->rb_stack[last].data_pgcnt - (allocd - pgcnt);
+			sp = min(sp, split_block(a, last, need, &allocd));
+		}
+		lend_rows(a, tkid);
 		arena_update_totals(a, sp);
+		stats_pages(pgcnt, allocd);
 		return tkid;
 	} else {
 		return 0;
 	}
 }
 
+/*
+ * Return the position in `bucket[lo, hi)' (free row blocks of one bank, sorted
+ * by size) of the smallest block holding at least `want' pages, or of the
+ * largest one if none does. Blocks reserved since bucketing are skipped.
+ */
+static size_t pick_block(const struct Arena *a, const size_t *bucket,
+                         size_t lo, size_t hi, size_t want)
+{
+	size_t best = hi;
+	for (size_t i = lo; i < hi; i++) {
+		if (a->rb_tickmap[bucket[i]] == 0) {
+			best = i;
+			if (a->rb_stack[bucket[i]].data_pgcnt >= want) {
+				break;
+			}
+		}
+	}
+	assert(best < hi);
+	return best;
+}
+
+static ticketid_t reserve_spread(struct Arena *a, size_t pgcnt, int balance)
+{
+	const size_t nb = a->bank_cnt;
+	if (a->rb_top == 0 || a->last_ticket >= TICKET_MAX ||
+	    pgcnt > a->rb_pgtotals[a->rb_top - 1])
+	{
+		return 0;
+	}
+	size_t *bstart = calloc(3 * nb + 1, sizeof(*bstart));
+	size_t *bucket = malloc(a->rb_top * sizeof(*bucket));
+	if (bstart == NULL || bucket == NULL) {
+		free(bstart);
+		free(bucket);
+		return 0;
+	}
+	size_t *bpos = bstart + nb + 1;
+	size_t *bfree = bpos + nb;
+
+	/* Bucket free row blocks by bank; rb_stack order keeps buckets sorted */
+	for (size_t i = 0; i < a->rb_top; i++) {
+		if (a->rb_tickmap[i] == 0) {
+			bfree[a->rb_stack[i].bank]++;
+		}
+	}
+	size_t active = 0;
+	for (size_t b = 0; b < nb; b++) {
+		bstart[b + 1] = bstart[b] + bfree[b];
+		bpos[b] = bstart[b];
+		active += (bfree[b] > 0);
+	}
+	for (size_t i = 0; i < a->rb_top; i++) {
+		if (a->rb_tickmap[i] == 0) {
+			bucket[bpos[a->rb_stack[i].bank]++] = i;
+		}
+	}
+
+	/* Round-robin over the banks, asking each for an equal share */
+	a->last_ticket++;
+	ticketid_t tkid = a->last_ticket;
+	size_t allocd = 0;
+	size_t minrb = a->rb_top;
+	size_t last = 0;
+	while (allocd < pgcnt) {
+		assert(active > 0);
+		for (size_t b = 0; b < nb && (balance || allocd < pgcnt); b++) {
+			if (bfree[b] == 0) {
+				continue;
+			}
+			const size_t want = (allocd < pgcnt) ? ceildiv(pgcnt - allocd, active) : 1;
+			const size_t rbi = bucket[pick_block(a, bucket, bstart[b], bstart[b + 1], want)];
+			a->rb_tickmap[rbi] = tkid;
+			allocd += a->rb_stack[rbi].data_pgcnt;
+			minrb = min(rbi, minrb);
+			last = rbi;
+			if (--bfree[b] == 0) {
+				active--;
+			}
+		}
+	}
+	free(bstart);
+	free(bucket);
+	if (!balance && allocd > pgcnt) {
+		const size_t need = a->rb_stack[last].data_pgcnt - (allocd - pgcnt);
+		minrb = min(minrb, split_block(a, last, need, &allocd));
+	}
+	lend_rows(a, tkid);
+	arena_update_totals(a, minrb);
+	stats_pages(pgcnt, allocd);
+	return tkid;
+}
+
+ticketid_t alis_arena_reserve(struct Arena *a, size_t size)
+{
+	uint64_t t0 = stats_begin();
+	ticketid_t t = reserve(a, size);
+	stats_end(ALIS_OP_RESERVE, t0, t == 0);
+	return t;
+}
+
+ticketid_t alis_arena_reserve_policy(struct Arena *a, size_t size,
+                                     enum ArenaPolicy policy)
+{
+	uint64_t t0 = stats_begin();
+	ticketid_t t;
+	if (policy == ARENA_POLICY_BESTFIT || a->bank_cnt == 0 || size == 0) {
+		t = reserve(a, size);
+	} else {
+		t = reserve_spread(a, ceildiv(size, a->page_size),
+		                   policy == ARENA_POLICY_MAXBW);
+	}
+	stats_end(ALIS_OP_RESERVE, t0, t == 0);
+	return t;
+}
+
+struct batch_req {
+	size_t pgcnt;
+	size_t idx;
+};
+
+static int batch_req_cmp(const void *ra, const void *rb)
+{
+	const struct batch_req *a = ra;
+	const struct batch_req *b = rb;
+	if (a->pgcnt != b->pgcnt) {
+		return (a->pgcnt < b->pgcnt) ? -1 : 1;
+	}
+	return (a->idx < b->idx) ? -1 : (a->idx > b->idx);
+}
+
+struct batch_piece {
+	struct RowBlock rb;
+	ticketid_t ticket;
+};
+
+static int batch_piece_cmp(const void *pa, const void *pb)
+{
+	return rb_data_pgcnt_cmp(&(((const struct batch_piece *)pa)->rb),
+	                         &(((const struct batch_piece *)pb)->rb));
+}
+
+/*
+ * Replace the row blocks flagged in `carved' with the `np' pieces cut from
+ * them, keeping rb_stack sorted by size. rb_stack must have room for them.
+ */
+static void rb_replace(struct Arena *a, const unsigned char *carved,
+                       struct batch_piece *pieces, size_t np)
+{
+	size_t m = 0;
+	for (size_t i = 0; i < a->rb_top; i++) {
+		if (!carved[i]) {
+			a->rb_stack[m] = a->rb_stack[i];
+			a->rb_tickmap[m] = a->rb_tickmap[i];
+			m++;
+		}
+	}
+	qsort(pieces, np, sizeof(*pieces), batch_piece_cmp);
+	/* Merge from the back so neither list is overwritten before it is read */
+	size_t i = m;
+	size_t j = np;
+	a->rb_top = m + np;
+	for (size_t k = a->rb_top; j > 0; k--) {
+		if (i > 0 && a->rb_stack[i - 1].data_pgcnt > pieces[j - 1].rb.data_pgcnt) {
+			a->rb_stack[k - 1] = a->rb_stack[i - 1];
+			a->rb_tickmap[k - 1] = a->rb_tickmap[i - 1];
+			i--;
+		} else {
+			a->rb_stack[k - 1] = pieces[j - 1].rb;
+			a->rb_tickmap[k - 1] = pieces[j - 1].ticket;
+			j--;
+		}
+	}
+}
+
+/*
+ * Place the requests in `reqs' (sorted by size) that fit in a single free row
+ * block, in one pass over rb_stack. Requests are carved off the smallest block
+ * that holds them, and consecutive requests share a block while it has room,
+ * so the stack is rebuilt and its totals updated once at the end.
+ * Returns the number of requests placed; the rest are left for reserve().
+ */
+static size_t place_batch(struct Arena *a, const struct batch_req *reqs, size_t n,
+                          ticketid_t *tickets)
+{
+	/* Each placement adds at most one row block and one piece */
+	unsigned char *carved = calloc(a->rb_top, sizeof(*carved));
+	struct batch_piece *pieces = malloc(2 * n * sizeof(*pieces));
+	if (carved == NULL || pieces == NULL || rb_grow(a, n)) {
+		free(carved);
+		free(pieces);
+		return 0;
+	}
+	size_t np = 0;
+	size_t placed = 0;
+	size_t cur = 0;
+	struct RowBlock open;
+	int have_open = 0;
+	for (; placed < n && a->last_ticket < TICKET_MAX; placed++) {
+		const size_t pgcnt = reqs[placed].pgcnt;
+		if (!have_open || open.data_pgcnt < pgcnt) {
+			if (have_open) {
+				pieces[np++] = ((struct batch_piece){open, 0});
+				have_open = 0;
+			}
+			while (cur < a->rb_top &&
+			       (a->rb_tickmap[cur] != 0 || a->rb_stack[cur].data_pgcnt < pgcnt))
+			{
+				cur++;
+			}
+			if (cur == a->rb_top) {
+				break;
+			}
+			open = a->rb_stack[cur];
+			carved[cur++] = 1;
+			have_open = 1;
+		}
+		struct RowBlock head = open;
+		if (cut_block(a, &head, pgcnt, &open) != 0) {
+			have_open = 0;
+		}
+		a->last_ticket++;
+		tickets[reqs[placed].idx] = a->last_ticket;
+		pieces[np++] = ((struct batch_piece){head, a->last_ticket});
+		stats_pages(pgcnt, head.data_pgcnt);
+	}
+	if (have_open) {
+		pieces[np++] = ((struct batch_piece){open, 0});
+	}
+	rb_replace(a, carved, pieces, np);
+	arena_update_totals(a, 0);
+	free(carved);
+	free(pieces);
+	return placed;
+}
+
+/* Trimmed blocks are only handed back by alis_arena_repopulate */
+static int releasable(const struct Arena *a, size_t i, ticketid_t first, ticketid_t last)
+{
+	const ticketid_t t = a->rb_tickmap[i];
+	return t > first && t <= last && t != a->trim_ticket;
+}
+
+/*
+ * Release the reservations with tickets in (first, last] and merge the freed
+ * row blocks with their free neighbours. Returns the number of blocks freed.
+ */
+static size_t release_range(struct Arena *a, ticketid_t first, ticketid_t last)
+{
+	size_t freed = 0;
+	for (size_t i = 0; i < a->rb_top; i++) {
+		freed += releasable(a, i, first, last);
+	}
+	/* Row offsets stay put while blocks move around rb_stack during merges */
+	size_t *rows = freed ? malloc(freed * sizeof(*rows)) : NULL;
+	const uint64_t now = freed ? nstime() : 0;
+	size_t lo = a->rb_top;
+	size_t n = 0;
+	for (size_t i = a->rb_top; i --> 0;) {
+		if (releasable(a, i, first, last)) {
+			unlend_rows(a, &(a->rb_stack[i]));
+			a->rb_tickmap[i] = 0;
+			a->rb_stack[i].free_since = now;
+			lo = i;
+			if (rows != NULL) {
+				rows[n++] = a->rb_stack[i].row_off;
+			}
+		}
+	}
+	for (size_t i = 0; i < n; i++) {
+		lo = min(lo, coalesce(a, rows[i]));
+	}
+	free(rows);
+	arena_update_totals(a, lo);
+	return freed;
+}
+
+static size_t reserve_batch(struct Arena *a, const size_t *sizes, size_t n,
+                            ticketid_t *tickets, int atomic)
+{
+	if (n == 0) {
+		return 0;
+	}
+	struct batch_req *reqs = malloc(n * sizeof(*reqs));
+	if (reqs == NULL) {
+		return 0;
+	}
+	size_t nr = 0;
+	size_t total = 0;
+	for (size_t i = 0; i < n; i++) {
+		tickets[i] = 0;
+		if (sizes[i] != 0) {
+			reqs[nr++] = ((struct batch_req){ceildiv(sizes[i], a->page_size), i});
+			total += reqs[nr - 1].pgcnt;
+		}
+	}
+	const ticketid_t first = a->last_ticket;
+	if (atomic &&
+	    (nr < n || a->rb_top == 0 || total > a->rb_pgtotals[a->rb_top - 1] ||
+	     (size_t)(TICKET_MAX - a->last_ticket) < n))
+	{
+		free(reqs);
+		return 0;
+	}
+	qsort(reqs, nr, sizeof(*reqs), batch_req_cmp);
+	size_t placed = (a->rb_top > 0) ? place_batch(a, reqs, nr, tickets) : 0;
+	/* Requests larger than any free row block need several */
+	for (size_t i = placed; i < nr; i++) {
+		tickets[reqs[i].idx] = reserve(a, sizes[reqs[i].idx]);
+		placed += (tickets[reqs[i].idx] != 0);
+	}
+	free(reqs);
+	if (atomic && placed < n) {
+		release_range(a, first, a->last_ticket);
+		a->last_ticket = first;
+		memset(tickets, 0, n * sizeof(*tickets));
+		return 0;
+	}
+	return placed;
+}
+
+size_t alis_arena_reserve_batch(struct Arena *a, const size_t *sizes, size_t n,
+                                ticketid_t *tickets)
+{
+	uint64_t t0 = stats_begin();
+	size_t placed = reserve_batch(a, sizes, n, tickets, 0);
+	stats_end(ALIS_OP_RESERVE, t0, placed < n);
+	return placed;
+}
+
+int alis_arena_reserve_batch_all(struct Arena *a, const size_t *sizes, size_t n,
+                                 ticketid_t *tickets)
+{
+	uint64_t t0 = stats_begin();
+	size_t placed = reserve_batch(a, sizes, n, tickets, 1);
+	stats_end(ALIS_OP_RESERVE, t0, placed < n);
+	return placed < n;
+}
+
+/*
+ * Store the first rows of the row blocks bordering `ticket's across a cut row
+ * in `rows' (room for two per block of `ticket'), if they are free or, with
+ * `own', belong to `ticket' too. Returns the number of rows stored.
+ */
+static size_t cut_neighbours(const struct Arena *a, ticketid_t ticket, int own,
+                             size_t *rows)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < a->rb_top; i++) {
+		if (a->rb_tickmap[i] != ticket) {
+			continue;
+		}
+		const struct RowBlock *rb = &(a->rb_stack[i]);
+		const size_t end = rb->row_off + rb->row_cnt;
+		if (a->rows[rb->row_off - 1].flags & ARENA_ROW_CUT) {
+			size_t l = rb_find(a, rb->row_off - 1, 1);
+			/* Cuts between two blocks of `ticket' are counted from the left */
+			if (l < a->rb_top && a->rb_tickmap[l] == 0) {
+				rows[n++] = a->rb_stack[l].row_off;
+			}
+		}
+		if (a->rows[end].flags & ARENA_ROW_CUT) {
+			size_t r = rb_find(a, end + 1, 0);
+			if (r < a->rb_top &&
+			    (a->rb_tickmap[r] == 0 || (own && a->rb_tickmap[r] == ticket)))
+			{
+				rows[n++] = end + 1;
+			}
+		}
+	}
+	return n;
+}
+
+static size_t ticket_blocks(const struct Arena *a, ticketid_t ticket)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < a->rb_top; i++) {
+		n += (a->rb_tickmap[i] == ticket);
+	}
+	return n;
+}
+
+size_t arena_release_merges(const struct Arena *a, ticketid_t ticket)
+{
+	const size_t nb = ticket_blocks(a, ticket);
+	size_t *rows = nb ? malloc(2 * nb * sizeof(*rows)) : NULL;
+	if (rows == NULL) {
+		return 0;
+	}
+	const size_t n = cut_neighbours(a, ticket, 1, rows);
+	free(rows);
+	return n;
+}
+
+ticketid_t arena_reserve_away(struct Arena *a, size_t size, ticketid_t ticket)
+{
+	const size_t nb = ticket_blocks(a, ticket);
+	size_t *rows = nb ? malloc(2 * nb * sizeof(*rows)) : NULL;
+	if (rows == NULL) {
+		return nb ? 0 : reserve(a, size);
+	}
+	/* Hide the free neighbours from reserve() by lending them the ticket */
+	const size_t n = cut_neighbours(a, ticket, 0, rows);
+	for (size_t k = 0; k < n; k++) {
+		a->rb_tickmap[rb_find(a, rows[k], 0)] = ticket;
+	}
+	arena_update_totals(a, 0);
+	ticketid_t t = reserve(a, size);
+	for (size_t k = 0; k < n; k++) {
+		a->rb_tickmap[rb_find(a, rows[k], 0)] = 0;
+	}
+	arena_update_totals(a, 0);
+	free(rows);
+	return t;
+}
+
+void arena_free_block(struct Arena *a, size_t row)
+{
+	const size_t i = rb_find(a, row, 0);
+	unlend_rows(a, &(a->rb_stack[i]));
+	a->rb_tickmap[i] = 0;
+	a->rb_stack[i].free_since = nstime();
+	arena_update_totals(a, min(i, coalesce(a, row)));
+}
+
+void arena_drop_block(struct Arena *a, size_t row)
+{
+	const size_t i = rb_find(a, row, 0);
+	rb_remove(a, i);
+	if (a->rb_top > 0) {
+		arena_update_totals(a, min(i, a->rb_top - 1));
+	}
+}
+
 enum writeval {
 	MFD_OFF,
 	PHYS_ADDR
 };
 
-static void writeout(struct MergeHeap *mh, enum writeval wval,
-                     void *out, size_t max_chunks)
+static void writeout(struct Arena *a, struct MergeHeap *mh,
+                     enum writeval wval, void *out, size_t max_chunks)
 {
 	struct ArenaPageEntry *last = NULL;
 	struct ArenaPageEntry *p = (struct ArenaPageEntry *)mheap_next(mh);
@@ -118,13 +914,13 @@ static void writeout(struct MergeHeap *mh, enum writeval wval,
 	     p && i < max_chunks;
 	     p = (struct ArenaPageEntry *)mheap_next(mh))
 	{
-		if (!last || last->pa != p->pa) {
+		if (!last || last->pfn != p->pfn) {
 			switch (wval) {
 				case MFD_OFF:
-					((off_t *)out)[i++] = p->mfd_off;
+					((off_t *)out)[i++] = ape_mfd_off(a, p);
 					break;
 				case PHYS_ADDR:
-					((physaddr_t *)out)[i++] = p->pa;
+					((physaddr_t *)out)[i++] = ape_pa(a, p);
 					break;
 			}
 		}
@@ -143,18 +939,27 @@ static size_t fill_mergeheap(struct Arena *a, ticketid_t ticket, size_t sp,
 	size_t totalchunks = 0;
 	do {
 		if (a->rb_tickmap[sp] == ticket) {
+			const struct RowBlock *rb = &(a->rb_stack[sp]);
+			const size_t post = rb->row_off + rb->row_cnt;
 			switch (ct) {
 				case DATA_CHUNKS:
-					mheap_insert(mh,
-					             &(a->data_pgents[a->rb_stack[sp].data_pgents_off]),
-					             a->rb_stack[sp].data_pgcnt);
-					totalchunks += a->rb_stack[sp].data_pgcnt;
+					for (size_t r = rb->row_off; r < post; r++) {
+						mheap_insert(mh, row_pgents(a, r), a->rows[r].pgcnt);
+					}
+					totalchunks += rb->data_pgcnt;
+					/* A lent row is handed out with the block before it */
+					if (a->rows[post].flags & ARENA_ROW_LENT) {
+						mheap_insert(mh, row_pgents(a, post), a->rows[post].pgcnt);
+						totalchunks += a->rows[post].pgcnt;
+					}
 					break;
 				case GUARD_CHUNKS:
-					mheap_insert(mh,
-					             &(a->guard_pgents[a->rb_stack[sp].guard_pgents_off]),
-					             a->rb_stack[sp].guard_pgcnt);
-					totalchunks += a->rb_stack[sp].guard_pgcnt;
+					for (size_t r = rb->row_off - 1; r <= post; r += rb->row_cnt + 1) {
+						if (!(a->rows[r].flags & ARENA_ROW_LENT)) {
+							mheap_insert(mh, row_pgents(a, r), a->rows[r].pgcnt);
+							totalchunks += a->rows[r].pgcnt;
+						}
+					}
 					break;
 				default:
 					return 0;
@@ -164,27 +969,50 @@ static size_t fill_mergeheap(struct Arena *a, ticketid_t ticket, size_t sp,
 	return totalchunks;
 }
 
-static size_t get_chunks(struct Arena *a, ticketid_t ticket, enum chunktype ct,
-                         enum writeval wval, void *outbuf, size_t max_chunks)
+static size_t collect_chunks(struct Arena *a, ticketid_t ticket,
+                             enum chunktype ct, enum writeval wval,
+                             void *outbuf, size_t max_chunks)
 {
 	size_t sp;
 	for (sp = a->rb_top - 1; sp && a->rb_tickmap[sp] != ticket; sp--);
 	if (a->rb_tickmap[sp] == ticket) {
-		/* Prepare merge heap */
-		const size_t heapsz = mheap_calcsize(sp + 1);
-		struct MergeHeap *mh = alloca(sizeof(*mh) + heapsz * sizeof(*mh->heap));
+		/* Prepare merge heap, with one sorted list per row */
+		size_t lists = 0;
+		for (size_t i = 0; i <= sp; i++) {
+			if (a->rb_tickmap[i] == ticket) {
+				lists += (ct == DATA_CHUNKS) ? a->rb_stack[i].row_cnt + 1 : 2;
+			}
+		}
+		const size_t heapsz = mheap_calcsize(lists);
+		const size_t mhlen = sizeof(struct MergeHeap) + heapsz * sizeof(struct HeapNode);
+		struct MergeHeap *mh = (mhlen > MHEAP_STACK_MAX) ? malloc(mhlen) : alloca(mhlen);
+		if (mh == NULL) {
+			return 0;
+		}
 		mh->size = heapsz;
 		mh->top = 0;
 		mh->elem_size = sizeof(struct ArenaPageEntry);
 		mh->key_fn = ape_phys_key;
 		size_t totalchunks = fill_mergeheap(a, ticket, sp, ct, mh);
-		writeout(mh, wval, outbuf, max_chunks);
+		writeout(a, mh, wval, outbuf, max_chunks);
+		if (mhlen > MHEAP_STACK_MAX) {
+			free(mh);
+		}
 		return totalchunks;
 	} else {
 		return 0;
 	}
 }
 
+static size_t get_chunks(struct Arena *a, ticketid_t ticket, enum chunktype ct,
+                         enum writeval wval, void *outbuf, size_t max_chunks)
+{
+	uint64_t t0 = stats_begin();
+	size_t r = collect_chunks(a, ticket, ct, wval, outbuf, max_chunks);
+	stats_end(ALIS_OP_GET, t0, r == 0);
+	return r;
+}
+
 size_t alis_arena_get_data(struct Arena *a, ticketid_t ticket,
                            off_t *offsets, size_t max_chunks)
 {
@@ -209,14 +1037,10 @@ size_t alis_arena_get_guard_physaddr(struct Arena *a, ticketid_t ticket,
 	return get_chunks(a, ticket, GUARD_CHUNKS, PHYS_ADDR, addrs, max_chunks);
 }
 
-void alis_arena_release(struct Arena *a, ticketid_t ticket)
+size_t alis_arena_release(struct Arena *a, ticketid_t ticket)
 {
-	size_t min = a->rb_top;
-	for (size_t i = a->rb_top; i --> 0;) {
-		if (a->rb_tickmap[i] == ticket) {
-			a->rb_tickmap[i] = 0;
-			min = i;
-		}
-	}
-	arena_update_totals(a, min);
+	uint64_t t0 = stats_begin();
+	size_t freed = (ticket != 0) ? release_range(a, ticket - 1, ticket) : 0;
+	stats_end(ALIS_OP_RELEASE, t0, freed == 0);
+	return freed;
 }
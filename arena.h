@@ -13,16 +13,48 @@
 #include <stddef.h>
 #include <sys/types.h>
 
+/*
+ * Page entries hold page numbers rather than addresses, which limits both the
+ * backing file and physical memory to 2^32 pages (16 TiB with 4 KiB pages).
+ */
+typedef uint32_t pgnum_t;
+#define PGNUM_MAX UINT32_MAX
+
 struct ArenaPageEntry {
-	physaddr_t pa;
-	off_t mfd_off;
+	pgnum_t pfn;
+	pgnum_t mfd_pgoff;
+};
+
+/* Guard pages are filled with this byte */
+#define ARENA_GUARD_BYTE 0xAA
+
+/*
+ * The pages of one DRAM row, sorted by pfn. Data rows live in data_pgents,
+ * the guard rows bounding each row block built by the arena in guard_pgents.
+ */
+struct ArenaRow {
+	size_t pgents_off;
+	size_t pgcnt;
+	unsigned flags;
 };
 
+#define ARENA_ROW_GUARD 0x1 /* Pages are in guard_pgents */
+#define ARENA_ROW_CUT   0x2 /* Data row serving as guard after a split */
+#define ARENA_ROW_LENT  0x4 /* Guard row between two row blocks of one ticket, lent to it as data */
+
+/*
+ * A row block covers data rows [row_off, row_off + row_cnt) of Arena.rows; the
+ * rows right before and after it are its guard rows. Its data pages are
+ * contiguous in data_pgents, sorted by pfn row by row.
+ */
 struct RowBlock {
 	size_t data_pgcnt;
 	size_t data_pgents_off;
 	size_t guard_pgcnt;
-	size_t guard_pgents_off;
+	size_t row_off;
+	size_t row_cnt;
+	uint32_t bank; /* Index into Arena.banks */
+	uint64_t free_since; /* nstime() of its last release or trim, or of arena creation */
 };
 
 #define TICKET_MAX 0xffff
@@ -42,19 +74,96 @@ struct Arena {
 	ticketid_t *rb_tickmap;
 	ticketid_t last_ticket;
 	int mfd;
+
+	/* Capacity of rb_stack, rb_pgtotals and rb_tickmap; splits add blocks */
+	size_t rb_cap;
+	struct ArenaRow *rows;
+	size_t row_cnt;
+
+	/*
+	 * DRAM banks holding the row blocks (row and col are 0), ordered so that
+	 * consecutive indexes differ in channel first, then DIMM, rank and bank.
+	 * bank_cnt is 0 if the arena carries no placement information.
+	 */
+	struct DRAMAddr *banks;
+	size_t bank_cnt;
+
+	/* Holds the row blocks whose pages alis_arena_trim gave back; 0 if none */
+	ticketid_t trim_ticket;
+
+	/* Bitset of the guard_pgents in ARENA_ROW_LENT rows; NULL until a row is lent */
+	uint64_t *guard_lent;
+	/* Bitset of the guard_pgents that are data pages too; NULL if there are none */
+	uint64_t *guard_shared;
+};
+
+enum ArenaPolicy {
+	/* Fewest, best-fitting row blocks regardless of placement */
+	ARENA_POLICY_BESTFIT = 0,
+	/* Take row blocks from the banks in turn, best fitting per bank */
+	ARENA_POLICY_SPREAD,
+	/*
+	 * Like ARENA_POLICY_SPREAD, but finish the last round so every bank used
+	 * contributes equally; may reserve noticeably more than requested.
+	 */
+	ARENA_POLICY_MAXBW
 };
 
+static inline physaddr_t ape_pa(const struct Arena *a,
+                                const struct ArenaPageEntry *ape)
+{
+	return (physaddr_t)ape->pfn * a->page_size;
+}
+
+static inline off_t ape_mfd_off(const struct Arena *a,
+                                const struct ArenaPageEntry *ape)
+{
+	return (off_t)ape->mfd_pgoff * a->page_size;
+}
+
 /*
  * Reserve an isolated area of memory of minimum length `size'.
  * If `size' is 0, reserves all free pages in the arena.
+ * If the last row block taken has rows to spare, it is split: the row after
+ * the rows kept becomes a guard row and the rest is returned to the free pool.
+ * The guard row between two row blocks taken that lie one row apart is lent to
+ * the reservation as data, and becomes a guard row again on release; rows with
+ * pages that are also data pages of some row block are never lent.
+ * Released pieces are merged back with free neighbours.
  *
  * On success, returns a non-zero ticket id associated with the reservation.
  * On failure or if arena is full, returns 0.
  */
 ticketid_t alis_arena_reserve(struct Arena *arena, size_t size);
+/*
+ * Like alis_arena_reserve, choosing row blocks according to `policy' so the
+ * reservation is spread over channels, ranks and banks for bandwidth.
+ * Falls back to ARENA_POLICY_BESTFIT for arenas without placement information
+ * and when `size' is 0.
+ */
+ticketid_t alis_arena_reserve_policy(struct Arena *arena, size_t size,
+                                     enum ArenaPolicy policy);
+
+/*
+ * Reserve `n' areas at once, storing the ticket for `sizes[i]' in `tickets[i]',
+ * or 0 if that area could not be reserved. Sizes of 0 are never reserved.
+ * Requests fitting in a single free row block are placed in one pass, smallest
+ * first, with consecutive requests cut from the same block while it has room;
+ * larger ones are reserved as by alis_arena_reserve.
+ *
+ * Returns the number of areas reserved.
+ */
+size_t alis_arena_reserve_batch(struct Arena *arena, const size_t *sizes,
+                                size_t n, ticketid_t *tickets);
+/*
+ * Like alis_arena_reserve_batch, but reserves either all `n' areas or none.
+ * Returns 0 on success; on failure, all of `tickets' are 0.
+ */
+int alis_arena_reserve_batch_all(struct Arena *arena, const size_t *sizes,
+                                 size_t n, ticketid_t *tickets);
 
 /*
- * Obtain the data pages reserved by `ticket'.
+ * Obtain the data pages reserved by `ticket', including lent guard rows.
  * Stores in `*offsets' up to `max_chunks' offsets into the mfd, which need
  * to be mapped into a process' address space; returns the *total* number of
  * pages reserved, which may be greater than `max_chunks'.
@@ -62,7 +171,7 @@ ticketid_t alis_arena_reserve(struct Arena *arena, size_t size);
 size_t alis_arena_get_data(struct Arena *arena, ticketid_t ticket,
                            off_t *offsets, size_t max_chunks);
 /*
- * Obtain the guard pages reserved by `ticket'.
+ * Obtain the guard pages reserved by `ticket', leaving out lent guard rows.
  * Stores in `*offsets' up to `max_chunks' offsets into the mfd, which need
  * to be mapped into a process' address space; returns the *total* number of
  * pages reserved, which may be greater than `max_chunks'.
@@ -78,7 +187,9 @@ size_t alis_arena_get_guard_physaddr(struct Arena *a, ticketid_t ticket,
 /*
  * Release the data and guard pages associated with the reservation identified
  * by `ticket'.
+ * Returns the number of row blocks freed, 0 if `ticket' holds none, e.g.
+ * because it was released before.
  */
-void alis_arena_release(struct Arena *a, ticketid_t ticket);
+size_t alis_arena_release(struct Arena *a, ticketid_t ticket);
 
 #endif /* arena.h */
@@ -9,5 +9,28 @@
 
 /* Updates the a->rb_pgtotals structure */
 void arena_update_totals(struct Arena *a, size_t start);
+/*
+ * Number of merges releasing `ticket' would cause: cut rows between its row
+ * blocks, and between them and free ones.
+ */
+size_t arena_release_merges(const struct Arena *a, ticketid_t ticket);
+/*
+ * Like alis_arena_reserve, but leaves alone the free row blocks that releasing
+ * `ticket' would merge with.
+ */
+ticketid_t arena_reserve_away(struct Arena *a, size_t size, ticketid_t ticket);
+/* Free the row block starting at `row' and merge it with free neighbours */
+void arena_free_block(struct Arena *a, size_t row);
+/*
+ * Remove the row block starting at `row' from the arena for good; its rows
+ * are left in Arena.rows, but no block refers to them any more.
+ */
+void arena_drop_block(struct Arena *a, size_t row);
+/*
+ * Fault in `len' bytes at `buf' with up to `nthreads' threads, in chunks
+ * aligned to 2 MiB so huge pages are not split between threads.
+ * The caller still has to mlock; on populated memory that is cheap.
+ */
+void arena_prefault(void *buf, size_t len, size_t page_size, size_t nthreads);
 
 #endif /* arena_int.h */
@@ -19,7 +19,11 @@
 
 #include "arena_mgmt.h"
 #include "arena_int.h"
+#include "bitset.h"
+#include "rsort.h"
 #include "ceildiv.h"
+#include "nstime.h"
+#include "xlate.h"
 
 #include <ramses/bufmap.h>
 #include <ramses/translate/pagemap.h>
@@ -31,14 +35,16 @@
 #include <string.h>
 #include <errno.h>
 
+#include <pthread.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/syscall.h>
 #include <fcntl.h>
+#include <linux/mempolicy.h>
 
-#define GUARD_BYTE	0xAA
 #define MINALEN		(32 * 1024 * 1024)
 #define MA_THRESH	(128 * 1024 * 1024)
+#define PREFAULT_ALIGN	(2 * 1024 * 1024)
 
 static size_t min(size_t a, size_t b)
 {
@@ -66,31 +72,222 @@ static size_t getalen(size_t hint, size_t shft)
 	return (ret >= MINALEN) ? ret : MINALEN;
 }
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
-static size_t bm_get_entry_ptes(struct BufferMap *bm, size_t ri, size_t off,
+static int bind_node(void *buf, size_t len, int node)
+{
+	const size_t ULBITS = 8 * sizeof(unsigned long);
+	const size_t masklen = (node / ULBITS) + 1;
+	unsigned long nodemask[masklen];
+	memset(nodemask, 0, sizeof(nodemask));
+	nodemask[node / ULBITS] = 1UL << (node % ULBITS);
+	return (int)syscall(SYS_mbind, buf, len, MPOL_BIND, nodemask,
+	                    masklen * ULBITS + 1, MPOL_MF_STRICT);
+}
+
+struct prefault_job {
+	char *start;
+	size_t len;
+	size_t page_size;
+};
+
+static void *prefault_worker(void *arg)
+{
+	struct prefault_job *job = arg;
+	#ifdef MADV_POPULATE_WRITE
+	if (madvise(job->start, job->len, MADV_POPULATE_WRITE) == 0) {
+		return NULL;
+	}
+	#endif
+	for (size_t off = 0; off < job->len; off += job->page_size) {
+		((volatile char *)job->start)[off] = 0;
+	}
+	return NULL;
+}
+
+void arena_prefault(void *buf, size_t len, size_t page_size, size_t nthreads)
+{
+	const size_t chunk = ceildiv(ceildiv(len, nthreads), PREFAULT_ALIGN) * PREFAULT_ALIGN;
+	const size_t njobs = ceildiv(len, chunk);
+	pthread_t tids[njobs];
+	int started[njobs];
+	struct prefault_job jobs[njobs];
+	for (size_t i = 0; i < njobs; i++) {
+		jobs[i] = ((struct prefault_job){
+			.start = (char *)buf + (i * chunk),
+			.len = min(chunk, len - (i * chunk)),
+			.page_size = page_size
+		});
+		/* The calling thread takes the last chunk itself */
+		started[i] = (i + 1 < njobs) &&
+		             pthread_create(&tids[i], NULL, prefault_worker, &jobs[i]) == 0;
+		if (!started[i]) {
+			prefault_worker(&jobs[i]);
+		}
+	}
+	for (size_t i = 0; i < njobs; i++) {
+		if (started[i]) {
+			pthread_join(tids[i], NULL);
+		}
+	}
+}
+
+/* Charges the time since `*t' to `phase' and restarts the clock */
+static void lap(struct ArenaIterStats *its, enum ArenaPhase phase, uint64_t *t)
+{
+	uint64_t now = nstime();
+	its->phase_ns[phase] += now - *t;
+	*t = now;
+}
+
+static void commit_iter(struct ArenaStats *stats, const struct ArenaOptions *opts,
+                        size_t itcnt, const struct ArenaIterStats *its)
+{
+	if (stats != NULL) {
+		for (int p = 0; p < ARENA_PHASE_COUNT; p++) {
+			stats->total.phase_ns[p] += its->phase_ns[p];
+		}
+		stats->total.backing_bytes += its->backing_bytes;
+		stats->total.pte_cnt += its->pte_cnt;
+		stats->total.usable_pages += its->usable_pages;
+		stats->total.data_pages += its->data_pages;
+	}
+	if (opts != NULL && opts->iter_stats != NULL && itcnt < opts->iter_stats_cap) {
+		opts->iter_stats[itcnt] = *its;
+	}
+}
+
+/* Entries translated per xlate_range call */
+#define XLATE_BATCH 64
+
+/*
+ * Translation of bufmap entries to PTE indexes. Entries are translated with
+ * the kernel if the mapping is affine, row by row as far as the generic path
+ * agrees on the row, and with ramses_resolve_reverse otherwise. PTEs are
+ * looked up by frame number in a hash table if the kernel is used outside of
+ * streaming mode, and with ramses' binary search otherwise.
+ */
+struct entry_xlate {
+	struct BufferMap *bm;
+	const struct XlateKernel *kern; /* NULL if the mapping is not affine */
+	struct PteHash ptes; /* slots is NULL if there is no table */
+};
+
+/*
+ * Store the PTE indexes of `count' entries of range `ri' from `off' on in
+ * `pte_indexes'. Returns the number of entries stored, which is less than
+ * `count' if the range ends first or an entry has no PTE.
+ */
+static size_t bm_get_entry_ptes(const struct entry_xlate *x, size_t ri, size_t off,
                                 size_t count, size_t *pte_indexes)
 {
-	int r;
+	struct BufferMap *bm = x->bm;
+	physaddr_t pas[XLATE_BATCH];
 	size_t enti = 0;
-	size_t rei = off;
-	while (enti < count && rei < bm->ranges[ri].entry_cnt) {
-		struct DRAMAddr da = ramses_bufmap_addr(bm, ri, rei);
-		physaddr_t pa = ramses_resolve_reverse(bm->msys, da);
-		r = ramses_bufmap_find_pte(bm, pa, &pte_indexes[enti]);
-		assert(!r);
-		enti++;
-		rei++;
+	count = (off < bm->ranges[ri].entry_cnt) ?
+	        min(count, bm->ranges[ri].entry_cnt - off) : 0;
+	while (enti < count) {
+		const size_t n = min(count - enti, XLATE_BATCH);
+		size_t i = (x->kern != NULL) ? xlate_range(x->kern, bm, ri, off + enti, n, pas) : 0;
+		for (; i < n; i++) {
+			struct DRAMAddr da = ramses_bufmap_addr(bm, ri, off + enti + i);
+			pas[i] = ramses_resolve_reverse(bm->msys, da);
+		}
+		for (i = 0; i < n; i++) {
+			if ((x->ptes.slots == NULL ||
+			     ptehash_find(&x->ptes, pas[i], &pte_indexes[enti + i]) != 0) &&
+			    ramses_bufmap_find_pte(bm, pas[i], &pte_indexes[enti + i]) != 0)
+			{
+				return enti + i;
+			}
+		}
+		enti += n;
 	}
 	return enti;
 }
-#pragma GCC diagnostic pop
 
-static int ape_pa_cmp(const void *a, const void *b)
+static size_t bitlen(uint64_t v)
+{
+	return v ? 64 - __builtin_clzll(v) : 0;
+}
+
+/*
+ * Set up `x' for `bm'. `kern' is learnt for the field widths seen at the ends
+ * of the ranges; it is left unused if the mapping is not affine. The PTE hash
+ * table takes 8 to 16 bytes per backing PTE. It is only built along with the
+ * kernel, whose lookups it speeds up most, and never in streaming mode
+ * (`window' > 0), whose bounded temporaries it would outgrow.
+ * Returns 0 on success, 1 on allocation failure or too many PTEs.
+ */
+static int entry_xlate_init(struct entry_xlate *x, struct BufferMap *bm,
+                            struct XlateKernel *kern, size_t window)
+{
+	memset(x, 0, sizeof(*x));
+	x->bm = bm;
+	if (kern == NULL) {
+		return 0;
+	}
+	const struct MappingProps mprops = bm->msys->mapping.props;
+	uint64_t maxv[XLATE_FIELDS] = {0};
+	for (size_t ri = 0; ri < bm->range_cnt; ri++) {
+		if (bm->ranges[ri].entry_cnt == 0) {
+			continue;
+		}
+		const struct DRAMAddr ends[2] = {
+			bm->ranges[ri].start,
+			ramses_bufmap_addr(bm, ri, bm->ranges[ri].entry_cnt - 1)
+		};
+		for (size_t e = 0; e < 2; e++) {
+			maxv[XLATE_CHAN] |= ends[e].chan;
+			maxv[XLATE_DIMM] |= ends[e].dimm;
+			maxv[XLATE_RANK] |= ends[e].rank;
+			maxv[XLATE_BANK] |= ends[e].bank;
+			maxv[XLATE_ROW] |= ends[e].row;
+		}
+	}
+	unsigned bits[XLATE_FIELDS];
+	for (size_t f = 0; f < XLATE_FIELDS; f++) {
+		bits[f] = bitlen(maxv[f]);
+	}
+	bits[XLATE_COL] = bitlen(mprops.col_cnt - 1);
+	if (xlate_learn(kern, bm->msys, bits) != 0) {
+		return 0;
+	}
+	x->kern = kern;
+	return (window == 0) ? ptehash_build(&(x->ptes), bm) : 0;
+}
+
+static void entry_xlate_free(struct entry_xlate *x)
+{
+	ptehash_free(&(x->ptes));
+}
+
+static struct ArenaPageEntry pte_ape(struct BufferMap *bm, size_t ptei)
+{
+	return ((struct ArenaPageEntry){
+		.pfn = bm->ptes[ptei].pa / bm->page_size,
+		.mfd_pgoff = (bm->ptes[ptei].va - (uintptr_t)bm->bufbase) / bm->page_size
+	});
+}
+
+/* Checks that every page of `bm' can be described by a struct ArenaPageEntry */
+static int bm_fits_pgnum(struct BufferMap *bm)
 {
-	physaddr_t pa = ((struct ArenaPageEntry *)a)->pa;
-	physaddr_t pb = ((struct ArenaPageEntry *)b)->pa;
-	return (pa == pb) ? 0 : ((pa < pb) ? -1 : 1);
+	if (bm->pte_cnt > PGNUM_MAX) {
+		return 0;
+	}
+	for (size_t i = 0; i < bm->pte_cnt; i++) {
+		if (bm->ptes[i].pa / bm->page_size > PGNUM_MAX) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void discard(uintptr_t va, size_t len)
+{
+	if (len) {
+		madvise((void *)va, len, MADV_REMOVE);
+		munmap((void *)va, len);
+	}
 }
 
 static int rb_datalen_cmp(const void *a, const void *b)
@@ -101,60 +298,113 @@ static int rb_datalen_cmp(const void *a, const void *b)
 }
 
 
-#define PTE_UNSAFE      0x1
-#define PTE_EDGE        0x2
-#define PTE_GUARD_PRE   0x4
-#define PTE_GUARD_POST  0x8
-#define PTE_ROWBLOCK    0x10
+/* PTE classification is kept as one bitmap ("plane") per flag */
+enum {
+	PTE_PLANE_UNSAFE,
+	PTE_PLANE_EDGE,
+	PTE_PLANE_GUARD_PRE,
+	PTE_PLANE_GUARD_POST,
+	PTE_PLANE_ROWBLOCK,
+	PTE_PLANES
+};
+
+#define PTE_UNSAFE      (1 << PTE_PLANE_UNSAFE)
+#define PTE_EDGE        (1 << PTE_PLANE_EDGE)
+#define PTE_GUARD_PRE   (1 << PTE_PLANE_GUARD_PRE)
+#define PTE_GUARD_POST  (1 << PTE_PLANE_GUARD_POST)
+#define PTE_ROWBLOCK    (1 << PTE_PLANE_ROWBLOCK)
 #define PTE_VISIT       0x0 /* Impromptu debug flag if non-zero */
 typedef uint8_t pteflag_t;
 
-static size_t mark(pteflag_t *pte_flags, struct BufferMap *bm,
-                   size_t ri, size_t ei, size_t ecnt, pteflag_t flags)
+struct PteFlags {
+	bitword_t *plane[PTE_PLANES];
+	size_t nwords;
+};
+
+static int pteflags_alloc(struct PteFlags *pf, size_t pte_cnt)
+{
+	const size_t nw = bitset_words(pte_cnt);
+	bitword_t *mem = calloc(PTE_PLANES * nw, sizeof(*mem));
+	if (mem == NULL) {
+		return 1;
+	}
+	for (size_t p = 0; p < PTE_PLANES; p++) {
+		pf->plane[p] = mem + p * nw;
+	}
+	pf->nwords = nw;
+	return 0;
+}
+
+static void pteflags_free(struct PteFlags *pf)
+{
+	free(pf->plane[0]);
+	pf->plane[0] = NULL;
+}
+
+static pteflag_t pteflags_get(const struct PteFlags *pf, size_t ptei)
+{
+	pteflag_t f = 0;
+	for (size_t p = 0; p < PTE_PLANES; p++) {
+		f |= bitset_test(pf->plane[p], ptei) << p;
+	}
+	return f;
+}
+
+/* Set `flags' on the PTEs of `ecnt' entries; returns 1 if an entry has no PTE */
+static int mark(struct PteFlags *pf, const struct entry_xlate *x,
+                size_t ri, size_t ei, size_t ecnt, pteflag_t flags)
 {
 	const size_t MAXENTS = 2048;
 
-	size_t ret = 0;
 	if (flags && ecnt) {
 		size_t em = 0;
 		while (em < ecnt) {
 			const size_t entstack_sz = min(ecnt - em, MAXENTS);
 			size_t pteis[entstack_sz];
-			size_t ec = bm_get_entry_ptes(bm, ri, ei + em, entstack_sz, pteis);
-			assert(ec == entstack_sz);
+			size_t ec = bm_get_entry_ptes(x, ri, ei + em, entstack_sz, pteis);
+			if (ec != entstack_sz) {
+				return 1;
+			}
 			for (size_t i = 0; i < ec; i++) {
-				if (!((pte_flags[pteis[i]] & flags) == flags)) {
-					pte_flags[pteis[i]] |= flags;
-					ret++;
+				for (size_t p = 0; p < PTE_PLANES; p++) {
+					if (flags & (1 << p)) {
+						bitset_set(pf->plane[p], pteis[i]);
+					}
 				}
 			}
 			em += ec;
 		}
 	}
-	return ret;
+	return 0;
 }
 
 
-static size_t pass1(struct BufferMap *bm, pteflag_t *pte_flags)
+/*
+ * Flag the entries that cannot hold data and store the length of the longest
+ * range in `*maxecnt'. Returns 0 on success, 1 if an entry has no PTE.
+ */
+static int pass1(const struct entry_xlate *x, struct PteFlags *pf, size_t *maxecnt)
 {
+	struct BufferMap *bm = x->bm;
 	const struct MappingProps mprops = bm->msys->mapping.props;
 	const size_t rowlen = mprops.col_cnt * mprops.cell_size;
 	const size_t epr = rowlen / bm->entry_len;
 	assert((rowlen % bm->entry_len) == 0);
 
-	size_t maxecnt = 0;
-	for (size_t ri = 0; ri < bm->range_cnt; ri++) {
+	int err = 0;
+	*maxecnt = 0;
+	for (size_t ri = 0; ri < bm->range_cnt && !err; ri++) {
 		int s = 0;
 		size_t ei = 0;
 		size_t ecnt = bm->ranges[ri].entry_cnt;
-		if (ecnt > maxecnt) {
-			maxecnt = ecnt;
+		if (ecnt > *maxecnt) {
+			*maxecnt = ecnt;
 		}
 		if (bm->ranges[ri].start.col != 0) {
 			size_t ents_left = ((mprops.col_cnt - bm->ranges[ri].start.col) *
 			                   mprops.cell_size) / bm->entry_len;
 			ents_left = (ents_left < ecnt) ? ents_left : ecnt;
-			mark(pte_flags, bm, ri, ei, ents_left, PTE_UNSAFE | PTE_VISIT);
+			err |= mark(pf, x, ri, ei, ents_left, PTE_UNSAFE | PTE_VISIT);
 			ei += ents_left;
 		}
 		/* ei at start of row */
@@ -164,11 +414,11 @@ static size_t pass1(struct BufferMap *bm, pteflag_t *pte_flags)
 				if (rem >= epr) { /* (it) = F */
 					if (rem >= (2*epr)) { /* (it+1) = F */
 						#if (PTE_VISIT)
-						mark(pte_flags, bm, ri, ei, epr, PTE_VISIT);
+						err |= mark(pf, x, ri, ei, epr, PTE_VISIT);
 						#endif
 						ei += epr;
 					} else { /* (it+1) = E,I */
-						mark(pte_flags, bm, ri, ei, epr, PTE_EDGE | PTE_VISIT);
+						err |= mark(pf, x, ri, ei, epr, PTE_EDGE | PTE_VISIT);
 						ei += epr;
 						s = 0;
 					}
@@ -177,136 +427,687 @@ static size_t pass1(struct BufferMap *bm, pteflag_t *pte_flags)
 				}
 			} else { /* S0 */
 				if (rem >= epr) { /* (it) = F */
-					mark(pte_flags, bm, ri, ei, epr, PTE_EDGE | PTE_VISIT);
+					err |= mark(pf, x, ri, ei, epr, PTE_EDGE | PTE_VISIT);
 					ei += epr;
 					s = 1;
 				} else { /* (it) = I */
-					mark(pte_flags, bm, ri, ei, rem, PTE_UNSAFE | PTE_VISIT);
+					err |= mark(pf, x, ri, ei, rem, PTE_UNSAFE | PTE_VISIT);
 					ei = ecnt;
 				}
 			}
 			/* ei == ecnt when (it) = E */
 		}
 	}
-	return maxecnt;
+	return err;
 }
 
-struct pass2_stats {
+/*
+ * pass2 output. The arrays grow on demand, so they can either be preallocated
+ * to their worst-case size or start out empty and track the final size.
+ */
+struct pass2_out {
+	struct RowBlock *rb_stack;
+	size_t rb_cap;
 	size_t rb_top;
-	size_t data_pge_top;
-	size_t guard_pge_top;
+	struct ArenaPageEntry *dpgents;
+	size_t dpge_cap;
+	size_t dpge_top;
+	struct ArenaPageEntry *gpgents;
+	size_t gpge_cap;
+	size_t gpge_top;
+	struct ArenaRow *rows;
+	size_t row_cap;
+	size_t row_top;
 };
 
-static struct pass2_stats pass2(struct BufferMap *bm, pteflag_t *pte_flags,
-                                size_t maxecnt, size_t max_rows_per_block,
-                                struct RowBlock *rb_stack,
-                                struct ArenaPageEntry *dpgents,
-                                struct ArenaPageEntry *gpgents)
+/* Grow `p' to hold at least `need' elements; frees `p' and returns NULL on failure */
+static void *grow_array(void *p, size_t *cap, size_t need, size_t elsz)
 {
+	size_t ncap = *cap + (*cap / 2);
+	ncap = (ncap >= need) ? ncap : need;
+	ncap = (ncap >= 64) ? ncap : 64;
+	void *np = realloc(p, ncap * elsz);
+	if (np == NULL) {
+		free(p);
+		return NULL;
+	}
+	*cap = ncap;
+	return np;
+}
+
+#define ENSURE_CAP(arr, cap, need) \
+	((need) <= (cap) || ((arr) = grow_array((arr), &(cap), (need), sizeof(*(arr)))) != NULL)
+
+/* Entries [base, base + len) of one range, resolved to PTE indexes */
+struct pte_window {
 	size_t *pteis;
-	const size_t MAXSTACKENTS = 2 * bm->page_size / sizeof(*pteis);
+	size_t cap;
+	size_t base;
+	size_t len;
+};
+
+/*
+ * Make entries [lo, hi) of range `ri' available in `w', keeping what is
+ * already resolved and reading ahead as far as the window allows.
+ * Returns 0 on success, 1 if an entry has no PTE.
+ */
+static int window_cover(const struct entry_xlate *x, size_t ri, size_t ecnt,
+                         struct pte_window *w, size_t lo, size_t hi)
+{
+	hi = min(hi, ecnt);
+	if (lo >= w->base && hi <= w->base + w->len) {
+		return 0;
+	}
+	assert(hi - lo <= w->cap);
+	size_t kept = 0;
+	if (lo >= w->base && lo < w->base + w->len) {
+		kept = w->base + w->len - lo;
+		memmove(w->pteis, w->pteis + (lo - w->base), kept * sizeof(*w->pteis));
+	}
+	const size_t cnt = min(ecnt, lo + w->cap) - (lo + kept);
+	size_t ec = bm_get_entry_ptes(x, ri, lo + kept, cnt, w->pteis + kept);
+	w->base = lo;
+	w->len = kept + ec;
+	return ec != cnt;
+}
+
+/* `tmp' has room for a full row, ramses_bufmap_epr entries */
+static void sort_row(struct ArenaPageEntry *pgents, const struct ArenaRow *row,
+                     struct ArenaPageEntry *tmp)
+{
+	rsort_pgents(pgents + row->pgents_off, row->pgcnt, tmp);
+}
+
+/*
+ * Assemble row blocks from the entries pass1 left usable. Ranges are resolved
+ * `window' entries at a time, or whole if `window' is 0.
+ * Returns 0 on success, 1 on allocation failure or if an entry has no PTE.
+ */
+static int pass2(const struct entry_xlate *x, struct PteFlags *pf,
+                 size_t maxecnt, size_t max_rows_per_block, size_t window,
+                 struct pass2_out *out, uint64_t *sort_ns)
+{
+	struct BufferMap *bm = x->bm;
+	struct pte_window w = {NULL, 0, 0, 0};
+	const size_t MAXSTACKENTS = 2 * bm->page_size / sizeof(*w.pteis);
 	const size_t epr = ramses_bufmap_epr(bm);
 	const size_t max_rbecnt = max_rows_per_block * epr;
 	assert((ramses_bufmap_rowlen(bm) % bm->entry_len) == 0);
 
-	if (maxecnt > MAXSTACKENTS) {
-		pteis = malloc(maxecnt * sizeof(*pteis));
+	/* Room for one row behind and one row ahead of the current entry */
+	w.cap = (window > 0) ? min(maxecnt, window + 2 * epr) : maxecnt;
+	if (w.cap > MAXSTACKENTS) {
+		w.pteis = malloc(w.cap * sizeof(*w.pteis));
+		if (w.pteis == NULL) {
+			return 1;
+		}
 	} else {
-		pteis = alloca(maxecnt * sizeof(*pteis));
+		w.pteis = alloca(w.cap * sizeof(*w.pteis));
 	}
+	struct ArenaPageEntry sorttmp[epr];
+	/* PTEs made pre guards by the row block being assembled */
+	size_t pre_pteis[epr];
+	int ret = 1;
 
-	size_t rb_top = 0;
 	size_t dpge_base = 0;
-	size_t dpge_top = 0;
 	size_t gpge_base = 0;
-	size_t gpge_top = 0;
+	size_t row_base = 0;
+	#define PTEI(e) (w.pteis[(e) - w.base])
 
 	for (size_t ri = 0; ri < bm->range_cnt; ri++) {
 		const size_t ecnt = min(bm->ranges[ri].entry_cnt, maxecnt);
-		size_t ec = bm_get_entry_ptes(bm, ri, 0, ecnt, pteis);
-		assert(ec == ecnt);
+		w.base = 0;
+		w.len = 0;
 		size_t rbecnt = 0;
-		for (size_t ei = 0; ei < ec; ei++) {
-			pteflag_t cur_flags = pte_flags[pteis[ei]];
+		for (size_t ei = 0; ei < ecnt; ei++) {
+			if (window_cover(x, ri, ecnt, &w, ei - min(ei, epr), ei + epr) != 0) {
+				errno = EFAULT;
+				goto out;
+			}
+			pteflag_t cur_flags = pteflags_get(pf, PTEI(ei));
 			if (!(cur_flags & (PTE_UNSAFE | PTE_EDGE | PTE_GUARD_PRE | PTE_GUARD_POST)) &&
 			    (max_rbecnt == 0 || rbecnt < max_rbecnt))
 			{
-				if (!(cur_flags & PTE_ROWBLOCK)) {
-					if (dpge_top == dpge_base) {
-						/* First page in row block, mark prev row(s) GUARD */
-						assert(ei >= epr);
-						for (size_t gei = ei - epr; gei < ei; gei++) {
-							if (!(pte_flags[pteis[gei]] & PTE_GUARD_PRE)) {
-								pte_flags[pteis[gei]] |= PTE_GUARD_PRE;
-								gpgents[gpge_top] = ((struct ArenaPageEntry){
-									.pa = bm->ptes[pteis[gei]].pa,
-									.mfd_off = bm->ptes[pteis[gei]].va - (uintptr_t)bm->bufbase
-								});
-								gpge_top++;
-							}
+				if (rbecnt == 0) {
+					/* First row in row block, mark prev row GUARD */
+					assert(ei >= epr);
+					if (!ENSURE_CAP(out->rows, out->row_cap, out->row_top + 1) ||
+					    !ENSURE_CAP(out->gpgents, out->gpge_cap, out->gpge_top + epr))
+					{
+						goto out;
+					}
+					row_base = out->row_top;
+					out->rows[out->row_top++] = ((struct ArenaRow){out->gpge_top, 0, ARENA_ROW_GUARD});
+					for (size_t gei = ei - epr; gei < ei; gei++) {
+						if (!bitset_test_set(pf->plane[PTE_PLANE_GUARD_PRE], PTEI(gei))) {
+							pre_pteis[out->gpge_top - gpge_base] = PTEI(gei);
+							out->gpgents[out->gpge_top] = pte_ape(bm, PTEI(gei));
+							out->gpge_top++;
 						}
 					}
-					pte_flags[pteis[ei]] |= PTE_ROWBLOCK;
+					out->rows[row_base].pgcnt = out->gpge_top - gpge_base;
+				}
+				if ((rbecnt % epr) == 0) {
+					if (!ENSURE_CAP(out->rows, out->row_cap, out->row_top + 1) ||
+					    !ENSURE_CAP(out->dpgents, out->dpge_cap, out->dpge_top + epr))
+					{
+						goto out;
+					}
+					out->rows[out->row_top++] = ((struct ArenaRow){out->dpge_top, 0, 0});
+				}
+				if (!(cur_flags & PTE_ROWBLOCK)) {
+					bitset_set(pf->plane[PTE_PLANE_ROWBLOCK], PTEI(ei));
 					/* Add page to dpgents */
-					dpgents[dpge_top] = ((struct ArenaPageEntry){
-						.pa = bm->ptes[pteis[ei]].pa,
-						.mfd_off = bm->ptes[pteis[ei]].va - (uintptr_t)bm->bufbase
-					});
-					dpge_top++;
+					out->dpgents[out->dpge_top] = pte_ape(bm, PTEI(ei));
+					out->dpge_top++;
+					out->rows[out->row_top - 1].pgcnt++;
 				}
 				rbecnt++;
-			} else {
-				if (dpge_top > dpge_base) {
-					/* Finished assembling row block, mark next row(s) GUARD */
-					assert(ei + epr <= ecnt);
-					for (size_t gei = ei; gei < ei + epr; gei++) {
-						if (!(pte_flags[pteis[gei]] & PTE_GUARD_POST)) {
-							pte_flags[pteis[gei]] |= PTE_GUARD_POST;
-							gpgents[gpge_top] = ((struct ArenaPageEntry){
-								.pa = bm->ptes[pteis[gei]].pa,
-								.mfd_off = bm->ptes[pteis[gei]].va - (uintptr_t)bm->bufbase
-							});
-							gpge_top++;
-						}
+			} else if (rbecnt > 0) {
+				rbecnt = 0;
+				if (out->dpge_top == dpge_base) {
+					/* All pages were claimed through other rows; drop it */
+					for (size_t g = 0; g < out->gpge_top - gpge_base; g++) {
+						bitset_clear(pf->plane[PTE_PLANE_GUARD_PRE], pre_pteis[g]);
+					}
+					out->gpge_top = gpge_base;
+					out->row_top = row_base;
+					continue;
+				}
+				/* Finished assembling row block, mark next row GUARD */
+				assert(ei + epr <= ecnt);
+				if (!ENSURE_CAP(out->rows, out->row_cap, out->row_top + 1) ||
+				    !ENSURE_CAP(out->gpgents, out->gpge_cap, out->gpge_top + epr) ||
+				    !ENSURE_CAP(out->rb_stack, out->rb_cap, out->rb_top + 1))
+				{
+					goto out;
+				}
+				const size_t post = out->row_top++;
+				out->rows[post] = ((struct ArenaRow){out->gpge_top, 0, ARENA_ROW_GUARD});
+				for (size_t gei = ei; gei < ei + epr; gei++) {
+					if (!bitset_test_set(pf->plane[PTE_PLANE_GUARD_POST], PTEI(gei))) {
+						out->gpgents[out->gpge_top] = pte_ape(bm, PTEI(gei));
+						out->gpge_top++;
 					}
+				}
+				out->rows[post].pgcnt = out->gpge_top - out->rows[post].pgents_off;
+
+				out->rb_stack[out->rb_top] = ((struct RowBlock){
+					.data_pgcnt = out->dpge_top - dpge_base,
+					.data_pgents_off = dpge_base,
+					.guard_pgcnt = out->gpge_top - gpge_base,
+					.row_off = row_base + 1,
+					.row_cnt = post - row_base - 1,
+					.bank = ri /* Turned into a bank index by index_banks */
+				});
+				out->rb_top++;
+				uint64_t t = nstime();
+				sort_row(out->gpgents, &(out->rows[row_base]), sorttmp);
+				for (size_t r = row_base + 1; r < post; r++) {
+					sort_row(out->dpgents, &(out->rows[r]), sorttmp);
+				}
+				sort_row(out->gpgents, &(out->rows[post]), sorttmp);
+				*sort_ns += nstime() - t;
+				dpge_base = out->dpge_top;
+				gpge_base = out->gpge_top;
+			}
+		}
+		assert(out->dpge_top == dpge_base);
+	}
+	#undef PTEI
 
-					rb_stack[rb_top] = ((struct RowBlock){
-						.data_pgcnt = dpge_top - dpge_base,
-						.data_pgents_off = dpge_base,
-						.guard_pgcnt = gpge_top - gpge_base,
-						.guard_pgents_off = gpge_base
-					});
-					rb_top++;
-					rbecnt = 0;
-					qsort(dpgents + dpge_base, dpge_top - dpge_base, sizeof(*dpgents), ape_pa_cmp);
-					dpge_base = dpge_top;
-					qsort(gpgents + gpge_base, gpge_top - gpge_base, sizeof(*gpgents), ape_pa_cmp);
-					gpge_base = gpge_top;
+	uint64_t t = nstime();
+	struct RowBlock *rbtmp = malloc(out->rb_top * sizeof(*rbtmp));
+	if (rbtmp != NULL) {
+		rsort_rowblocks(out->rb_stack, out->rb_top, rbtmp);
+		free(rbtmp);
+	} else {
+		qsort(out->rb_stack, out->rb_top, sizeof(*out->rb_stack), rb_datalen_cmp);
+	}
+	*sort_ns += nstime() - t;
+	ret = 0;
+out:
+	if (w.cap > MAXSTACKENTS) {
+		free(w.pteis);
+	}
+	return ret;
+}
+
+/* Blocks of a new arena count as idle from its creation on */
+static void stamp_blocks(struct Arena *a)
+{
+	const uint64_t now = nstime();
+	for (size_t i = 0; i < a->rb_top; i++) {
+		a->rb_stack[i].free_since = now;
+	}
+}
+
+static int pfn_cmp(const void *a, const void *b)
+{
+	pgnum_t x = ((const struct ArenaPageEntry *)a)->pfn;
+	pgnum_t y = ((const struct ArenaPageEntry *)b)->pfn;
+	return (x == y) ? 0 : ((x < y) ? -1 : 1);
+}
+
+/*
+ * Bitset of the guard pages that are data pages as well, which are never lent
+ * as data; *out is NULL if there are none. Returns 1 on allocation failure.
+ */
+static int shared_guards(const struct ArenaPageEntry *dpgents, size_t dcnt,
+                         const struct ArenaPageEntry *gpgents, size_t gcnt,
+                         bitword_t **out)
+{
+	*out = NULL;
+	if (dcnt == 0 || gcnt == 0) {
+		return 0;
+	}
+	struct ArenaPageEntry *d = malloc(2 * dcnt * sizeof(*d));
+	if (d == NULL) {
+		return 1;
+	}
+	memcpy(d, dpgents, dcnt * sizeof(*d));
+	rsort_pgents(d, dcnt, d + dcnt);
+	for (size_t i = 0; i < gcnt; i++) {
+		if (bsearch(&gpgents[i], d, dcnt, sizeof(*d), pfn_cmp) == NULL) {
+			continue;
+		}
+		if (*out == NULL) {
+			*out = calloc(bitset_words(gcnt), sizeof(**out));
+			if (*out == NULL) {
+				free(d);
+				return 1;
+			}
+		}
+		bitset_set(*out, i);
+	}
+	free(d);
+	return 0;
+}
+
+/* Channels vary fastest, so consecutive bank indexes hit different channels */
+static int bank_cmp(const void *a, const void *b)
+{
+	const struct DRAMAddr *x = a;
+	const struct DRAMAddr *y = b;
+	const unsigned kx[4] = {x->bank, x->rank, x->dimm, x->chan};
+	const unsigned ky[4] = {y->bank, y->rank, y->dimm, y->chan};
+	for (int i = 0; i < 4; i++) {
+		if (kx[i] != ky[i]) {
+			return (kx[i] < ky[i]) ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Replace the range index pass2 left in each RowBlock.bank with an index into
+ * the returned array of distinct banks. Returns NULL on allocation failure.
+ */
+static struct DRAMAddr *index_banks(struct BufferMap *bm, struct RowBlock *rbs,
+                                    size_t rb_cnt, size_t *bank_cnt)
+{
+	struct DRAMAddr *banks = malloc((rb_cnt ? rb_cnt : 1) * sizeof(*banks));
+	if (banks == NULL) {
+		return NULL;
+	}
+	for (size_t i = 0; i < rb_cnt; i++) {
+		banks[i] = bm->ranges[rbs[i].bank].start;
+		banks[i].row = 0;
+		banks[i].col = 0;
+	}
+	qsort(banks, rb_cnt, sizeof(*banks), bank_cmp);
+	size_t n = 0;
+	for (size_t i = 0; i < rb_cnt; i++) {
+		if (n == 0 || bank_cmp(&banks[n - 1], &banks[i]) != 0) {
+			banks[n++] = banks[i];
+		}
+	}
+	for (size_t i = 0; i < rb_cnt; i++) {
+		struct DRAMAddr key = bm->ranges[rbs[i].bank].start;
+		key.row = 0;
+		key.col = 0;
+		struct DRAMAddr *b = bsearch(&key, banks, n, sizeof(*banks), bank_cmp);
+		assert(b != NULL);
+		rbs[i].bank = b - banks;
+	}
+	*bank_cnt = n;
+	return realloc(banks, (n ? n : 1) * sizeof(*banks));
+}
+
+
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB	0x0004U
+#endif
+#ifndef MFD_HUGE_SHIFT
+#define MFD_HUGE_SHIFT	26
+#endif
+
+#define PAGEMAP_PRESENT	(1ULL << 63)
+#define PAGEMAP_PFN	((1ULL << 55) - 1)
+
+/* Whether the bank of `da' exists, i.e. its address resolves back to it */
+static int bank_exists(struct MemorySystem *msys, struct DRAMAddr da)
+{
+	const struct DRAMAddr rt = ramses_resolve(msys, ramses_resolve_reverse(msys, da));
+	return (da.chan | da.dimm | da.rank | da.bank) < UINT8_MAX &&
+	       rt.chan == da.chan && rt.dimm == da.dimm && rt.rank == da.rank &&
+	       rt.bank == da.bank;
+}
+
+/*
+ * Whether huge pages of `hsz' bytes can stand in for DRAM rows: the rows next
+ * to those in a huge page must lie within the huge pages on either side, so
+ * one huge page suffices as guard. The stride between rows 0 and 1 is checked
+ * in every bank of the mapping, and taken to hold for the rows past them.
+ */
+static int huge_rows_fit(struct MemorySystem *msys, size_t hsz)
+{
+	struct DRAMAddr da = {0};
+	for (da.chan = 0; bank_exists(msys, da); da.chan++) {
+		for (da.dimm = 0; bank_exists(msys, da); da.dimm++) {
+			for (da.rank = 0; bank_exists(msys, da); da.rank++) {
+				for (da.bank = 0; bank_exists(msys, da); da.bank++) {
+					struct DRAMAddr next = da;
+					next.row = 1;
+					const physaddr_t r0 = ramses_resolve_reverse(msys, da);
+					const physaddr_t r1 = ramses_resolve_reverse(msys, next);
+					if (((r1 > r0) ? r1 - r0 : r0 - r1) > hsz) {
+						return 0;
+					}
 				}
+				da.bank = 0;
 			}
+			da.rank = 0;
 		}
-		assert(dpge_top == dpge_base);
+		da.dimm = 0;
 	}
-	if (maxecnt > MAXSTACKENTS) {
-		free(pteis);
+	return 1;
+}
+
+/* Physical address of the page at `va' from /proc/self/pagemap; returns 0 on success */
+static int pagemap_pa(int pagemap_fd, uintptr_t va, size_t base_page, physaddr_t *pa)
+{
+	uint64_t ent;
+	if (pread(pagemap_fd, &ent, sizeof(ent), (va / base_page) * sizeof(ent)) !=
+	    (ssize_t)sizeof(ent) || !(ent & PAGEMAP_PRESENT) || !(ent & PAGEMAP_PFN))
+	{
+		return 1;
+	}
+	*pa = (physaddr_t)(ent & PAGEMAP_PFN) * base_page;
+	return 0;
+}
+
+/*
+ * Assemble row blocks out of the huge pages `hps', sorted by pfn, each of
+ * which serves as one row. Runs of physically contiguous huge pages are cut
+ * into blocks of at most `max_rows' data pages (0 for no limit); the pages
+ * at either end of a run and between blocks are guards.
+ * Returns 0 on success, 1 on allocation failure.
+ */
+static int huge_blocks(const struct ArenaPageEntry *hps, size_t n, size_t max_rows,
+                       struct pass2_out *out)
+{
+	for (size_t i = 0, j; i < n; i = j) {
+		for (j = i + 1; j < n && hps[j].pfn == hps[j - 1].pfn + 1; j++);
+		for (size_t p = i + 1; p + 1 < j;) {
+			size_t cnt = j - 1 - p;
+			cnt = (max_rows > 0) ? min(cnt, max_rows) : cnt;
+			if (!ENSURE_CAP(out->rows, out->row_cap, out->row_top + cnt + 2) ||
+			    !ENSURE_CAP(out->gpgents, out->gpge_cap, out->gpge_top + 2) ||
+			    !ENSURE_CAP(out->dpgents, out->dpge_cap, out->dpge_top + cnt) ||
+			    !ENSURE_CAP(out->rb_stack, out->rb_cap, out->rb_top + 1))
+			{
+				return 1;
+			}
+			const size_t pre = out->row_top;
+			out->rows[out->row_top++] = ((struct ArenaRow){out->gpge_top, 1, ARENA_ROW_GUARD});
+			out->gpgents[out->gpge_top++] = hps[p - 1];
+			out->rb_stack[out->rb_top++] = ((struct RowBlock){
+				.data_pgcnt = cnt,
+				.data_pgents_off = out->dpge_top,
+				.guard_pgcnt = 2,
+				.row_off = pre + 1,
+				.row_cnt = cnt,
+				.bank = 0
+			});
+			for (size_t k = p; k < p + cnt; k++) {
+				out->rows[out->row_top++] = ((struct ArenaRow){out->dpge_top, 1, 0});
+				out->dpgents[out->dpge_top++] = hps[k];
+			}
+			out->rows[out->row_top++] = ((struct ArenaRow){out->gpge_top, 1, ARENA_ROW_GUARD});
+			out->gpgents[out->gpge_top++] = hps[p + cnt];
+			p += cnt + 1;
+		}
 	}
-	qsort(rb_stack, rb_top, sizeof(*rb_stack), rb_datalen_cmp);
-	return ((struct pass2_stats){rb_top, dpge_top, gpge_top});
+	qsort(out->rb_stack, out->rb_top, sizeof(*out->rb_stack), rb_datalen_cmp);
+	return 0;
 }
 
+enum {
+	HUGE_DROPPED,
+	HUGE_DATA,
+	HUGE_GUARD
+};
+
+/*
+ * alis_arena_create_opts for arenas backed by a hugetlb memfd with huge pages
+ * of 1 << `hshift' bytes, which become the arena's pages. Each huge page is
+ * looked up in the pagemap once and treated as a row of its own.
+ */
+static int create_huge(size_t size_hint, size_t max_cont_rows, unsigned hshift,
+                       int node, const struct ArenaOptions *opts,
+                       struct MasterArena *ma, struct ArenaStats *stats)
+{
+	const size_t base_page = sysconf(_SC_PAGESIZE);
+	const size_t hsz = (size_t)1 << hshift;
+	const size_t minpc = ceildiv(size_hint, hsz);
+	int shift = (size_hint > MA_THRESH) ? estimate_shift(size_hint, hsz) : 1;
+
+	const int pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+	if (pagemap_fd == -1) {
+		return 1;
+	}
+	const uint64_t t_start = nstime();
+	if (stats != NULL) {
+		memset(&(stats->total), 0, sizeof(stats->total));
+	}
+	for (size_t itcnt = 0; ; itcnt++) {
+		struct ArenaIterStats its;
+		memset(&its, 0, sizeof(its));
+		uint64_t t = nstime();
+		const size_t alen = ceildiv(getalen(size_hint, shift + itcnt), hsz) * hsz;
+		const size_t n = alen / hsz;
+		its.backing_bytes = alen;
+		int mfd = syscall(SYS_memfd_create, "AlisArenaBacking",
+		                  MFD_HUGETLB | (hshift << MFD_HUGE_SHIFT));
+		if (mfd < 0) {
+			break;
+		}
+		void *buf = MAP_FAILED;
+		struct ArenaPageEntry *hps = NULL;
+		unsigned char *use = NULL;
+		struct pass2_out out;
+		memset(&out, 0, sizeof(out));
+		size_t *pgtotals = NULL;
+		ticketid_t *tickmap = NULL;
+		bitword_t *gshared = NULL;
+
+		if (ftruncate(mfd, alen) != 0) {
+			goto err;
+		}
+		buf = mmap(NULL, alen, PROT_READ|PROT_WRITE, MAP_SHARED, mfd, 0);
+		if (buf == MAP_FAILED) {
+			goto err;
+		}
+		if (node >= 0 && bind_node(buf, alen, node) != 0) {
+			goto err;
+		}
+		lap(&its, ARENA_PHASE_BACKING, &t);
+		/* Faults in the huge pages; fails if the pool runs dry */
+		if (mlock(buf, alen) != 0) {
+			goto err;
+		}
+		lap(&its, ARENA_PHASE_POPULATE, &t);
+
+		/* One pagemap lookup per huge page */
+		hps = malloc(n * sizeof(*hps));
+		use = calloc(n, sizeof(*use));
+		if (hps == NULL || use == NULL) {
+			goto err;
+		}
+		size_t hcnt = 0;
+		for (size_t k = 0; k < n; k++) {
+			physaddr_t pa;
+			if (pagemap_pa(pagemap_fd, (uintptr_t)buf + (k * hsz), base_page, &pa) == 0 &&
+			    (pa >> hshift) <= PGNUM_MAX)
+			{
+				hps[hcnt++] = ((struct ArenaPageEntry){pa >> hshift, k});
+			}
+		}
+		its.pte_cnt = n;
+		its.usable_pages = hcnt;
+		lap(&its, ARENA_PHASE_BUFMAP, &t);
+		struct ArenaPageEntry *tmp = malloc(hcnt * sizeof(*tmp));
+		if (tmp == NULL) {
+			goto err;
+		}
+		rsort_pgents(hps, hcnt, tmp);
+		free(tmp);
+		lap(&its, ARENA_PHASE_SORT, &t);
+
+		if (huge_blocks(hps, hcnt, max_cont_rows, &out) != 0) {
+			goto err;
+		}
+		its.data_pages = out.dpge_top;
+		lap(&its, ARENA_PHASE_PASS2, &t);
+		if (out.dpge_top < minpc) {
+			free(out.dpgents);
+			free(out.gpgents);
+			free(out.rb_stack);
+			free(out.rows);
+			free(hps);
+			free(use);
+			munmap(buf, alen);
+			close(mfd);
+			commit_iter(stats, opts, itcnt, &its);
+			continue;
+		}
+
+		/* Fill data & guard pages and give unused ones back to the pool */
+		for (size_t k = 0; k < out.dpge_top; k++) {
+			use[out.dpgents[k].mfd_pgoff] = HUGE_DATA;
+		}
+		for (size_t k = 0; k < out.gpge_top; k++) {
+			use[out.gpgents[k].mfd_pgoff] = HUGE_GUARD;
+		}
+		size_t cnts[3] = {0, 0, 0};
+		for (size_t k = 0; k < n; k++) {
+			void *page = (char *)buf + (k * hsz);
+			cnts[use[k]]++;
+			if (use[k] == HUGE_DROPPED) {
+				discard((uintptr_t)page, hsz);
+			} else {
+				memset(page, (use[k] == HUGE_GUARD) ? ARENA_GUARD_BYTE : 0, hsz);
+			}
+		}
+		lap(&its, ARENA_PHASE_FILL, &t);
+		commit_iter(stats, opts, itcnt, &its);
+
+		/* Writeout */
+		pgtotals = calloc(out.rb_top, sizeof(*pgtotals));
+		tickmap = calloc(out.rb_top, sizeof(*tickmap));
+		if (pgtotals == NULL || tickmap == NULL ||
+		    shared_guards(out.dpgents, out.dpge_top, out.gpgents, out.gpge_top, &gshared) != 0)
+		{
+			goto err;
+		}
+		ma->backing.buf = buf;
+		ma->backing.map_sz = alen;
+		ma->backing.node = node;
+		ma->arena = ((struct Arena){
+			.page_size = hsz,
+			.rb_stack = realloc(out.rb_stack, out.rb_top * sizeof(*out.rb_stack)),
+			.rb_top = out.rb_top,
+			.rb_pgtotals = pgtotals,
+			.rb_tickmap = tickmap,
+			.rb_cap = out.rb_top,
+			.rows = realloc(out.rows, out.row_top * sizeof(*out.rows)),
+			.row_cnt = out.row_top,
+			.data_pgents = realloc(out.dpgents, out.dpge_top * sizeof(*out.dpgents)),
+			.data_pgents_size = out.dpge_top,
+			.guard_pgents = realloc(out.gpgents, out.gpge_top * sizeof(*out.gpgents)),
+			.guard_pgents_size = out.gpge_top,
+			.last_ticket = 0,
+			.mfd = mfd,
+			.banks = NULL,
+			.bank_cnt = 0,
+			.guard_shared = gshared
+		});
+		arena_update_totals(&(ma->arena), 0);
+		stamp_blocks(&(ma->arena));
+		if (stats != NULL) {
+			stats->data_pages = cnts[HUGE_DATA];
+			stats->guard_pages = cnts[HUGE_GUARD];
+			stats->dropped_pages = cnts[HUGE_DROPPED];
+			stats->alloc_iterations = itcnt + 1;
+			stats->total_ns = nstime() - t_start;
+		}
+		free(hps);
+		free(use);
+		close(pagemap_fd);
+		return 0;
+
+	err:
+		free(pgtotals);
+		free(tickmap);
+		free(gshared);
+		free(out.dpgents);
+		free(out.gpgents);
+		free(out.rb_stack);
+		free(out.rows);
+		free(hps);
+		free(use);
+		if (buf != MAP_FAILED) {
+			munmap(buf, alen);
+		}
+		close(mfd);
+		break;
+	}
+	close(pagemap_fd);
+	return 1;
+}
 
 int alis_arena_create(struct MemorySystem *msys,
                       size_t size_hint, size_t max_cont_rows,
                       struct MasterArena *ma, struct ArenaStats *stats)
 {
+	return alis_arena_create_opts(msys, size_hint, max_cont_rows, NULL, ma, stats);
+}
+
+int alis_arena_create_opts(struct MemorySystem *msys,
+                           size_t size_hint, size_t max_cont_rows,
+                           const struct ArenaOptions *opts,
+                           struct MasterArena *ma, struct ArenaStats *stats)
+{
+	/* Undo ARENA_NODE; -1 for ARENA_NODE_ANY */
+	const int node = ((opts != NULL) ? opts->numa_node : ARENA_NODE_ANY) - 1;
+	const size_t pf_threads = (opts != NULL) ? opts->prefault_threads : 0;
+	const size_t window = (opts != NULL) ? opts->stream_window : 0;
+	struct ArenaSizeModel *model = (opts != NULL) ? opts->size_model : NULL;
+	const unsigned hshift = (opts != NULL) ? opts->hugetlb_shift : 0;
+	if (hshift != 0 && huge_rows_fit(msys, (size_t)1 << hshift)) {
+		return create_huge(size_hint, max_cont_rows, hshift, node, opts, ma, stats);
+	}
+
 	int pagemap_fd;
 	struct Translation trans;
 	struct BufferMap bm;
-	pteflag_t *pte_flags = NULL;
+	struct entry_xlate ex;
+	struct PteFlags pf = {{NULL}, 0};
 
 	int mfd;
 	void *buf;
-	size_t alen;
+	size_t alen = 0;
 	size_t itcnt;
 	size_t dpcnt;
 	size_t gpcnt;
@@ -315,14 +1116,28 @@ int alis_arena_create(struct MemorySystem *msys,
 	struct RowBlock *rb_stack = NULL;
 	struct ArenaPageEntry *dpgents = NULL;
 	struct ArenaPageEntry *gpgents = NULL;
+	struct ArenaRow *rows = NULL;
 	size_t *pgtotals = NULL;
 	ticketid_t *tickmap = NULL;
+	bitword_t *gshared = NULL;
+	struct DRAMAddr *banks = NULL;
+	size_t bank_cnt = 0;
+
+	struct ArenaIterStats its;
+	uint64_t t;
+	const uint64_t t_start = nstime();
+	if (stats != NULL) {
+		memset(&(stats->total), 0, sizeof(stats->total));
+	}
 
 	pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
 	if (pagemap_fd == -1) {
 		return 1;
 	}
 	ramses_translate_pagemap(&trans, pagemap_fd);
+	/* Without a kernel every entry takes the generic path */
+	struct XlateKernel *kern = malloc(sizeof(*kern));
+	memset(&ex, 0, sizeof(ex));
 
 	const size_t PAGE_SIZE = ramses_translate_granularity(&trans);
 	const size_t minpc = ceildiv(size_hint, PAGE_SIZE);
@@ -330,7 +1145,17 @@ int alis_arena_create(struct MemorySystem *msys,
 
 	for(itcnt = 0; ; itcnt++) {
 		/* Prepare backing buffer */
-		alen = getalen(size_hint, shift + itcnt);
+		memset(&its, 0, sizeof(its));
+		t = nstime();
+		if (model != NULL) {
+			size_t predicted = alis_sizemodel_predict(model, size_hint, PAGE_SIZE);
+			/* Keep growing even if the last miss barely moved the model */
+			alen = (itcnt && predicted <= alen) ? alen + (alen / 4) : predicted;
+			alen = (alen >= MINALEN) ? alen : MINALEN;
+		} else {
+			alen = getalen(size_hint, shift + itcnt);
+		}
+		its.backing_bytes = alen;
 		mfd = syscall(SYS_memfd_create, "AlisArenaBacking", 0);
 		if (mfd < 0) {
 			break;
@@ -343,105 +1168,204 @@ int alis_arena_create(struct MemorySystem *msys,
 			goto err_close;
 		}
 		madvise(buf, alen, MADV_HUGEPAGE);
+		if (node >= 0 && bind_node(buf, alen, node) != 0) {
+			goto err_unmap;
+		}
+		lap(&its, ARENA_PHASE_BACKING, &t);
+		if (pf_threads > 1) {
+			arena_prefault(buf, alen, PAGE_SIZE, pf_threads);
+		}
 		if (mlock(buf, alen) != 0) {
 			goto err_unmap;
 		}
+		lap(&its, ARENA_PHASE_POPULATE, &t);
 
 		/* Prepare temporary data structures */
 		if (ramses_bufmap(&bm, buf, alen, &trans, msys, 0) != 0) {
 			goto err_unmap;
 		}
-		pte_flags = calloc(bm.pte_cnt, sizeof(*pte_flags));
-		if (pte_flags == NULL) {
+		its.pte_cnt = bm.pte_cnt;
+		if (!bm_fits_pgnum(&bm)) {
+			errno = EOVERFLOW;
+			goto err_freebm;
+		}
+		if (entry_xlate_init(&ex, &bm, kern, window) != 0) {
+			goto err_freebm;
+		}
+		lap(&its, ARENA_PHASE_BUFMAP, &t);
+		if (pteflags_alloc(&pf, bm.pte_cnt) != 0) {
 			goto err_freebm;
 		}
 
-		size_t maxecnt = pass1(&bm, pte_flags);
+		size_t maxecnt;
+		if (pass1(&ex, &pf, &maxecnt) != 0) {
+			pteflags_free(&pf);
+			errno = EFAULT;
+			goto err_freebm;
+		}
+		lap(&its, ARENA_PHASE_PASS1, &t);
 
 		/* Check if it's possible to satisfy allocation hint */
 		dpcnt = bm.pte_cnt;
-		for (size_t pi = 0; pi < bm.pte_cnt; pi++) {
-			if (pte_flags[pi] & (PTE_UNSAFE | PTE_EDGE)) {
-				dpcnt--;
-				if (dpcnt < minpc) {
-					break;
-				}
+		for (size_t w = 0; w < pf.nwords; w++) {
+			dpcnt -= __builtin_popcountll(pf.plane[PTE_PLANE_UNSAFE][w] |
+			                              pf.plane[PTE_PLANE_EDGE][w]);
+			if (dpcnt < minpc) {
+				break;
 			}
 		}
+		its.usable_pages = dpcnt;
+		lap(&its, ARENA_PHASE_YIELD, &t);
 		if (dpcnt < minpc) {
+			/* Counting stopped early, so this only bounds the yield */
+			if (model != NULL &&
+			    (double)dpcnt / bm.pte_cnt < model->yield)
+			{
+				alis_sizemodel_update(model, bm.pte_cnt, dpcnt);
+			}
 			goto cont_postpass1;
 		}
 
-		/* Set up aux data structures */
-		dpgents = malloc(dpcnt * sizeof(*dpgents));
-		gpgents = malloc(2 * dpcnt * sizeof(*gpgents));
-		const size_t maxrbs = dpcnt /
-			((bm.msys->mapping.props.col_cnt * bm.msys->mapping.props.cell_size) / bm.page_size);
-		rb_stack = malloc(maxrbs * sizeof(*rb_stack));
-		if (dpgents == NULL || gpgents == NULL || rb_stack == NULL) {
-			goto err_freeaux;
+		/*
+		 * Set up aux data structures. Without a stream window they are sized
+		 * for the worst case up front; otherwise they grow with the output.
+		 */
+		struct pass2_out p2o;
+		memset(&p2o, 0, sizeof(p2o));
+		if (window == 0) {
+			p2o.dpge_cap = dpcnt;
+			p2o.gpge_cap = 2 * dpcnt;
+			p2o.rb_cap = dpcnt /
+				((bm.msys->mapping.props.col_cnt * bm.msys->mapping.props.cell_size) / bm.page_size);
+			/* Guard rows shared by two row blocks are listed twice */
+			for (size_t ri = 0; ri < bm.range_cnt; ri++) {
+				p2o.row_cap += 2 * ceildiv(bm.ranges[ri].entry_cnt, ramses_bufmap_epr(&bm));
+			}
+			p2o.dpgents = malloc(p2o.dpge_cap * sizeof(*p2o.dpgents));
+			p2o.gpgents = malloc(p2o.gpge_cap * sizeof(*p2o.gpgents));
+			p2o.rb_stack = malloc(p2o.rb_cap * sizeof(*p2o.rb_stack));
+			p2o.rows = malloc((p2o.row_cap ? p2o.row_cap : 1) * sizeof(*p2o.rows));
 		}
 
-		struct pass2_stats p2s = pass2(&bm, pte_flags, maxecnt, max_cont_rows,
-		                               rb_stack, dpgents, gpgents);
-		if (p2s.data_pge_top < minpc) {
+		uint64_t sort_ns = 0;
+		int p2err = (window == 0 &&
+		             (p2o.dpgents == NULL || p2o.gpgents == NULL ||
+		              p2o.rb_stack == NULL || p2o.rows == NULL));
+		if (!p2err) {
+			p2err = pass2(&ex, &pf, maxecnt, max_cont_rows, window, &p2o, &sort_ns);
+		}
+		dpgents = p2o.dpgents;
+		gpgents = p2o.gpgents;
+		rb_stack = p2o.rb_stack;
+		rows = p2o.rows;
+		if (p2err) {
+			goto err_freeaux;
+		}
+		its.data_pages = p2o.dpge_top;
+		lap(&its, ARENA_PHASE_PASS2, &t);
+		its.phase_ns[ARENA_PHASE_PASS2] -= sort_ns;
+		its.phase_ns[ARENA_PHASE_SORT] += sort_ns;
+		if (model != NULL) {
+			alis_sizemodel_update(model, bm.pte_cnt, p2o.dpge_top);
+		}
+		if (p2o.dpge_top < minpc) {
 			goto cont_postpass2;
 		}
 
-		dpgents = realloc(dpgents, p2s.data_pge_top * sizeof(*dpgents));
-		gpgents = realloc(gpgents, p2s.guard_pge_top * sizeof(*gpgents));
-		rb_stack = realloc(rb_stack, p2s.rb_top * sizeof(*rb_stack));
+		dpgents = realloc(dpgents, p2o.dpge_top * sizeof(*dpgents));
+		gpgents = realloc(gpgents, p2o.gpge_top * sizeof(*gpgents));
+		rb_stack = realloc(rb_stack, p2o.rb_top * sizeof(*rb_stack));
+		rows = realloc(rows, p2o.row_top * sizeof(*rows));
+		banks = index_banks(&bm, rb_stack, p2o.rb_top, &bank_cnt);
+		if (banks == NULL) {
+			goto err_freeaux;
+		}
 
 		/* Fill data & guard pages, discard unusable pages and collect stats */
 		dpcnt = 0;
 		gpcnt = 0;
 		xpcnt = 0;
-		for (size_t i = 0; i < bm.pte_cnt; i++) {
-			pteflag_t f = pte_flags[i];
-			if (f & PTE_ROWBLOCK) {
+		uintptr_t xva = 0;
+		size_t xlen = 0;
+		for (size_t w = 0; w < pf.nwords; w++) {
+			const size_t pbase = w * BITWORD_BITS;
+			const bitword_t rbw = pf.plane[PTE_PLANE_ROWBLOCK][w];
+			const bitword_t gw = (pf.plane[PTE_PLANE_GUARD_PRE][w] |
+			                      pf.plane[PTE_PLANE_GUARD_POST][w]) & ~rbw;
+			bitword_t xw = ~(rbw | gw);
+			if (w == pf.nwords - 1) {
+				xw &= bitset_tailmask(bm.pte_cnt);
+			}
+			dpcnt += __builtin_popcountll(rbw);
+			gpcnt += __builtin_popcountll(gw);
+			xpcnt += __builtin_popcountll(xw);
+			for (bitword_t m = rbw; m; m &= m - 1) {
+				size_t i = pbase + __builtin_ctzll(m);
 				memset((void *)bm.ptes[i].va, 0, bm.page_size);
-				dpcnt++;
-			} else if (f & (PTE_GUARD_PRE | PTE_GUARD_POST)) {
-				memset((void *)bm.ptes[i].va, GUARD_BYTE, bm.page_size);
-				gpcnt++;
-			} else {
-				madvise((void *)bm.ptes[i].va, bm.page_size, MADV_REMOVE);
-				munmap((void *)bm.ptes[i].va, bm.page_size);
-				xpcnt++;
+			}
+			for (bitword_t m = gw; m; m &= m - 1) {
+				size_t i = pbase + __builtin_ctzll(m);
+				memset((void *)bm.ptes[i].va, ARENA_GUARD_BYTE, bm.page_size);
+			}
+			/* Unusable pages tend to come in runs; discard them in bulk */
+			for (bitword_t m = xw; m; m &= m - 1) {
+				uintptr_t va = bm.ptes[pbase + __builtin_ctzll(m)].va;
+				if (xlen && va == xva + xlen) {
+					xlen += bm.page_size;
+				} else {
+					discard(xva, xlen);
+					xva = va;
+					xlen = bm.page_size;
+				}
 			}
 		}
-		free(pte_flags);
-		pte_flags = NULL;
+		discard(xva, xlen);
+		pteflags_free(&pf);
+		lap(&its, ARENA_PHASE_FILL, &t);
+		commit_iter(stats, opts, itcnt, &its);
 
 		/* Writeout */
-		pgtotals = calloc(p2s.rb_top, sizeof(*pgtotals));
-		tickmap = calloc(p2s.rb_top, sizeof(*tickmap));
-		if (pgtotals == NULL || tickmap == NULL) {
+		pgtotals = calloc(p2o.rb_top, sizeof(*pgtotals));
+		tickmap = calloc(p2o.rb_top, sizeof(*tickmap));
+		if (pgtotals == NULL || tickmap == NULL ||
+		    shared_guards(dpgents, p2o.dpge_top, gpgents, p2o.gpge_top, &gshared) != 0)
+		{
 			goto err_freeout;
 		}
 		ma->backing.buf = buf;
 		ma->backing.map_sz = alen;
+		ma->backing.node = node;
 		ma->arena = ((struct Arena){
 			.page_size = PAGE_SIZE,
 			.rb_stack = rb_stack,
-			.rb_top = p2s.rb_top,
+			.rb_top = p2o.rb_top,
 			.rb_pgtotals = pgtotals,
 			.rb_tickmap = tickmap,
+			.rb_cap = p2o.rb_top,
+			.rows = rows,
+			.row_cnt = p2o.row_top,
 			.data_pgents = dpgents,
-			.data_pgents_size = p2s.data_pge_top,
+			.data_pgents_size = p2o.dpge_top,
 			.guard_pgents = gpgents,
-			.guard_pgents_size = p2s.guard_pge_top,
+			.guard_pgents_size = p2o.gpge_top,
 			.last_ticket = 0,
-			.mfd = mfd
+			.mfd = mfd,
+			.banks = banks,
+			.bank_cnt = bank_cnt,
+			.guard_shared = gshared
 		});
 		arena_update_totals(&(ma->arena), 0);
+		stamp_blocks(&(ma->arena));
 		if (stats != NULL) {
 			stats->data_pages = dpcnt;
 			stats->guard_pages = gpcnt;
 			stats->dropped_pages = xpcnt;
 			stats->alloc_iterations = itcnt + 1;
+			stats->total_ns = nstime() - t_start;
 		}
+		entry_xlate_free(&ex);
 		ramses_bufmap_free(&bm);
+		free(kern);
 		close(pagemap_fd);
 		return 0;
 
@@ -450,11 +1374,14 @@ int alis_arena_create(struct MemorySystem *msys,
 		free(dpgents);
 		free(gpgents);
 		free(rb_stack);
+		free(rows);
 	cont_postpass1:
-		free(pte_flags);
+		pteflags_free(&pf);
+		entry_xlate_free(&ex);
 		ramses_bufmap_free(&bm);
 		munmap(buf, alen);
 		close(mfd);
+		commit_iter(stats, opts, itcnt, &its);
 		errno = 0;
 		continue;
 
@@ -462,12 +1389,16 @@ int alis_arena_create(struct MemorySystem *msys,
 	err_freeout:
 		free(pgtotals);
 		free(tickmap);
+		free(gshared);
+		free(banks);
 	err_freeaux:
 		free(dpgents);
 		free(gpgents);
 		free(rb_stack);
-		free(pte_flags);
+		free(rows);
+		pteflags_free(&pf);
 	err_freebm:
+		entry_xlate_free(&ex);
 		ramses_bufmap_free(&bm);
 	err_unmap:
 		munmap(buf, alen);
@@ -475,6 +1406,7 @@ int alis_arena_create(struct MemorySystem *msys,
 		close(mfd);
 		break;
 	}
+	free(kern);
 	close(pagemap_fd);
 	return 1;
 }
@@ -486,9 +1418,243 @@ int alis_arena_destroy(struct MasterArena *ma)
 	free(ma->arena.rb_tickmap);
 	free(ma->arena.data_pgents);
 	free(ma->arena.guard_pgents);
+	free(ma->arena.banks);
+	free(ma->arena.rows);
+	free(ma->arena.guard_lent);
+	free(ma->arena.guard_shared);
 	r = close(ma->arena.mfd);
 	if (!r) {
 		r |= munmap(ma->backing.buf, ma->backing.map_sz);
 	}
 	return r;
 }
+
+/*
+ * Apply `op' to the backing of the data pages of `rb', in runs of pages that
+ * are adjacent in the mfd. Returns 1 as soon as a run fails, 0 otherwise.
+ */
+static int block_runs(struct MasterArena *ma, const struct RowBlock *rb,
+                      int (*op)(void *, size_t))
+{
+	const struct Arena *a = &(ma->arena);
+	const struct ArenaPageEntry *pg = &(a->data_pgents[rb->data_pgents_off]);
+	for (size_t i = 0, j; i < rb->data_pgcnt; i = j) {
+		for (j = i + 1; j < rb->data_pgcnt &&
+		     pg[j].mfd_pgoff == pg[j - 1].mfd_pgoff + 1; j++);
+		if (op((char *)ma->backing.buf + ape_mfd_off(a, &pg[i]),
+		       (j - i) * a->page_size))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Locked pages cannot be removed */
+static int trim_run(void *va, size_t len)
+{
+	return munlock(va, len) != 0 || madvise(va, len, MADV_REMOVE) != 0;
+}
+
+static int lock_run(void *va, size_t len)
+{
+	return mlock(va, len) != 0;
+}
+
+/* Whether a data page of `rb' is a guard page of another block too */
+static int block_shared(const struct Arena *a, const struct RowBlock *rb)
+{
+	if (a->guard_shared == NULL) {
+		return 0;
+	}
+	const struct ArenaPageEntry *pg = &(a->data_pgents[rb->data_pgents_off]);
+	for (size_t w = 0; w < bitset_words(a->guard_pgents_size); w++) {
+		for (bitword_t v = a->guard_shared[w]; v != 0; v &= v - 1) {
+			const size_t gi = w * BITWORD_BITS + __builtin_ctzll(v);
+			const pgnum_t pfn = a->guard_pgents[gi].pfn;
+			for (size_t i = 0; i < rb->data_pgcnt; i++) {
+				if (pg[i].pfn == pfn) {
+					return 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Point the data pages of `rb' at the mfd pages now backed by their frames.
+ * The block is as isolated as when it was classified as long as its pages are
+ * back on its own frames, in whatever order the kernel handed them out.
+ * Blocks with pages that are guard pages too are never trimmed, but are
+ * refused here as well: the guard_pgents of those pages would keep their old
+ * offsets. Returns 1 if the pages are not back, on such blocks, or on failure.
+ */
+static int block_refit(struct MasterArena *ma, const struct RowBlock *rb,
+                       int pagemap_fd)
+{
+	struct Arena *a = &(ma->arena);
+	const size_t base_page = sysconf(_SC_PAGESIZE);
+	const size_t n = rb->data_pgcnt;
+	struct ArenaPageEntry *pg = &(a->data_pgents[rb->data_pgents_off]);
+	if (block_shared(a, rb)) {
+		return 1;
+	}
+	struct ArenaPageEntry *now = malloc(3 * n * sizeof(*now));
+	if (now == NULL) {
+		return 1;
+	}
+	struct ArenaPageEntry *was = now + n;
+	struct ArenaPageEntry *tmp = was + n;
+	int ret = 1;
+	for (size_t i = 0; i < n; i++) {
+		physaddr_t pa;
+		uintptr_t va = (uintptr_t)ma->backing.buf + ape_mfd_off(a, &pg[i]);
+		if (pagemap_pa(pagemap_fd, va, base_page, &pa) != 0 ||
+		    pa / a->page_size > PGNUM_MAX)
+		{
+			goto out;
+		}
+		now[i] = ((struct ArenaPageEntry){pa / a->page_size, pg[i].mfd_pgoff});
+	}
+	memcpy(was, pg, n * sizeof(*was));
+	rsort_pgents(now, n, tmp);
+	rsort_pgents(was, n, tmp);
+	for (size_t i = 0; i < n; i++) {
+		if (now[i].pfn != was[i].pfn) {
+			goto out;
+		}
+	}
+	for (size_t i = 0; i < n; i++) {
+		const struct ArenaPageEntry *e = bsearch(&pg[i], now, n, sizeof(*now), pfn_cmp);
+		pg[i].mfd_pgoff = e->mfd_pgoff;
+	}
+	ret = 0;
+out:
+	free(now);
+	return ret;
+}
+
+struct trim_cand {
+	uint64_t free_since;
+	size_t rbi;
+};
+
+static int trim_cand_cmp(const void *ca, const void *cb)
+{
+	uint64_t a = ((struct trim_cand *)ca)->free_since;
+	uint64_t b = ((struct trim_cand *)cb)->free_since;
+	return (a == b) ? 0 : ((a < b) ? -1 : 1);
+}
+
+/* Most recently trimmed first */
+static int rb_trimmed_cmp(const void *rba, const void *rbb)
+{
+	uint64_t a = ((struct RowBlock *)rba)->free_since;
+	uint64_t b = ((struct RowBlock *)rbb)->free_since;
+	return (a == b) ? 0 : ((a > b) ? -1 : 1);
+}
+
+size_t alis_arena_trim(struct MasterArena *ma, const struct ArenaTrimPolicy *policy)
+{
+	struct Arena *a = &(ma->arena);
+	const size_t keep = (policy != NULL) ? policy->keep_pages : 0;
+	if (a->rb_top == 0 || a->rb_pgtotals[a->rb_top - 1] <= keep) {
+		return 0;
+	}
+	struct trim_cand *cands = malloc(a->rb_top * sizeof(*cands));
+	if (cands == NULL) {
+		return 0;
+	}
+	const uint64_t now = nstime();
+	size_t n = 0;
+	for (size_t i = 0; i < a->rb_top; i++) {
+		const uint64_t since = a->rb_stack[i].free_since;
+		/* Frames that are guards of other blocks must stay put */
+		if (a->rb_tickmap[i] == 0 &&
+		    (policy == NULL || now - since >= policy->min_idle_ns) &&
+		    !block_shared(a, &(a->rb_stack[i])))
+		{
+			cands[n++] = ((struct trim_cand){since, i});
+		}
+	}
+	if (n > 0 && a->trim_ticket == 0) {
+		if (a->last_ticket >= TICKET_MAX) {
+			n = 0;
+		} else {
+			a->trim_ticket = ++a->last_ticket;
+		}
+	}
+	qsort(cands, n, sizeof(*cands), trim_cand_cmp);
+
+	size_t resident = a->rb_pgtotals[a->rb_top - 1];
+	size_t trimmed = 0;
+	/* Each block trims in well over a ns, so stamps stay unique across calls */
+	uint64_t stamp = nstime();
+	for (size_t k = 0; k < n && resident > keep; k++) {
+		struct RowBlock *rb = &(a->rb_stack[cands[k].rbi]);
+		if (resident - rb->data_pgcnt < keep) {
+			continue;
+		}
+		/* Pages a run failed on come back through alis_arena_repopulate too */
+		a->rb_tickmap[cands[k].rbi] = a->trim_ticket;
+		rb->free_since = stamp++;
+		(void) block_runs(ma, rb, trim_run);
+		resident -= rb->data_pgcnt;
+		trimmed += rb->data_pgcnt;
+	}
+	free(cands);
+	if (trimmed) {
+		arena_update_totals(a, 0);
+	}
+	return trimmed;
+}
+
+size_t alis_arena_repopulate(struct MasterArena *ma, size_t want_pages,
+                             size_t *dropped)
+{
+	struct Arena *a = &(ma->arena);
+	size_t n = 0;
+	for (size_t i = 0; i < a->rb_top; i++) {
+		n += (a->trim_ticket != 0 && a->rb_tickmap[i] == a->trim_ticket);
+	}
+	const int pagemap_fd = n ? open("/proc/self/pagemap", O_RDONLY) : -1;
+	/* Blocks move around rb_stack as others are freed and merged */
+	struct RowBlock *rbs = (pagemap_fd >= 0) ? malloc(n * sizeof(*rbs)) : NULL;
+	if (rbs == NULL) {
+		if (pagemap_fd >= 0) {
+			close(pagemap_fd);
+		}
+		return 0;
+	}
+	n = 0;
+	for (size_t i = 0; i < a->rb_top; i++) {
+		if (a->rb_tickmap[i] == a->trim_ticket) {
+			rbs[n++] = a->rb_stack[i];
+		}
+	}
+	/* Freed frames tend to be handed out again last in, first out */
+	qsort(rbs, n, sizeof(*rbs), rb_trimmed_cmp);
+
+	size_t restored = 0;
+	for (size_t k = 0; k < n && (want_pages == 0 || restored < want_pages); k++) {
+		if (block_runs(ma, &rbs[k], lock_run)) {
+			/* Likely out of RLIMIT_MEMLOCK; leave the rest trimmed */
+			(void) block_runs(ma, &rbs[k], trim_run);
+			break;
+		}
+		if (block_refit(ma, &rbs[k], pagemap_fd)) {
+			(void) block_runs(ma, &rbs[k], trim_run);
+			arena_drop_block(a, rbs[k].row_off);
+			if (dropped != NULL) {
+				*dropped += rbs[k].data_pgcnt;
+			}
+			continue;
+		}
+		arena_free_block(a, rbs[k].row_off);
+		restored += rbs[k].data_pgcnt;
+	}
+	free(rbs);
+	close(pagemap_fd);
+	return restored;
+}
@@ -8,12 +8,14 @@
 #define ALIS_ARENA_MGMT_H 1
 
 #include "arena.h"
+#include "sizemodel.h"
 
 #include <ramses/msys.h>
 
 struct ArenaBacking {
 	void *buf;
 	size_t map_sz;
+	int node; /* NUMA node the memory is bound to, or -1 */
 };
 
 struct MasterArena {
@@ -22,16 +24,110 @@ struct MasterArena {
 };
 
 
+enum ArenaPhase {
+	ARENA_PHASE_BACKING,	/* memfd setup and mmap */
+	ARENA_PHASE_POPULATE,	/* Prefaulting and mlock */
+	ARENA_PHASE_BUFMAP,	/* ramses_bufmap */
+	ARENA_PHASE_PASS1,
+	ARENA_PHASE_YIELD,	/* Usable page count check */
+	ARENA_PHASE_PASS2,	/* Excluding sorting */
+	ARENA_PHASE_SORT,
+	ARENA_PHASE_FILL,	/* Scrubbing, guard filling and discarding */
+	ARENA_PHASE_COUNT
+};
+
+struct ArenaIterStats {
+	uint64_t phase_ns[ARENA_PHASE_COUNT];
+	size_t backing_bytes;
+	size_t pte_cnt;
+	size_t usable_pages; /* Pages left after pass1; just below the hint if short */
+	size_t data_pages;   /* Pages placed in row blocks by pass2 */
+};
+
 struct ArenaStats {
 	size_t data_pages;
 	size_t guard_pages;
 	size_t dropped_pages;
 	size_t alloc_iterations;
+	uint64_t total_ns;
+	/* Phase timings and counts, summed over all iterations */
+	struct ArenaIterStats total;
+};
+
+/* ArenaOptions.numa_node values; zeroed options leave the memory unbound */
+#define ARENA_NODE_ANY 0
+#define ARENA_NODE(n) ((n) + 1)
+
+struct ArenaOptions {
+	/* ARENA_NODE(n) binds the backing memory to node n, ARENA_NODE_ANY to none */
+	int numa_node;
+	/* If non-NULL, size the backing buffer with (and train) this model */
+	struct ArenaSizeModel *size_model;
+	/* Prefault the backing buffer with this many threads before mlock */
+	size_t prefault_threads;
+	/*
+	 * Resolve buffer ranges this many entries at a time and grow the page
+	 * lists with the row blocks found, instead of sizing everything for the
+	 * worst case up front. 0 processes whole ranges. PTEs are then looked up
+	 * by binary search instead of through a table of 8 to 16 bytes per PTE.
+	 */
+	size_t stream_window;
+	/*
+	 * Back the arena with huge pages of 1 << hugetlb_shift bytes (e.g. 21 or
+	 * 30) from a hugetlb memfd, or with base pages if 0. Huge pages become the
+	 * arena's pages and are classified whole, one per row; a block's guards
+	 * are the huge pages physically before and after it. Falls back to base
+	 * pages if adjacent rows lie further apart than one huge page. Neither
+	 * the size model nor stream_window apply.
+	 */
+	unsigned hugetlb_shift;
+	/* If non-NULL, filled with the stats of the first `iter_stats_cap' iterations */
+	struct ArenaIterStats *iter_stats;
+	size_t iter_stats_cap;
 };
 
 int alis_arena_create(struct MemorySystem *msys,
                       size_t size_hint, size_t max_cont_rows,
                       struct MasterArena *ma, struct ArenaStats *stats);
+/* Like alis_arena_create, with creation options; `opts' may be NULL */
+int alis_arena_create_opts(struct MemorySystem *msys,
+                           size_t size_hint, size_t max_cont_rows,
+                           const struct ArenaOptions *opts,
+                           struct MasterArena *ma, struct ArenaStats *stats);
 int alis_arena_destroy(struct MasterArena *ma);
 
+/* Which free row blocks alis_arena_trim gives back */
+struct ArenaTrimPolicy {
+	uint64_t min_idle_ns; /* Only blocks free for at least this long */
+	size_t keep_pages;    /* Free data pages to keep resident regardless */
+};
+
+/*
+ * Unlock the data pages of the free row blocks allowed by `policy' (all of
+ * them if NULL), longest idle first, and give them back to the kernel with
+ * MADV_REMOVE. The blocks keep their rows and guards but are held by
+ * arena.trim_ticket, so they are not reserved until repopulated; releasing
+ * that ticket has no effect. Blocks with data pages that are guard pages of
+ * other blocks too (see Arena.guard_shared) are never trimmed.
+ * Trimming may shrink the arena for good: see alis_arena_repopulate.
+ * Returns the number of data pages trimmed.
+ */
+size_t alis_arena_trim(struct MasterArena *ma, const struct ArenaTrimPolicy *policy);
+/*
+ * Fault in and lock trimmed row blocks again, most recently trimmed first,
+ * until at least `want_pages' data pages (0 for all) are back in the free
+ * pool. The kernel hands out whatever frames it has for trimmed pages, so
+ * each page is looked up in /proc/self/pagemap. A block whose pages came back
+ * on its own frames, in any order, is restored with its pages renumbered.
+ * Blocks with pages on other frames are dropped from the arena for good, and
+ * their page counts added to `*dropped' if non-NULL.
+ * Huge page pools hand freed pages back out in order unless other users of
+ * the pool get to them first, so blocks usually come back on hugetlb arenas;
+ * on base page arenas the frames are typically taken by then, and trimming
+ * mostly shrinks the arena for good.
+ * Returns the number of data pages restored.
+ */
+size_t alis_arena_repopulate(struct MasterArena *ma, size_t want_pages,
+                             size_t *dropped);
+
 #endif /* arena_mgmt.h */
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2017-2018 Vrije Universiteit Amsterdam
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE
+
+#include "async.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+struct ArenaBuild {
+	pthread_t tid;
+	struct MemorySystem *msys;
+	size_t size_hint;
+	size_t max_cont_rows;
+	struct ArenaOptions opts;
+	int has_opts;
+
+	struct MasterArena ma;
+	struct ArenaStats stats;
+	int result;
+	int err;
+	int done;
+};
+
+static void *build_thread(void *arg)
+{
+	struct ArenaBuild *b = arg;
+	b->result = alis_arena_create_opts(b->msys, b->size_hint, b->max_cont_rows,
+	                                   b->has_opts ? &(b->opts) : NULL,
+	                                   &(b->ma), &(b->stats));
+	b->err = errno;
+	__atomic_store_n(&(b->done), 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+struct ArenaBuild *alis_arena_create_async(struct MemorySystem *msys,
+                                           size_t size_hint, size_t max_cont_rows,
+                                           const struct ArenaOptions *opts)
+{
+	struct ArenaBuild *b = calloc(1, sizeof(*b));
+	if (b == NULL) {
+		return NULL;
+	}
+	b->msys = msys;
+	b->size_hint = size_hint;
+	b->max_cont_rows = max_cont_rows;
+	if (opts != NULL) {
+		b->opts = *opts;
+		b->has_opts = 1;
+	}
+	int r = pthread_create(&(b->tid), NULL, build_thread, b);
+	if (r != 0) {
+		free(b);
+		errno = r;
+		return NULL;
+	}
+	return b;
+}
+
+int alis_arena_build_done(struct ArenaBuild *b)
+{
+	return __atomic_load_n(&(b->done), __ATOMIC_ACQUIRE);
+}
+
+int alis_arena_build_wait(struct ArenaBuild *b, struct MasterArena *ma,
+                          struct ArenaStats *stats)
+{
+	pthread_join(b->tid, NULL);
+	int r = b->result;
+	if (r == 0) {
+		*ma = b->ma;
+		if (stats != NULL) {
+			*stats = b->stats;
+		}
+	}
+	errno = b->err;
+	free(b);
+	return r;
+}
+
+
+static size_t free_pages(struct Arena *a)
+{
+	return a->rb_top ? a->rb_pgtotals[a->rb_top - 1] : 0;
+}
+
+static void maybe_replenish(struct ArenaReplenisher *r)
+{
+	if (r->standby == NULL &&
+	    free_pages(&(r->active->ma.arena)) < r->low_watermark)
+	{
+		r->standby = alis_arena_create_async(r->msys, r->size_hint,
+		                                     r->max_cont_rows, &(r->opts));
+	}
+}
+
+static void retire(struct ArenaReplenisher *r, struct ReplArena *ra)
+{
+	if (ra->live_tickets == 0) {
+		alis_arena_destroy(&(ra->ma));
+		free(ra);
+		return;
+	}
+	struct ReplArena **d = realloc(r->draining,
+	                               (r->draining_cnt + 1) * sizeof(*d));
+	if (d == NULL) {
+		/* Can't track it; leaking beats pulling pages from under tickets */
+		return;
+	}
+	d[r->draining_cnt++] = ra;
+	r->draining = d;
+}
+
+/* Swap the standby arena in; waits if it is still being built */
+static int promote(struct ArenaReplenisher *r)
+{
+	if (r->standby == NULL) {
+		return 1;
+	}
+	struct ReplArena *ra = malloc(sizeof(*ra));
+	if (ra == NULL) {
+		return 1;
+	}
+	struct ArenaBuild *b = r->standby;
+	r->standby = NULL;
+	if (alis_arena_build_wait(b, &(ra->ma), NULL) != 0) {
+		free(ra);
+		return 1;
+	}
+	ra->live_tickets = 0;
+	ra->id = r->next_id++;
+	retire(r, r->active);
+	r->active = ra;
+	return 0;
+}
+
+int alis_repl_init(struct ArenaReplenisher *r, struct MemorySystem *msys,
+                   size_t size_hint, size_t max_cont_rows,
+                   const struct ArenaOptions *opts, size_t low_watermark)
+{
+	memset(r, 0, sizeof(*r));
+	r->msys = msys;
+	r->size_hint = size_hint;
+	r->max_cont_rows = max_cont_rows;
+	r->opts = (opts != NULL) ? *opts :
+	          ((struct ArenaOptions){.numa_node = ARENA_NODE_ANY});
+	r->low_watermark = low_watermark;
+	r->active = malloc(sizeof(*(r->active)));
+	if (r->active == NULL) {
+		return 1;
+	}
+	if (alis_arena_create_opts(msys, size_hint, max_cont_rows, &(r->opts),
+	                           &(r->active->ma), NULL))
+	{
+		free(r->active);
+		return 1;
+	}
+	r->active->live_tickets = 0;
+	r->active->id = r->next_id++;
+	maybe_replenish(r);
+	return 0;
+}
+
+int alis_repl_destroy(struct ArenaReplenisher *r)
+{
+	int ret = 0;
+	if (r->standby != NULL) {
+		struct MasterArena ma;
+		if (alis_arena_build_wait(r->standby, &ma, NULL) == 0) {
+			ret |= alis_arena_destroy(&ma);
+		}
+	}
+	for (size_t i = 0; i < r->draining_cnt; i++) {
+		ret |= alis_arena_destroy(&(r->draining[i]->ma));
+		free(r->draining[i]);
+	}
+	free(r->draining);
+	ret |= alis_arena_destroy(&(r->active->ma));
+	free(r->active);
+	return ret;
+}
+
+struct ReplTicket alis_repl_reserve(struct ArenaReplenisher *r, size_t size)
+{
+	ticketid_t t = alis_arena_reserve(&(r->active->ma.arena), size);
+	/* Swapping can't help requests that would not fit a fresh arena either */
+	if (t == 0 && size != 0 && size <= r->size_hint) {
+		/* Start a build now if the watermark did not already */
+		if (r->standby == NULL) {
+			r->standby = alis_arena_create_async(r->msys, r->size_hint,
+			                                     r->max_cont_rows, &(r->opts));
+		}
+		if (promote(r) == 0) {
+			t = alis_arena_reserve(&(r->active->ma.arena), size);
+		}
+	}
+	if (t != 0) {
+		r->active->live_tickets++;
+	}
+	struct ReplTicket rt = {r->active, r->active->id, t};
+	maybe_replenish(r);
+	return rt;
+}
+
+void alis_repl_release(struct ArenaReplenisher *r, struct ReplTicket rt)
+{
+	if (rt.ticket == 0 || rt.ra == NULL) {
+		return;
+	}
+	/*
+	 * The arena of a stale ticket may be gone already, and its address taken
+	 * by a newer arena, so its id must match too
+	 */
+	size_t i = 0;
+	if (rt.ra != r->active) {
+		for (; i < r->draining_cnt && r->draining[i] != rt.ra; i++);
+		if (i == r->draining_cnt) {
+			return;
+		}
+	}
+	if (rt.ra->id != rt.arena_id) {
+		return;
+	}
+	/* Releasing a ticket twice must not count it out twice */
+	if (alis_arena_release(&(rt.ra->ma.arena), rt.ticket) == 0) {
+		return;
+	}
+	rt.ra->live_tickets--;
+	if (rt.ra != r->active && rt.ra->live_tickets == 0) {
+		r->draining[i] = r->draining[--(r->draining_cnt)];
+		alis_arena_destroy(&(rt.ra->ma));
+		free(rt.ra);
+	}
+}
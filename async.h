@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_ASYNC_H
+#define ALIS_ASYNC_H 1
+
+#include "arena.h"
+#include "arena_mgmt.h"
+
+#include <ramses/msys.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct ArenaBuild;
+
+/*
+ * Start building an arena on a background thread. `msys' and anything `opts'
+ * points to must stay valid, and untouched, until the build is waited for.
+ *
+ * Returns NULL if the build could not be started.
+ */
+struct ArenaBuild *alis_arena_create_async(struct MemorySystem *msys,
+                                           size_t size_hint, size_t max_cont_rows,
+                                           const struct ArenaOptions *opts);
+/* Returns non-zero once the build has finished; never blocks */
+int alis_arena_build_done(struct ArenaBuild *b);
+/*
+ * Wait for the build to finish and release the handle. On success stores the
+ * arena in `*ma' and, if `stats' is non-NULL, its creation stats. The
+ * per-iteration records go to the `iter_stats' buffer of the options, if any.
+ *
+ * Returns 0 on success, 1 on failure, like alis_arena_create.
+ */
+int alis_arena_build_wait(struct ArenaBuild *b, struct MasterArena *ma,
+                          struct ArenaStats *stats);
+
+/*
+ * Double-buffered arena: keeps a standby arena built in the background
+ * whenever the active one drops below `low_watermark' free pages, and swaps
+ * to it when the active one runs out.
+ * Arenas that were swapped out stay alive until their last ticket is released.
+ */
+struct ReplArena {
+	struct MasterArena ma;
+	size_t live_tickets;
+	uint64_t id; /* Never reused, unlike the address of the ReplArena */
+};
+
+struct ArenaReplenisher {
+	struct MemorySystem *msys;
+	size_t size_hint;
+	size_t max_cont_rows;
+	struct ArenaOptions opts;
+	size_t low_watermark;
+
+	struct ReplArena *active;
+	struct ArenaBuild *standby;
+	struct ReplArena **draining;
+	size_t draining_cnt;
+	uint64_t next_id;
+};
+
+struct ReplTicket {
+	struct ReplArena *ra;
+	uint64_t arena_id;
+	ticketid_t ticket;
+};
+
+/*
+ * Build the first arena synchronously. `opts' may be NULL.
+ * Returns 0 on success, 1 on failure.
+ */
+int alis_repl_init(struct ArenaReplenisher *r, struct MemorySystem *msys,
+                   size_t size_hint, size_t max_cont_rows,
+                   const struct ArenaOptions *opts, size_t low_watermark);
+int alis_repl_destroy(struct ArenaReplenisher *r);
+
+/* On failure, returns a ReplTicket with a zero ticket */
+struct ReplTicket alis_repl_reserve(struct ArenaReplenisher *r, size_t size);
+/*
+ * Release a reservation. Releasing a ticket that was released before, or whose
+ * arena has been destroyed since, has no effect.
+ */
+void alis_repl_release(struct ArenaReplenisher *r, struct ReplTicket rt);
+
+#endif /* async.h */
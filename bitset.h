@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef BITSET_H
+#define BITSET_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t bitword_t;
+#define BITWORD_BITS 64
+
+static inline size_t bitset_words(size_t nbits)
+{
+	return (nbits / BITWORD_BITS) + ((nbits % BITWORD_BITS) ? 1 : 0);
+}
+
+static inline int bitset_test(const bitword_t *bs, size_t i)
+{
+	return (bs[i / BITWORD_BITS] >> (i % BITWORD_BITS)) & 1;
+}
+
+static inline void bitset_set(bitword_t *bs, size_t i)
+{
+	bs[i / BITWORD_BITS] |= (bitword_t)1 << (i % BITWORD_BITS);
+}
+
+static inline void bitset_clear(bitword_t *bs, size_t i)
+{
+	bs[i / BITWORD_BITS] &= ~((bitword_t)1 << (i % BITWORD_BITS));
+}
+
+/* Set bit i and return its previous value */
+static inline int bitset_test_set(bitword_t *bs, size_t i)
+{
+	const bitword_t m = (bitword_t)1 << (i % BITWORD_BITS);
+	const bitword_t w = bs[i / BITWORD_BITS];
+	bs[i / BITWORD_BITS] = w | m;
+	return (w & m) != 0;
+}
+
+/* Mask selecting the valid bits of the last word of an nbits long set */
+static inline bitword_t bitset_tailmask(size_t nbits)
+{
+	return (nbits % BITWORD_BITS) ?
+	       ((bitword_t)1 << (nbits % BITWORD_BITS)) - 1 : ~(bitword_t)0;
+}
+
+static inline size_t bitset_count(const bitword_t *bs, size_t nbits)
+{
+	const size_t nw = bitset_words(nbits);
+	size_t n = 0;
+	for (size_t w = 0; w < nw; w++) {
+		bitword_t v = bs[w];
+		if (w == nw - 1) {
+			v &= bitset_tailmask(nbits);
+		}
+		n += __builtin_popcountll(v);
+	}
+	return n;
+}
+
+#endif /* bitset.h */
@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE
+
+#include "compact.h"
+#include "arena_int.h"
+#include "map.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+
+void alis_compact_init(struct Compactor *c, struct Arena *arena)
+{
+	memset(c, 0, sizeof(*c));
+	c->arena = arena;
+}
+
+void alis_compact_destroy(struct Compactor *c)
+{
+	free(c->ents);
+	memset(c, 0, sizeof(*c));
+}
+
+static struct CompactEntry *find(const struct Compactor *c, const void *addr)
+{
+	for (size_t i = 0; i < c->ent_cnt; i++) {
+		if (c->ents[i].addr == addr) {
+			return &(c->ents[i]);
+		}
+	}
+	return NULL;
+}
+
+int alis_compact_register(struct Compactor *c, ticketid_t ticket, void *addr)
+{
+	const size_t cnt = alis_arena_get_data(c->arena, ticket, NULL, 0);
+	if (cnt == 0 || find(c, addr) != NULL) {
+		return 1;
+	}
+	if (c->ent_cnt == c->ent_cap) {
+		size_t cap = c->ent_cap ? 2 * c->ent_cap : 16;
+		struct CompactEntry *ents = realloc(c->ents, cap * sizeof(*ents));
+		if (ents == NULL) {
+			return 1;
+		}
+		c->ents = ents;
+		c->ent_cap = cap;
+	}
+	c->ents[c->ent_cnt++] = ((struct CompactEntry){
+		.ticket = ticket,
+		.addr = addr,
+		.len = cnt * c->arena->page_size
+	});
+	return 0;
+}
+
+ticketid_t alis_compact_unregister(struct Compactor *c, const void *addr)
+{
+	struct CompactEntry *e = find(c, addr);
+	if (e == NULL) {
+		return 0;
+	}
+	const ticketid_t t = e->ticket;
+	if (e->held != 0) {
+		alis_arena_release(c->arena, e->held);
+	}
+	*e = c->ents[--(c->ent_cnt)];
+	return t;
+}
+
+ticketid_t alis_compact_ticket(const struct Compactor *c, const void *addr)
+{
+	const struct CompactEntry *e = find(c, addr);
+	return (e != NULL) ? e->ticket : 0;
+}
+
+static size_t count_blocks(const struct Arena *a, ticketid_t t)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < a->rb_top; i++) {
+		n += (a->rb_tickmap[i] == t);
+	}
+	return n;
+}
+
+/*
+ * Keep writers out of [addr, addr + len) until thaw. Writes block on a
+ * userfaultfd write-protection if the kernel supports it for shared memory,
+ * and fault on a read-only range otherwise. Returns the userfaultfd, -1 if the
+ * range was made read-only instead, or -2 on failure.
+ */
+static int freeze(void *addr, size_t len)
+{
+	#ifdef UFFD_FEATURE_WP_HUGETLBFS_SHMEM
+	int fd = (int)syscall(SYS_userfaultfd, O_CLOEXEC);
+	#ifdef UFFD_USER_MODE_ONLY
+	if (fd < 0 && (errno == EPERM || errno == EACCES)) {
+		fd = (int)syscall(SYS_userfaultfd, O_CLOEXEC | UFFD_USER_MODE_ONLY);
+	}
+	#endif
+	if (fd >= 0) {
+		struct uffdio_api api = {
+			.api = UFFD_API,
+			.features = UFFD_FEATURE_WP_HUGETLBFS_SHMEM
+		};
+		struct uffdio_register reg = {
+			.range = {(uintptr_t)addr, len},
+			.mode = UFFDIO_REGISTER_MODE_WP
+		};
+		struct uffdio_writeprotect wp = {
+			.range = {(uintptr_t)addr, len},
+			.mode = UFFDIO_WRITEPROTECT_MODE_WP
+		};
+		if (ioctl(fd, UFFDIO_API, &api) == 0 &&
+		    ioctl(fd, UFFDIO_REGISTER, &reg) == 0 &&
+		    ioctl(fd, UFFDIO_WRITEPROTECT, &wp) == 0)
+		{
+			return fd;
+		}
+		/* Closing unregisters the range */
+		close(fd);
+	}
+	#endif
+	return (mprotect(addr, len, PROT_READ) == 0) ? -1 : -2;
+}
+
+/*
+ * Let writers back in: lift the protection from [addr, addr + len) if the old
+ * pages are still mapped there (`moved' is 0), and wake the writers blocked.
+ */
+static void thaw(int fd, void *addr, size_t len, int moved)
+{
+	if (fd >= 0) {
+		struct uffdio_writeprotect wp = {.range = {(uintptr_t)addr, len}, .mode = 0};
+		if (!moved) {
+			(void) ioctl(fd, UFFDIO_WRITEPROTECT, &wp);
+		}
+		/* Woken writers retry and find the range writable, or the new pages */
+		(void) ioctl(fd, UFFDIO_WAKE, &(wp.range));
+		close(fd);
+	} else if (fd == -1 && !moved) {
+		(void) mprotect(addr, len, PROT_READ|PROT_WRITE);
+	}
+}
+
+/*
+ * Move the mapping of the `cnt' pages at `offs', mapped at `from', over `to',
+ * one run of pages adjacent in the mfd at a time, as each is a mapping of its
+ * own. A run either moves whole or is left in place. Returns the number of
+ * pages moved, stopping at the first run that fails.
+ */
+static size_t swap_runs(const struct Arena *a, void *to, char *from,
+                        const off_t *offs, size_t cnt)
+{
+	size_t i = 0;
+	while (i < cnt) {
+		size_t run = 1;
+		while (i + run < cnt &&
+		       offs[i + run] == offs[i] + (off_t)(run * a->page_size))
+		{
+			run++;
+		}
+		const size_t off = i * a->page_size;
+		if (mremap(from + off, run * a->page_size, run * a->page_size,
+		           MREMAP_MAYMOVE|MREMAP_FIXED, (char *)to + off) == MAP_FAILED)
+		{
+			break;
+		}
+		i += run;
+	}
+	return i;
+}
+
+/*
+ * Map the old pages `offs' of `e' over its whole range again, after its first
+ * `done' pages were swapped for new ones. Writers were held off the rest, but
+ * may have written the new pages since the swap: those are held off again and
+ * copied back. Returns 0 on success.
+ */
+static int undo_swap(const struct Arena *a, struct CompactEntry *e, off_t *offs,
+                     size_t done)
+{
+	const size_t len = done * a->page_size;
+	char *old = alis_map(NULL, 0, a->mfd, offs, done, a->page_size);
+	if (old == MAP_FAILED) {
+		return 1;
+	}
+	const int fd = freeze(e->addr, len);
+	if (fd == -2) {
+		alis_unmap(old, len);
+		return 1;
+	}
+	memcpy(old, e->addr, len);
+	const int r = alis_map_fixed(e->addr, a->mfd, offs, e->len / a->page_size,
+	                             a->page_size);
+	thaw(fd, e->addr, len, r == 0);
+	alis_unmap(old, len);
+	return r;
+}
+
+/* Copy the data of `e' to a new ticket and map it in place; returns 0 if moved */
+static int move_entry(struct Arena *a, struct CompactEntry *e)
+{
+	const size_t cnt = e->len / a->page_size;
+	const size_t blocks = count_blocks(a, e->ticket);
+	const size_t merges = arena_release_merges(a, e->ticket);
+	const size_t free_before = count_blocks(a, 0);
+	if (merges < blocks) {
+		/* Releasing it would not even offset its own blocks */
+		return 1;
+	}
+	off_t *offs = malloc(2 * cnt * sizeof(*offs));
+	if (offs == NULL) {
+		return 1;
+	}
+	off_t *noffs = offs + cnt;
+	char *tmp = MAP_FAILED;
+	alis_arena_get_data(a, e->ticket, offs, cnt);
+
+	ticketid_t nt = arena_reserve_away(a, e->len, e->ticket);
+	if (nt == 0) {
+		goto err_free;
+	}
+	/* Releasing the old ticket adds its blocks back, minus the merges */
+	if (count_blocks(a, nt) > blocks ||
+	    count_blocks(a, 0) + blocks - merges >= free_before)
+	{
+		goto err_release;
+	}
+	alis_arena_get_data(a, nt, noffs, cnt);
+	tmp = alis_map(NULL, 0, a->mfd, noffs, cnt, a->page_size);
+	if (tmp == MAP_FAILED) {
+		goto err_release;
+	}
+	const int fd = freeze(e->addr, e->len);
+	if (fd == -2) {
+		goto err_unmap;
+	}
+	memcpy(tmp, e->addr, e->len);
+	const size_t done = swap_runs(a, e->addr, tmp, noffs, cnt);
+	if (done == 0) {
+		thaw(fd, e->addr, e->len, 0);
+		goto err_unmap;
+	}
+	if (done < cnt) {
+		/* Part of the range has the new pages already: commit the move */
+		char *rest = (char *)e->addr + done * a->page_size;
+		const size_t rest_len = (cnt - done) * a->page_size;
+		alis_unmap(tmp + done * a->page_size, rest_len);
+		if (alis_map_fixed(rest, a->mfd, noffs + done, cnt - done, a->page_size) != 0) {
+			if (undo_swap(a, e, offs, done) != 0) {
+				/* Pages of both tickets back the range now, so both stay reserved */
+				e->held = nt;
+				thaw(fd, e->addr, e->len, 0);
+				free(offs);
+				return 1;
+			}
+			thaw(fd, e->addr, e->len, 1);
+			goto err_release;
+		}
+	}
+	thaw(fd, e->addr, e->len, 1);
+	alis_arena_release(a, e->ticket);
+	e->ticket = nt;
+	free(offs);
+	return 0;
+
+err_unmap:
+	alis_unmap(tmp, e->len);
+err_release:
+	alis_arena_release(a, nt);
+err_free:
+	free(offs);
+	return 1;
+}
+
+struct candidate {
+	size_t ent;
+	size_t gain;
+};
+
+static int candidate_cmp(const void *ca, const void *cb)
+{
+	const struct candidate *a = ca;
+	const struct candidate *b = cb;
+	return (a->gain == b->gain) ? 0 : ((a->gain > b->gain) ? -1 : 1);
+}
+
+size_t alis_compact(struct Compactor *c, size_t max_moves, size_t *copied)
+{
+	struct Arena *a = c->arena;
+	size_t moved = 0;
+	size_t bytes = 0;
+	struct candidate *cands = malloc(c->ent_cnt * sizeof(*cands));
+	if (cands != NULL) {
+		size_t n = 0;
+		for (size_t i = 0; i < c->ent_cnt; i++) {
+			if (c->ents[i].held != 0) {
+				continue;
+			}
+			const size_t merges = arena_release_merges(a, c->ents[i].ticket);
+			const size_t blocks = count_blocks(a, c->ents[i].ticket);
+			if (merges >= blocks) {
+				cands[n++] = ((struct candidate){i, merges - blocks + 1});
+			}
+		}
+		qsort(cands, n, sizeof(*cands), candidate_cmp);
+		/* Earlier moves change the gains; move_entry checks again */
+		for (size_t i = 0; i < n && (max_moves == 0 || moved < max_moves); i++) {
+			struct CompactEntry *e = &(c->ents[cands[i].ent]);
+			if (move_entry(a, e) == 0) {
+				moved++;
+				bytes += e->len;
+			}
+		}
+		free(cands);
+	}
+	if (copied != NULL) {
+		*copied = bytes;
+	}
+	return moved;
+}
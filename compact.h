@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_COMPACT_H
+#define ALIS_COMPACT_H 1
+
+#include "arena.h"
+
+#include <stddef.h>
+
+struct CompactEntry {
+	ticketid_t ticket;
+	void *addr;
+	size_t len;
+	/*
+	 * Ticket whose pages back the start of the range after a move that could
+	 * neither finish nor be undone, or 0. Such ranges are not moved again.
+	 */
+	ticketid_t held;
+};
+
+/*
+ * Tracks mapped tickets whose owners allow them to be moved. Compaction moves
+ * such a ticket when releasing it lets free row blocks merge across the cut
+ * rows left by splits: its data is copied to pages elsewhere in the arena and
+ * the new mapping is moved over the old range with mremap, so the virtual
+ * addresses stay valid. The ticket id changes with every move.
+ *
+ * The range is write-protected through userfaultfd while it is copied, so a
+ * write racing with a move blocks until the new pages are in place. Kernels
+ * that cannot write-protect shared memory this way (before Linux 5.19) get a
+ * read-only range instead, and there a racing write faults: owners must keep
+ * writers out of movable ranges while alis_compact runs.
+ *
+ * Only the registered range is moved: a movable ticket must not be mapped
+ * anywhere else, e.g. through a MapCache or a LazyMap, as those mappings
+ * would keep the pages given up by a move.
+ */
+struct Compactor {
+	struct Arena *arena;
+	struct CompactEntry *ents;
+	size_t ent_cnt;
+	size_t ent_cap;
+};
+
+void alis_compact_init(struct Compactor *c, struct Arena *arena);
+void alis_compact_destroy(struct Compactor *c);
+
+/*
+ * Register `ticket', whose data pages are mapped at `addr' in the order given
+ * by alis_arena_get_data (as done by alis_map), as movable.
+ * Returns 0 on success, 1 on failure.
+ */
+int alis_compact_register(struct Compactor *c, ticketid_t ticket, void *addr);
+/*
+ * Stop moving the ticket mapped at `addr'; it must be unregistered before it
+ * is released or unmapped. A held ticket (see CompactEntry) is released here,
+ * so the range must be unmapped before the next reservation.
+ * Returns its current ticket id, or 0 if unknown.
+ */
+ticketid_t alis_compact_unregister(struct Compactor *c, const void *addr);
+/* Current ticket id of the range mapped at `addr', or 0 if unknown */
+ticketid_t alis_compact_ticket(const struct Compactor *c, const void *addr);
+
+/*
+ * Move up to `max_moves' registered tickets (0 for no limit), those whose
+ * release merges the most free row blocks first. A ticket is only moved if
+ * the arena ends up with fewer free row blocks and the ticket with no more
+ * row blocks than before. Stores the number of bytes copied in `*copied' if
+ * non-NULL.
+ *
+ * Returns the number of tickets moved.
+ */
+size_t alis_compact(struct Compactor *c, size_t max_moves, size_t *copied);
+
+#endif /* compact.h */
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2017-2018 Vrije Universiteit Amsterdam
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE
+
+#include "guard.h"
+#include "guard_int.h"
+#include "bitset.h"
+#include "nstime.h"
+
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define GUARD_X86 1
+#endif
+
+#define BUDGET_CHECK_PAGES 64
+
+#ifdef GUARD_X86
+static int kernel_sse2(const void *page, size_t len)
+{
+	const __m128i pat = _mm_set1_epi8((char)ARENA_GUARD_BYTE);
+	const __m128i *p = page;
+	__m128i acc = _mm_setzero_si128();
+	for (size_t i = 0; i < len / sizeof(*p); i += 4) {
+		acc = _mm_or_si128(acc, _mm_xor_si128(_mm_load_si128(p + i), pat));
+		acc = _mm_or_si128(acc, _mm_xor_si128(_mm_load_si128(p + i + 1), pat));
+		acc = _mm_or_si128(acc, _mm_xor_si128(_mm_load_si128(p + i + 2), pat));
+		acc = _mm_or_si128(acc, _mm_xor_si128(_mm_load_si128(p + i + 3), pat));
+	}
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xffff;
+}
+
+__attribute__((target("avx2")))
+static int kernel_avx2(const void *page, size_t len)
+{
+	const __m256i pat = _mm256_set1_epi8((char)ARENA_GUARD_BYTE);
+	const __m256i *p = page;
+	__m256i acc = _mm256_setzero_si256();
+	for (size_t i = 0; i < len / sizeof(*p); i += 2) {
+		acc = _mm256_or_si256(acc, _mm256_xor_si256(_mm256_load_si256(p + i), pat));
+		acc = _mm256_or_si256(acc, _mm256_xor_si256(_mm256_load_si256(p + i + 1), pat));
+	}
+	return !_mm256_testz_si256(acc, acc);
+}
+#else
+static int kernel_u64(const void *page, size_t len)
+{
+	const uint64_t pat = 0x0101010101010101ULL * ARENA_GUARD_BYTE;
+	const uint64_t *p = page;
+	uint64_t acc = 0;
+	for (size_t i = 0; i < len / sizeof(*p); i++) {
+		acc |= p[i] ^ pat;
+	}
+	return acc != 0;
+}
+#endif
+
+size_t guard_kernels(guard_kernel_t *kernels, size_t max)
+{
+	size_t n = 0;
+	#ifdef GUARD_X86
+	__builtin_cpu_init();
+	if (n < max && __builtin_cpu_supports("avx2")) {
+		kernels[n++] = kernel_avx2;
+	}
+	if (n < max) {
+		kernels[n++] = kernel_sse2;
+	}
+	#else
+	if (n < max) {
+		kernels[n++] = kernel_u64;
+	}
+	#endif
+	return n;
+}
+
+static guard_kernel_t kernel;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void pick_kernel(void)
+{
+	guard_kernels(&kernel, 1);
+}
+
+size_t guard_count_bad(const unsigned char *page, size_t len)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < len; i++) {
+		n += (page[i] != ARENA_GUARD_BYTE);
+	}
+	return n;
+}
+
+size_t alis_guard_scan(struct MasterArena *ma, struct GuardScanner *gs,
+                       size_t max_pages, uint64_t budget_ns, int refill,
+                       struct GuardFault *faults, size_t max_faults)
+{
+	struct Arena *a = &(ma->arena);
+	const size_t total = a->guard_pgents_size;
+	if (total == 0) {
+		return 0;
+	}
+	pthread_once(&kernel_once, pick_kernel);
+	const uint64_t deadline = budget_ns ? nstime() + budget_ns : 0;
+	const size_t limit = (max_pages && max_pages < total) ? max_pages : total;
+
+	size_t found = 0;
+	for (size_t n = 0; n < limit; n++) {
+		if (gs->cursor >= total) {
+			gs->cursor = 0;
+		}
+		const size_t gi = gs->cursor++;
+		if (gs->cursor == total) {
+			gs->passes++;
+		}
+		/* Guard rows lent to a ticket, and pages that are data pages too, hold data */
+		if ((a->guard_lent != NULL && bitset_test(a->guard_lent, gi)) ||
+		    (a->guard_shared != NULL && bitset_test(a->guard_shared, gi)))
+		{
+			continue;
+		}
+		const struct ArenaPageEntry *ape = &(a->guard_pgents[gi]);
+		unsigned char *page = (unsigned char *)ma->backing.buf + ape_mfd_off(a, ape);
+		const int dirty = (a->page_size % 64) ?
+		                  guard_count_bad(page, a->page_size) != 0 :
+		                  kernel(page, a->page_size);
+		if (dirty) {
+			if (found < max_faults) {
+				faults[found] = ((struct GuardFault){
+					.pa = ape_pa(a, ape),
+					.mfd_off = ape_mfd_off(a, ape),
+					.bad_bytes = guard_count_bad(page, a->page_size)
+				});
+			}
+			found++;
+			if (refill) {
+				memset(page, ARENA_GUARD_BYTE, a->page_size);
+			}
+		}
+		gs->pages_scanned++;
+		if (deadline && (n % BUDGET_CHECK_PAGES) == BUDGET_CHECK_PAGES - 1 &&
+		    nstime() >= deadline)
+		{
+			break;
+		}
+	}
+	gs->pages_corrupted += found;
+	return found;
+}
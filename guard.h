@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_GUARD_H
+#define ALIS_GUARD_H 1
+
+#include "arena.h"
+#include "arena_mgmt.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Incremental scan state; zero-initialise before the first scan */
+struct GuardScanner {
+	size_t cursor; /* Next index into guard_pgents */
+	size_t passes; /* Completed passes over all guard pages */
+	size_t pages_scanned;
+	size_t pages_corrupted;
+};
+
+struct GuardFault {
+	physaddr_t pa;
+	off_t mfd_off;
+	size_t bad_bytes; /* Bytes that differ from ARENA_GUARD_BYTE */
+};
+
+/*
+ * Check guard pages of `ma' against ARENA_GUARD_BYTE, resuming where the last
+ * call on `gs' stopped and wrapping around at the end of guard_pgents. Pages
+ * in lent rows and pages that are data pages too are skipped.
+ * Stops after `max_pages' pages or once `budget_ns' nanoseconds have passed,
+ * whichever comes first; either may be 0 for no limit, but a call never goes
+ * past one full pass.
+ * Corrupted pages are stored in `*faults' (up to `max_faults' of them) and,
+ * if `refill' is set, filled with ARENA_GUARD_BYTE again.
+ *
+ * Returns the number of corrupted pages found, which may exceed `max_faults'.
+ */
+size_t alis_guard_scan(struct MasterArena *ma, struct GuardScanner *gs,
+                       size_t max_pages, uint64_t budget_ns, int refill,
+                       struct GuardFault *faults, size_t max_faults);
+
+#endif /* guard.h */
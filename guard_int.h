@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_GUARD_INT_H
+#define ALIS_GUARD_INT_H 1
+
+#include <stddef.h>
+
+/*
+ * Kernels return non-zero if any byte of the page differs from the pattern.
+ * `page' is aligned to 32 bytes and `len' is a multiple of 64.
+ */
+typedef int (*guard_kernel_t)(const void *page, size_t len);
+
+/* Store up to `max' of the kernels this CPU can run, best first; returns their count */
+size_t guard_kernels(guard_kernel_t *kernels, size_t max);
+/* Number of bytes of `page' that differ from the pattern */
+size_t guard_count_bad(const unsigned char *page, size_t len);
+
+#endif /* guard_int.h */
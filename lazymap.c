@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2017-2018 Vrije Universiteit Amsterdam
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE
+
+#include "lazymap.h"
+#include "map.h"
+#include "ceildiv.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/userfaultfd.h>
+
+#define CHUNK_MAPPED(lm, i)	((lm)->mapped[(i) / 8] & (1 << ((i) % 8)))
+
+static int open_uffd(void)
+{
+	int fd = (int)syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+	#ifdef UFFD_USER_MODE_ONLY
+	if (fd < 0 && (errno == EPERM || errno == EACCES)) {
+		fd = (int)syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+	}
+	#endif
+	if (fd < 0) {
+		return -1;
+	}
+	struct uffdio_api api = {.api = UFFD_API, .features = 0};
+	if (ioctl(fd, UFFDIO_API, &api) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Map the unmapped chunks of the batch around chunk `ci' */
+static void resolve(struct LazyMap *lm, size_t ci)
+{
+	size_t lo = (ci > lm->batch / 2) ? ci - lm->batch / 2 : 0;
+	size_t hi = lo + lm->batch;
+	if (hi > lm->chunk_count) {
+		hi = lm->chunk_count;
+		lo = (hi > lm->batch) ? hi - lm->batch : 0;
+	}
+	size_t i = lo;
+	while (i < hi) {
+		if (CHUNK_MAPPED(lm, i)) {
+			i++;
+			continue;
+		}
+		size_t j = i;
+		while (j < hi && !CHUNK_MAPPED(lm, j)) {
+			lm->mapped[j / 8] |= 1 << (j % 8);
+			j++;
+		}
+		void *start = (char *)lm->addr + i * lm->chunk_size;
+		if (alis_map_fixed(start, lm->mfd, lm->offsets + i, j - i, lm->chunk_size)) {
+			/* Fault for good rather than retry or hand out zero pages */
+			mmap(start, (j - i) * lm->chunk_size, PROT_NONE,
+			     MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED, -1, 0);
+		}
+		i = j;
+	}
+}
+
+static void *fault_thread(void *arg)
+{
+	struct LazyMap *lm = arg;
+	struct pollfd pfd[2] = {
+		{.fd = lm->uffd, .events = POLLIN},
+		{.fd = lm->stopfd, .events = POLLIN}
+	};
+	for (;;) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (pfd[1].revents) {
+			break;
+		}
+		struct uffd_msg msg;
+		ssize_t r = read(lm->uffd, &msg, sizeof(msg));
+		if (r != sizeof(msg) || msg.event != UFFD_EVENT_PAGEFAULT) {
+			continue;
+		}
+		uintptr_t fa = (uintptr_t)msg.arg.pagefault.address;
+		size_t ci = (fa - (uintptr_t)lm->addr) / lm->chunk_size;
+		if (ci < lm->chunk_count) {
+			resolve(lm, ci);
+		}
+		/* The retried fault finds the file mapping instead */
+		struct uffdio_range wr = {
+			.start = (uintptr_t)lm->addr + ci * lm->chunk_size,
+			.len = lm->chunk_size
+		};
+		ioctl(lm->uffd, UFFDIO_WAKE, &wr);
+	}
+	return NULL;
+}
+
+int alis_lazymap_create(struct LazyMap *lm, void *addr, size_t align, int mfd,
+                        const off_t *offsets, size_t chunk_count,
+                        size_t chunk_size, size_t batch)
+{
+	memset(lm, 0, sizeof(*lm));
+	lm->len = chunk_count * chunk_size;
+	lm->mfd = mfd;
+	lm->chunk_count = chunk_count;
+	lm->chunk_size = chunk_size;
+	lm->batch = batch ? batch : 1;
+	lm->offsets = malloc(chunk_count * sizeof(*offsets));
+	lm->mapped = calloc(ceildiv(chunk_count, 8), 1);
+	if (lm->offsets == NULL || lm->mapped == NULL) {
+		goto err_free;
+	}
+	memcpy(lm->offsets, offsets, chunk_count * sizeof(*offsets));
+
+	lm->addr = alis_map_reserve(addr, lm->len, align);
+	if (lm->addr == MAP_FAILED) {
+		goto err_free;
+	}
+	/* Placeholder pages have to be accessible to raise missing faults */
+	if (mmap(lm->addr, lm->len, PROT_READ|PROT_WRITE,
+	         MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED, -1, 0) == MAP_FAILED)
+	{
+		goto err_unmap;
+	}
+
+	lm->uffd = open_uffd();
+	if (lm->uffd < 0) {
+		goto err_unmap;
+	}
+	struct uffdio_register reg = {
+		.range = {.start = (uintptr_t)lm->addr, .len = lm->len},
+		.mode = UFFDIO_REGISTER_MODE_MISSING
+	};
+	if (ioctl(lm->uffd, UFFDIO_REGISTER, &reg) != 0) {
+		goto err_close;
+	}
+	lm->stopfd = eventfd(0, EFD_CLOEXEC);
+	if (lm->stopfd < 0) {
+		goto err_close;
+	}
+	int r = pthread_create(&(lm->tid), NULL, fault_thread, lm);
+	if (r != 0) {
+		errno = r;
+		close(lm->stopfd);
+		goto err_close;
+	}
+	return 0;
+
+err_close:
+	close(lm->uffd);
+err_unmap:
+	munmap(lm->addr, lm->len);
+err_free:
+	free(lm->offsets);
+	free(lm->mapped);
+	return 1;
+}
+
+int alis_lazymap_destroy(struct LazyMap *lm)
+{
+	uint64_t one = 1;
+	if (write(lm->stopfd, &one, sizeof(one)) == sizeof(one)) {
+		pthread_join(lm->tid, NULL);
+	}
+	close(lm->stopfd);
+	close(lm->uffd);
+	int r = alis_unmap(lm->addr, lm->len);
+	free(lm->offsets);
+	free(lm->mapped);
+	return r;
+}
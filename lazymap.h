@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_LAZYMAP_H
+#define ALIS_LAZYMAP_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/*
+ * A reservation mapped on first touch. The range starts out as anonymous
+ * memory registered with userfaultfd; a handler thread answers each missing
+ * page fault by mapping the chunks around the faulting address from the mfd
+ * with MAP_FIXED, which replaces the anonymous placeholder, and then wakes
+ * the faulting thread.
+ *
+ * Where unprivileged userfaultfd is restricted to user mode faults, kernel
+ * accesses (e.g. read(2) into the range) to untouched chunks fail with EFAULT.
+ */
+struct LazyMap {
+	void *addr;
+	size_t len;
+	int mfd;
+	off_t *offsets;
+	size_t chunk_count;
+	size_t chunk_size;
+	size_t batch;
+	uint8_t *mapped; /* One bit per chunk */
+
+	int uffd;
+	int stopfd;
+	pthread_t tid;
+};
+
+/*
+ * Set up a lazy mapping of `chunk_count' chunks at `offsets' in `mfd', like
+ * alis_map. Faults map up to `batch' chunks at once, centered on the fault.
+ * `offsets' is copied.
+ *
+ * Returns 0 on success, 1 on failure (with errno set).
+ */
+int alis_lazymap_create(struct LazyMap *lm, void *addr, size_t align, int mfd,
+                        const off_t *offsets, size_t chunk_count,
+                        size_t chunk_size, size_t batch);
+/* Stop the fault handler and unmap the whole range */
+int alis_lazymap_destroy(struct LazyMap *lm);
+
+#endif /* lazymap.h */
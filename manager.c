@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2017-2018 Vrije Universiteit Amsterdam
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "manager.h"
+
+#include <string.h>
+
+#define GEN_MASK	((UINT64_C(1) << 40) - 1)
+
+#define TICKET_SLOT(t)	(((t) >> 16) & 0xff)
+#define TICKET_GEN(t)	(((t) >> 24) & GEN_MASK)
+#define TICKET_ID(t)	((ticketid_t)((t) & 0xffff))
+
+static mgr_ticket_t mkticket(struct ArenaManager *m, size_t slot, ticketid_t t)
+{
+	return ((mgr_ticket_t)m->slots[slot].gen << 24) |
+	       ((mgr_ticket_t)slot << 16) | t;
+}
+
+static struct ManagedArena *lookup(struct ArenaManager *m, mgr_ticket_t t)
+{
+	struct ManagedArena *s = &(m->slots[TICKET_SLOT(t)]);
+	if (TICKET_ID(t) == 0 || !s->in_use || s->gen != TICKET_GEN(t)) {
+		return NULL;
+	}
+	return s;
+}
+
+static size_t free_pages(struct Arena *a)
+{
+	return a->rb_top ? a->rb_pgtotals[a->rb_top - 1] : 0;
+}
+
+/* Returns the new slot index, or MGR_MAX_ARENAS on failure */
+static size_t add_arena(struct ArenaManager *m, size_t size_hint)
+{
+	size_t i;
+	for (i = 0; i < MGR_MAX_ARENAS && m->slots[i].in_use; i++);
+	if (i == MGR_MAX_ARENAS) {
+		return i;
+	}
+	struct ManagedArena *s = &(m->slots[i]);
+	if (alis_arena_create_opts(m->msys, size_hint, m->max_cont_rows, &(m->opts),
+	                           &(s->ma), NULL))
+	{
+		return MGR_MAX_ARENAS;
+	}
+	s->live_tickets = 0;
+	s->in_use = 1;
+	m->arena_cnt++;
+	return i;
+}
+
+static void drop_arena(struct ArenaManager *m, struct ManagedArena *s)
+{
+	alis_arena_destroy(&(s->ma));
+	s->in_use = 0;
+	s->gen = (s->gen + 1) & GEN_MASK;
+	m->arena_cnt--;
+}
+
+int alis_mgr_init(struct ArenaManager *m, struct MemorySystem *msys,
+                  size_t size_hint, size_t max_cont_rows,
+                  const struct ArenaOptions *opts, size_t keep_arenas)
+{
+	memset(m, 0, sizeof(*m));
+	m->msys = msys;
+	m->size_hint = size_hint;
+	m->max_cont_rows = max_cont_rows;
+	m->opts = (opts != NULL) ? *opts :
+	          ((struct ArenaOptions){.numa_node = ARENA_NODE_ANY});
+	m->keep_arenas = keep_arenas;
+	for (size_t i = 0; i < keep_arenas; i++) {
+		if (add_arena(m, size_hint) == MGR_MAX_ARENAS) {
+			alis_mgr_destroy(m);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int alis_mgr_destroy(struct ArenaManager *m)
+{
+	int r = 0;
+	for (size_t i = 0; i < MGR_MAX_ARENAS; i++) {
+		if (m->slots[i].in_use) {
+			r |= alis_arena_destroy(&(m->slots[i].ma));
+			m->slots[i].in_use = 0;
+		}
+	}
+	m->arena_cnt = 0;
+	return r;
+}
+
+mgr_ticket_t alis_mgr_reserve(struct ArenaManager *m, size_t size)
+{
+	/* Try arenas from the tightest fit up; full ones drop out as they fail */
+	int tried[MGR_MAX_ARENAS] = {0};
+	for (;;) {
+		size_t best = MGR_MAX_ARENAS;
+		size_t best_free = 0;
+		for (size_t i = 0; i < MGR_MAX_ARENAS; i++) {
+			if (!m->slots[i].in_use || tried[i]) {
+				continue;
+			}
+			struct Arena *a = &(m->slots[i].ma.arena);
+			size_t fp = free_pages(a);
+			if (fp == 0 || fp * a->page_size < size) {
+				continue;
+			}
+			if (best == MGR_MAX_ARENAS || fp < best_free) {
+				best = i;
+				best_free = fp;
+			}
+		}
+		if (best == MGR_MAX_ARENAS) {
+			break;
+		}
+		tried[best] = 1;
+		ticketid_t t = alis_arena_reserve(&(m->slots[best].ma.arena), size);
+		if (t) {
+			m->slots[best].live_tickets++;
+			return mkticket(m, best, t);
+		}
+	}
+
+	if (size == 0) {
+		return 0;
+	}
+	size_t slot = add_arena(m, (size > m->size_hint) ? size : m->size_hint);
+	if (slot == MGR_MAX_ARENAS) {
+		return 0;
+	}
+	ticketid_t t = alis_arena_reserve(&(m->slots[slot].ma.arena), size);
+	if (t == 0) {
+		drop_arena(m, &(m->slots[slot]));
+		return 0;
+	}
+	m->slots[slot].live_tickets++;
+	return mkticket(m, slot, t);
+}
+
+void alis_mgr_release(struct ArenaManager *m, mgr_ticket_t ticket)
+{
+	struct ManagedArena *s = lookup(m, ticket);
+	if (s == NULL) {
+		return;
+	}
+	/* Releasing a ticket twice must not count it out twice */
+	if (alis_arena_release(&(s->ma.arena), TICKET_ID(ticket)) == 0) {
+		return;
+	}
+	s->live_tickets--;
+	if (s->live_tickets == 0 && m->arena_cnt > m->keep_arenas) {
+		drop_arena(m, s);
+	}
+}
+
+size_t alis_mgr_get_data(struct ArenaManager *m, mgr_ticket_t ticket,
+                         off_t *offsets, size_t max_chunks)
+{
+	struct ManagedArena *s = lookup(m, ticket);
+	return s ? alis_arena_get_data(&(s->ma.arena), TICKET_ID(ticket),
+	                               offsets, max_chunks) : 0;
+}
+
+size_t alis_mgr_get_guard(struct ArenaManager *m, mgr_ticket_t ticket,
+                          off_t *offsets, size_t max_chunks)
+{
+	struct ManagedArena *s = lookup(m, ticket);
+	return s ? alis_arena_get_guard(&(s->ma.arena), TICKET_ID(ticket),
+	                                offsets, max_chunks) : 0;
+}
+
+size_t alis_mgr_get_data_physaddr(struct ArenaManager *m, mgr_ticket_t ticket,
+                                  physaddr_t *addrs, size_t max_chunks)
+{
+	struct ManagedArena *s = lookup(m, ticket);
+	return s ? alis_arena_get_data_physaddr(&(s->ma.arena), TICKET_ID(ticket),
+	                                        addrs, max_chunks) : 0;
+}
+
+size_t alis_mgr_get_guard_physaddr(struct ArenaManager *m, mgr_ticket_t ticket,
+                                   physaddr_t *addrs, size_t max_chunks)
+{
+	struct ManagedArena *s = lookup(m, ticket);
+	return s ? alis_arena_get_guard_physaddr(&(s->ma.arena), TICKET_ID(ticket),
+	                                         addrs, max_chunks) : 0;
+}
+
+struct Arena *alis_mgr_arena(struct ArenaManager *m, mgr_ticket_t ticket)
+{
+	struct ManagedArena *s = lookup(m, ticket);
+	return s ? &(s->ma.arena) : NULL;
+}
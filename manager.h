@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_MANAGER_H
+#define ALIS_MANAGER_H 1
+
+#include "arena.h"
+#include "arena_mgmt.h"
+
+#include <ramses/msys.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Tickets handed out by an ArenaManager carry the arena slot and the slot's
+ * generation next to the arena-local ticket id:
+ *   [63:24] generation  [23:16] slot  [15:0] ticketid_t
+ * so tickets of an arena that was released never match its replacement. The
+ * generation only wraps after 2^40 arenas in one slot.
+ */
+typedef uint64_t mgr_ticket_t;
+#define MGR_MAX_ARENAS 256
+
+struct ManagedArena {
+	struct MasterArena ma;
+	size_t live_tickets;
+	uint64_t gen; /* Kept below 2^40 */
+	int in_use;
+};
+
+struct ArenaManager {
+	struct MemorySystem *msys;
+	size_t size_hint;
+	size_t max_cont_rows;
+	struct ArenaOptions opts;
+	size_t keep_arenas; /* Empty arenas are only released above this count */
+
+	struct ManagedArena slots[MGR_MAX_ARENAS];
+	size_t arena_cnt;
+};
+
+/*
+ * Set up a manager that creates arenas of `size_hint' bytes (or larger for
+ * requests that need it) on demand. `opts' may be NULL.
+ * Returns 0 on success, 1 on failure.
+ */
+int alis_mgr_init(struct ArenaManager *m, struct MemorySystem *msys,
+                  size_t size_hint, size_t max_cont_rows,
+                  const struct ArenaOptions *opts, size_t keep_arenas);
+int alis_mgr_destroy(struct ArenaManager *m);
+
+/*
+ * Reserve `size' bytes from the arena whose free pages fit the request most
+ * tightly, creating a new arena if none can take it.
+ * Returns a non-zero ticket on success, 0 on failure.
+ */
+mgr_ticket_t alis_mgr_reserve(struct ArenaManager *m, size_t size);
+/*
+ * Release a reservation; arenas left empty are destroyed. Releasing a ticket
+ * that was released before has no effect.
+ */
+void alis_mgr_release(struct ArenaManager *m, mgr_ticket_t ticket);
+
+/* Same as the alis_arena_get_* functions, for manager tickets */
+size_t alis_mgr_get_data(struct ArenaManager *m, mgr_ticket_t ticket,
+                         off_t *offsets, size_t max_chunks);
+size_t alis_mgr_get_guard(struct ArenaManager *m, mgr_ticket_t ticket,
+                          off_t *offsets, size_t max_chunks);
+size_t alis_mgr_get_data_physaddr(struct ArenaManager *m, mgr_ticket_t ticket,
+                                  physaddr_t *addrs, size_t max_chunks);
+size_t alis_mgr_get_guard_physaddr(struct ArenaManager *m, mgr_ticket_t ticket,
+                                   physaddr_t *addrs, size_t max_chunks);
+
+/* The arena backing `ticket' (for its mfd and page_size), or NULL */
+struct Arena *alis_mgr_arena(struct ArenaManager *m, mgr_ticket_t ticket);
+
+#endif /* manager.h */
@@ -18,6 +18,7 @@
 #define _GNU_SOURCE
 
 #include "map.h"
+#include "stats_int.h"
 
 #include <stdint.h>
 #include <assert.h>
@@ -37,7 +38,7 @@ static int sys_munmap(void *addr, size_t len)
 	return (int)syscall(SYS_munmap, addr, len);
 }
 
-static void *mapalign(void *addr, size_t sz, size_t align)
+void *alis_map_reserve(void *addr, size_t sz, size_t align)
 {
 	size_t reqsz = align ? sz + align : sz;
 	void *buf = sys_mmap(addr, reqsz, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
@@ -53,30 +54,55 @@ static void *mapalign(void *addr, size_t sz, size_t align)
 	return buf;
 }
 
+int alis_map_fixed(void *addr, int mfd, off_t *offsets,
+                   size_t chunk_count, size_t chunk_size)
+{
+	uintptr_t cur = (uintptr_t)addr;
+	size_t i = 0;
+	while (i < chunk_count) {
+		/* Chunks that are also contiguous in the mfd go in one call */
+		size_t run = 1;
+		while (i + run < chunk_count &&
+		       offsets[i + run] == offsets[i] + (off_t)(run * chunk_size))
+		{
+			run++;
+		}
+		void *r = sys_mmap((void *)cur, run * chunk_size,
+		                   PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED,
+		                   mfd, offsets[i]);
+		if (r == MAP_FAILED) {
+			return 1;
+		}
+		cur += run * chunk_size;
+		i += run;
+	}
+	return 0;
+}
+
 void *alis_map(void *addr, size_t align, int mfd, off_t *offsets,
                size_t chunk_count, size_t chunk_size)
 {
+	uint64_t t0 = stats_begin();
 	size_t sz = chunk_count * chunk_size;
-	void *m = mapalign(addr, sz, align);
-	if (m != MAP_FAILED) {
-		uintptr_t cur = (uintptr_t)m;
-		for (size_t i = 0; i < chunk_count; i++) {
-			cur = (uintptr_t)sys_mmap((void *)cur, chunk_size,
-			                          PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED,
-			                          mfd, offsets[i]);
-			if ((void *)cur == MAP_FAILED) {
-				(void) sys_munmap(m, sz);
-				m = MAP_FAILED;
-				break;
-			} else {
-				cur += chunk_size;
-			}
-		}
+	/* Huge page chunks can only be mapped at addresses aligned to their size */
+	if (chunk_size > (size_t)sysconf(_SC_PAGESIZE) &&
+	    (align < chunk_size || (align % chunk_size) != 0))
+	{
+		align = chunk_size;
+	}
+	void *m = alis_map_reserve(addr, sz, align);
+	if (m != MAP_FAILED && alis_map_fixed(m, mfd, offsets, chunk_count, chunk_size)) {
+		(void) sys_munmap(m, sz);
+		m = MAP_FAILED;
 	}
+	stats_end(ALIS_OP_MAP, t0, m == MAP_FAILED);
 	return m;
 }
 
 int alis_unmap(void *addr, size_t len)
 {
-	return sys_munmap(addr, len);
+	uint64_t t0 = stats_begin();
+	int r = sys_munmap(addr, len);
+	stats_end(ALIS_OP_UNMAP, t0, r != 0);
+	return r;
 }
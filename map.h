@@ -11,8 +11,16 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 
+/* Reserve `sz' bytes of PROT_NONE address space aligned to `align' (or 0) */
+void *alis_map_reserve(void *addr, size_t sz, size_t align);
 void *alis_map(void *addr, size_t align, int mfd, off_t *offsets,
                size_t chunk_count, size_t chunk_size);
 int alis_unmap(void *addr, size_t len);
+/*
+ * Map `chunk_count' chunks over the existing reservation at `addr' (MAP_FIXED).
+ * Returns 0 on success, 1 on failure; the range is left partially mapped.
+ */
+int alis_map_fixed(void *addr, int mfd, off_t *offsets,
+                   size_t chunk_count, size_t chunk_size);
 
 #endif /* map.h */
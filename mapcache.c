@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2017-2018 Vrije Universiteit Amsterdam
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE
+
+#include "mapcache.h"
+#include "map.h"
+#include "ceildiv.h"
+#include "stats_int.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#define RESERVE_FLAGS	(MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE)
+
+int alis_mapcache_init(struct MapCache *mc, size_t window_len, size_t align,
+                       size_t nwindows)
+{
+	memset(mc, 0, sizeof(*mc));
+	if (align) {
+		window_len = ceildiv(window_len, align) * align;
+	}
+	mc->align = align;
+	mc->window_len = window_len;
+	mc->pool_len = window_len * nwindows;
+	if (nwindows == 0) {
+		return 0;
+	}
+
+	/* Align the whole pool once instead of every mapping */
+	size_t reqsz = mc->pool_len + align;
+	char *p = mmap(NULL, reqsz, PROT_NONE, RESERVE_FLAGS, -1, 0);
+	if (p == MAP_FAILED) {
+		return 1;
+	}
+	size_t left = align ? (align - ((uintptr_t)p % align)) % align : 0;
+	if (left) {
+		munmap(p, left);
+	}
+	if (reqsz - left > mc->pool_len) {
+		munmap(p + left + mc->pool_len, reqsz - left - mc->pool_len);
+	}
+	mc->pool = p + left;
+
+	mc->free_windows = malloc(nwindows * sizeof(*(mc->free_windows)));
+	if (mc->free_windows == NULL) {
+		munmap(mc->pool, mc->pool_len);
+		return 1;
+	}
+	for (size_t i = nwindows; i --> 0;) {
+		mc->free_windows[mc->free_cnt++] = (char *)mc->pool + i * window_len;
+	}
+	return 0;
+}
+
+/* Whether window `w' was given up by put_window */
+static int lost_window(const struct MapCache *mc, const void *w)
+{
+	const size_t nwindows = mc->pool_len / mc->window_len;
+	for (size_t i = nwindows - mc->lost_cnt; i < nwindows; i++) {
+		if (mc->free_windows[i] == w) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void alis_mapcache_destroy(struct MapCache *mc)
+{
+	for (size_t i = 0; i < mc->map_cnt; i++) {
+		if (!mc->maps[i].windowed) {
+			alis_unmap(mc->maps[i].addr, mc->maps[i].len);
+		}
+	}
+	if (mc->pool != NULL && mc->lost_cnt == 0) {
+		munmap(mc->pool, mc->pool_len);
+	} else if (mc->pool != NULL) {
+		/* Lost windows are unmapped already, and may hold someone else's mapping */
+		char *end = (char *)mc->pool + mc->pool_len;
+		for (char *w = mc->pool; w < end; w += mc->window_len) {
+			if (!lost_window(mc, w)) {
+				munmap(w, mc->window_len);
+			}
+		}
+	}
+	free(mc->free_windows);
+	free(mc->maps);
+	memset(mc, 0, sizeof(*mc));
+}
+
+static struct CachedMapping *find(struct MapCache *mc, struct Arena *a,
+                                  ticketid_t t)
+{
+	for (size_t i = 0; i < mc->map_cnt; i++) {
+		if (mc->maps[i].ticket == t && mc->maps[i].arena == a) {
+			return &(mc->maps[i]);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Put window `w' back in its reserved state and return it to the pool. If it
+ * cannot be reserved again it is unmapped instead, so none of the pages it
+ * held stay mapped, and kept out of the pool.
+ */
+static void put_window(struct MapCache *mc, void *w)
+{
+	if (mmap(w, mc->window_len, PROT_NONE, RESERVE_FLAGS|MAP_FIXED, -1, 0) != MAP_FAILED) {
+		mc->free_windows[mc->free_cnt++] = w;
+	} else if (munmap(w, mc->window_len) == 0) {
+		const size_t nwindows = mc->pool_len / mc->window_len;
+		mc->free_windows[nwindows - ++(mc->lost_cnt)] = w;
+	}
+}
+
+/* Sets `*counted' if the mapping went through alis_map, which records it in the stats */
+static void *map_new(struct MapCache *mc, struct Arena *a, ticketid_t t,
+                     size_t *len, int *windowed, int *counted)
+{
+	size_t cnt = alis_arena_get_data(a, t, NULL, 0);
+	if (cnt == 0) {
+		return MAP_FAILED;
+	}
+	off_t *offs = malloc(cnt * sizeof(*offs));
+	if (offs == NULL) {
+		return MAP_FAILED;
+	}
+	alis_arena_get_data(a, t, offs, cnt);
+	*len = cnt * a->page_size;
+
+	void *m;
+	if (*len <= mc->window_len && mc->free_cnt > 0) {
+		m = mc->free_windows[--(mc->free_cnt)];
+		*windowed = 1;
+		if (alis_map_fixed(m, a->mfd, offs, cnt, a->page_size)) {
+			put_window(mc, m);
+			m = MAP_FAILED;
+		}
+	} else {
+		m = alis_map(NULL, mc->align, a->mfd, offs, cnt, a->page_size);
+		*windowed = 0;
+		*counted = 1;
+	}
+	free(offs);
+	return m;
+}
+
+static void *cached_map(struct MapCache *mc, struct Arena *a, ticketid_t t,
+                        size_t *len, int *counted)
+{
+	struct CachedMapping *cm = find(mc, a, t);
+	if (cm == NULL) {
+		if (mc->map_cnt == mc->map_cap) {
+			size_t cap = mc->map_cap ? 2 * mc->map_cap : 16;
+			struct CachedMapping *maps = realloc(mc->maps, cap * sizeof(*maps));
+			if (maps == NULL) {
+				return MAP_FAILED;
+			}
+			mc->maps = maps;
+			mc->map_cap = cap;
+		}
+		struct CachedMapping n = {.arena = a, .ticket = t, .refs = 0};
+		n.addr = map_new(mc, a, t, &(n.len), &(n.windowed), counted);
+		if (n.addr == MAP_FAILED) {
+			return MAP_FAILED;
+		}
+		cm = &(mc->maps[mc->map_cnt++]);
+		*cm = n;
+	}
+	cm->refs++;
+	if (len != NULL) {
+		*len = cm->len;
+	}
+	return cm->addr;
+}
+
+void *alis_mapcache_map(struct MapCache *mc, struct Arena *a, ticketid_t t,
+                        size_t *len)
+{
+	uint64_t t0 = stats_begin();
+	int counted = 0;
+	void *m = cached_map(mc, a, t, len, &counted);
+	if (!counted) {
+		stats_end(ALIS_OP_MAP, t0, m == MAP_FAILED);
+	}
+	return m;
+}
+
+void alis_mapcache_unmap(struct MapCache *mc, void *addr)
+{
+	for (size_t i = 0; i < mc->map_cnt; i++) {
+		if (mc->maps[i].addr == addr) {
+			if (mc->maps[i].refs) {
+				mc->maps[i].refs--;
+			}
+			return;
+		}
+	}
+}
+
+int alis_mapcache_evict(struct MapCache *mc, struct Arena *a, ticketid_t t)
+{
+	struct CachedMapping *cm = find(mc, a, t);
+	if (cm == NULL) {
+		return 1;
+	}
+	if (cm->windowed) {
+		put_window(mc, cm->addr);
+	} else {
+		alis_unmap(cm->addr, cm->len);
+	}
+	*cm = mc->maps[--(mc->map_cnt)];
+	return 0;
+}
+
+void alis_mapcache_release(struct MapCache *mc, struct Arena *a, ticketid_t t)
+{
+	alis_mapcache_evict(mc, a, t);
+	alis_arena_release(a, t);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_MAPCACHE_H
+#define ALIS_MAPCACHE_H 1
+
+#include "arena.h"
+
+#include <stddef.h>
+
+struct CachedMapping {
+	struct Arena *arena;
+	ticketid_t ticket;
+	void *addr;
+	size_t len;
+	size_t refs;
+	int windowed; /* Lives in a pool window rather than its own mapping */
+};
+
+/*
+ * Keeps one persistent mapping per ticket, placed in windows carved out of a
+ * single aligned PROT_NONE reservation.
+ * Mappings outlive alis_mapcache_unmap and are only torn down by
+ * alis_mapcache_evict; a ticket must be evicted before it is released, or its
+ * old pages stay mapped after the arena hands them to another ticket.
+ */
+struct MapCache {
+	size_t align;
+	size_t window_len;
+	void *pool;
+	size_t pool_len;
+	void **free_windows;
+	size_t free_cnt;
+	/* Windows that could not be reserved again; kept at the end of free_windows */
+	size_t lost_cnt;
+
+	struct CachedMapping *maps;
+	size_t map_cnt;
+	size_t map_cap;
+};
+
+/*
+ * Reserve `nwindows' windows of `window_len' bytes, each aligned to `align'
+ * (which may be 0). Tickets that do not fit a window get their own mapping.
+ * Returns 0 on success, 1 on failure.
+ */
+int alis_mapcache_init(struct MapCache *mc, size_t window_len, size_t align,
+                       size_t nwindows);
+/* Unmap everything, including mappings that are still referenced */
+void alis_mapcache_destroy(struct MapCache *mc);
+
+/*
+ * Map the data pages of `ticket', or return its existing mapping.
+ * Stores the mapping length in `*len' if non-NULL.
+ * Returns MAP_FAILED on failure.
+ */
+void *alis_mapcache_map(struct MapCache *mc, struct Arena *arena,
+                        ticketid_t ticket, size_t *len);
+/* Drop a reference taken by alis_mapcache_map; the mapping stays cached */
+void alis_mapcache_unmap(struct MapCache *mc, void *addr);
+/*
+ * Tear down the mapping of `ticket' regardless of references and return its
+ * window to the pool. Returns 0 if the ticket had a mapping, 1 otherwise.
+ */
+int alis_mapcache_evict(struct MapCache *mc, struct Arena *arena,
+                        ticketid_t ticket);
+/* Evict `ticket' and release it from `arena' */
+void alis_mapcache_release(struct MapCache *mc, struct Arena *arena,
+                           ticketid_t ticket);
+
+#endif /* mapcache.h */
@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef NSTIME_H
+#define NSTIME_H 1
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t nstime(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#endif /* nstime.h */
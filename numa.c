@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2017-2018 Vrije Universiteit Amsterdam
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE
+
+#include "numa.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define NODE_SYSFS	"/sys/devices/system/node"
+
+/* Parses a sysfs node list such as "0-1,4"; returns the node count */
+static size_t read_nodelist(const char *path, int **nodes)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return 0;
+	}
+	size_t cnt = 0;
+	size_t cap = 0;
+	int *ns = NULL;
+	int a, b;
+	char sep;
+	while (fscanf(f, "%d", &a) == 1) {
+		b = a;
+		if (fscanf(f, "%c", &sep) == 1 && sep == '-') {
+			if (fscanf(f, "%d", &b) != 1) {
+				break;
+			}
+			if (fscanf(f, "%c", &sep) != 1) {
+				sep = '\n';
+			}
+		}
+		for (int n = a; n <= b; n++) {
+			if (cnt == cap) {
+				cap = cap ? 2 * cap : 8;
+				int *nns = realloc(ns, cap * sizeof(*ns));
+				if (nns == NULL) {
+					free(ns);
+					fclose(f);
+					return 0;
+				}
+				ns = nns;
+			}
+			ns[cnt++] = n;
+		}
+		if (sep != ',') {
+			break;
+		}
+	}
+	fclose(f);
+	*nodes = ns;
+	return cnt;
+}
+
+/* Returns na->node_cnt if `node' has no arena */
+static size_t node_index(struct NumaArenas *na, int node)
+{
+	size_t i;
+	for (i = 0; i < na->node_cnt && na->nodes[i] != node; i++);
+	return i;
+}
+
+/* Fill `dist' with the SLIT distances from `node' to each arena's node */
+static void read_distance_row(const struct NumaArenas *na, int node,
+                              const int *online, size_t ocnt, int *dist)
+{
+	/* Distance files list one column per online node, in node order */
+	int row[ocnt ? ocnt : 1];
+	size_t rcnt = 0;
+	char path[64];
+	snprintf(path, sizeof(path), NODE_SYSFS "/node%d/distance", node);
+	FILE *f = fopen(path, "r");
+	if (f != NULL) {
+		while (rcnt < ocnt && fscanf(f, "%d", &row[rcnt]) == 1) {
+			rcnt++;
+		}
+		fclose(f);
+	}
+	for (size_t j = 0; j < na->node_cnt; j++) {
+		int d = (node == na->nodes[j]) ? 10 : 20;
+		for (size_t k = 0; k < rcnt; k++) {
+			if (online[k] == na->nodes[j]) {
+				d = row[k];
+			}
+		}
+		dist[j] = d;
+	}
+}
+
+/*
+ * Read the distances between the arenas' nodes, and from every online node
+ * without an arena to them. Returns 0 on success, 1 on allocation failure.
+ */
+static int read_distances(struct NumaArenas *na)
+{
+	int *online = NULL;
+	size_t ocnt = read_nodelist(NODE_SYSFS "/online", &online);
+	for (size_t i = 0; i < na->node_cnt; i++) {
+		read_distance_row(na, na->nodes[i], online, ocnt, &(na->dist[i * na->node_cnt]));
+	}
+
+	size_t mcnt = 0;
+	for (size_t k = 0; k < ocnt; k++) {
+		mcnt += (node_index(na, online[k]) == na->node_cnt);
+	}
+	if (mcnt > 0) {
+		na->memless_nodes = malloc(mcnt * sizeof(*na->memless_nodes));
+		na->memless_dist = malloc(mcnt * na->node_cnt * sizeof(*na->memless_dist));
+		if (na->memless_nodes == NULL || na->memless_dist == NULL) {
+			free(online);
+			return 1;
+		}
+	}
+	for (size_t k = 0; k < ocnt; k++) {
+		if (node_index(na, online[k]) == na->node_cnt) {
+			const size_t m = na->memless_cnt++;
+			na->memless_nodes[m] = online[k];
+			read_distance_row(na, online[k], online, ocnt,
+			                  &(na->memless_dist[m * na->node_cnt]));
+		}
+	}
+	free(online);
+	return 0;
+}
+
+static int current_node(void)
+{
+	unsigned cpu, node;
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+		return -1;
+	}
+	return (int)node;
+}
+
+static size_t free_pages(struct Arena *a)
+{
+	return a->rb_top ? a->rb_pgtotals[a->rb_top - 1] : 0;
+}
+
+int alis_numa_create(struct MemorySystem *msys,
+                     size_t size_hint, size_t max_cont_rows,
+                     enum NumaFallback policy, struct NumaArenas *na)
+{
+	int *nodes = NULL;
+	size_t cnt = read_nodelist(NODE_SYSFS "/has_memory", &nodes);
+	if (cnt == 0) {
+		cnt = read_nodelist(NODE_SYSFS "/online", &nodes);
+	}
+	if (cnt == 0) {
+		return 1;
+	}
+	na->node_cnt = cnt;
+	na->nodes = nodes;
+	na->policy = policy;
+	na->memless_cnt = 0;
+	na->memless_nodes = NULL;
+	na->memless_dist = NULL;
+	na->dist = malloc(cnt * cnt * sizeof(*na->dist));
+	na->arenas = calloc(cnt, sizeof(*na->arenas));
+	if (na->dist == NULL || na->arenas == NULL) {
+		goto err_free;
+	}
+	if (read_distances(na) != 0) {
+		goto err_free;
+	}
+
+	size_t i;
+	for (i = 0; i < cnt; i++) {
+		struct ArenaOptions opts = {.numa_node = ARENA_NODE(nodes[i])};
+		if (alis_arena_create_opts(msys, size_hint, max_cont_rows, &opts,
+		                           &(na->arenas[i]), NULL))
+		{
+			goto err_destroy;
+		}
+	}
+	return 0;
+
+err_destroy:
+	while (i --> 0) {
+		alis_arena_destroy(&(na->arenas[i]));
+	}
+err_free:
+	free(na->memless_dist);
+	free(na->memless_nodes);
+	free(na->arenas);
+	free(na->dist);
+	free(na->nodes);
+	return 1;
+}
+
+int alis_numa_destroy(struct NumaArenas *na)
+{
+	int r = 0;
+	for (size_t i = 0; i < na->node_cnt; i++) {
+		r |= alis_arena_destroy(&(na->arenas[i]));
+	}
+	free(na->memless_dist);
+	free(na->memless_nodes);
+	free(na->arenas);
+	free(na->dist);
+	free(na->nodes);
+	return r;
+}
+
+struct NumaTicket alis_numa_reserve_node(struct NumaArenas *na, size_t size,
+                                         int node)
+{
+	const size_t cnt = na->node_cnt;
+	const size_t local = node_index(na, node);
+	const int *dist;
+	ticketid_t t;
+	if (local < cnt) {
+		t = alis_arena_reserve(&(na->arenas[local].arena), size);
+		if (t || na->policy == NUMA_FALLBACK_NONE) {
+			return ((struct NumaTicket){local, t});
+		}
+		dist = &(na->dist[local * cnt]);
+	} else {
+		/* A node without memory falls back as if its own arena were full */
+		size_t m;
+		for (m = 0; m < na->memless_cnt && na->memless_nodes[m] != node; m++);
+		if (m == na->memless_cnt || na->policy == NUMA_FALLBACK_NONE) {
+			errno = ENODEV;
+			return ((struct NumaTicket){local, 0});
+		}
+		dist = &(na->memless_dist[m * cnt]);
+	}
+
+	/* Visit remote nodes best-first according to policy */
+	size_t order[cnt];
+	size_t key[cnt];
+	size_t n = 0;
+	for (size_t i = 0; i < cnt; i++) {
+		if (i == local) {
+			continue;
+		}
+		size_t k = (na->policy == NUMA_FALLBACK_NEAREST) ?
+		           (size_t)dist[i] :
+		           ~free_pages(&(na->arenas[i].arena));
+		size_t j = n++;
+		for (; j > 0 && key[j-1] > k; j--) {
+			order[j] = order[j-1];
+			key[j] = key[j-1];
+		}
+		order[j] = i;
+		key[j] = k;
+	}
+	for (size_t j = 0; j < n; j++) {
+		t = alis_arena_reserve(&(na->arenas[order[j]].arena), size);
+		if (t) {
+			return ((struct NumaTicket){order[j], t});
+		}
+	}
+	return ((struct NumaTicket){local, 0});
+}
+
+struct NumaTicket alis_numa_reserve(struct NumaArenas *na, size_t size)
+{
+	return alis_numa_reserve_node(na, size, current_node());
+}
+
+void alis_numa_release(struct NumaArenas *na, struct NumaTicket nt)
+{
+	if (nt.ticket && nt.node_idx < na->node_cnt) {
+		alis_arena_release(&(na->arenas[nt.node_idx].arena), nt.ticket);
+	}
+}
+
+struct Arena *alis_numa_arena(struct NumaArenas *na, struct NumaTicket nt)
+{
+	return (nt.node_idx < na->node_cnt) ? &(na->arenas[nt.node_idx].arena) : NULL;
+}
+
+size_t alis_numa_capacity(struct NumaArenas *na, struct NumaCapacity *caps,
+                          size_t max)
+{
+	for (size_t i = 0; i < na->node_cnt && i < max; i++) {
+		struct Arena *a = &(na->arenas[i].arena);
+		caps[i] = ((struct NumaCapacity){
+			.node = na->nodes[i],
+			.free_pages = free_pages(a),
+			.data_pages = a->data_pgents_size
+		});
+	}
+	return na->node_cnt;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2017-2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_NUMA_H
+#define ALIS_NUMA_H 1
+
+#include "arena.h"
+#include "arena_mgmt.h"
+
+#include <ramses/msys.h>
+
+#include <stddef.h>
+
+enum NumaFallback {
+	NUMA_FALLBACK_NONE,      /* Only ever reserve on the caller's node */
+	NUMA_FALLBACK_NEAREST,   /* Try remote nodes in order of distance */
+	NUMA_FALLBACK_MOST_FREE  /* Try remote nodes by decreasing free pages */
+};
+
+struct NumaArenas {
+	size_t node_cnt;
+	int *nodes;
+	int *dist; /* node_cnt x node_cnt SLIT distances, by index */
+	/* Online nodes without an arena, e.g. CPU-only ones */
+	size_t memless_cnt;
+	int *memless_nodes;
+	int *memless_dist; /* memless_cnt x node_cnt distances to the arenas' nodes */
+	struct MasterArena *arenas;
+	enum NumaFallback policy;
+};
+
+struct NumaTicket {
+	size_t node_idx;
+	ticketid_t ticket;
+};
+
+struct NumaCapacity {
+	int node;
+	size_t free_pages;
+	size_t data_pages;
+};
+
+/*
+ * Create one arena on each online memory node, with its backing memory bound
+ * to that node.
+ *
+ * Returns 0 on success, 1 on failure.
+ */
+int alis_numa_create(struct MemorySystem *msys,
+                     size_t size_hint, size_t max_cont_rows,
+                     enum NumaFallback policy, struct NumaArenas *na);
+int alis_numa_destroy(struct NumaArenas *na);
+
+/*
+ * Reserve `size' bytes, preferring the node of the CPU the caller is running
+ * on and falling back to remote nodes according to `na->policy'.
+ *
+ * A preferred node without memory of its own falls back to the other nodes
+ * straight away, nearest first by its SLIT distances for NUMA_FALLBACK_NEAREST.
+ *
+ * On failure, returns a NumaTicket with a zero ticket. If the preferred node
+ * has no arena and either no fallback is allowed or it is not an online node
+ * (e.g. getcpu failed), fails with errno set to ENODEV; pick a node with
+ * alis_numa_reserve_node then.
+ */
+struct NumaTicket alis_numa_reserve(struct NumaArenas *na, size_t size);
+/* Like alis_numa_reserve, with an explicit preferred node */
+struct NumaTicket alis_numa_reserve_node(struct NumaArenas *na, size_t size,
+                                         int node);
+void alis_numa_release(struct NumaArenas *na, struct NumaTicket nt);
+/* The arena holding `nt', e.g. for alis_arena_get_data */
+struct Arena *alis_numa_arena(struct NumaArenas *na, struct NumaTicket nt);
+
+/*
+ * Store up to `max' per-node capacity records in `*caps'.
+ * Returns the number of nodes.
+ */
+size_t alis_numa_capacity(struct NumaArenas *na, struct NumaCapacity *caps,
+                          size_t max);
+
+#endif /* numa.h */
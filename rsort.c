@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "rsort.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define RSORT_SMALL 32 /* Insertion sort below this many elements */
+#define RSORT_BITS 8
+#define RSORT_BUCKETS (1 << RSORT_BITS)
+#define DIGIT(k, d) (((k) >> ((d) * RSORT_BITS)) & (RSORT_BUCKETS - 1))
+
+void rsort_pgents(struct ArenaPageEntry *a, size_t n, struct ArenaPageEntry *tmp)
+{
+	size_t i;
+	for (i = 1; i < n && a[i - 1].pfn <= a[i].pfn; i++);
+	if (i >= n) {
+		return;
+	}
+	if (n < RSORT_SMALL) {
+		for (; i < n; i++) {
+			struct ArenaPageEntry e = a[i];
+			size_t j = i;
+			for (; j > 0 && a[j - 1].pfn > e.pfn; j--) {
+				a[j] = a[j - 1];
+			}
+			a[j] = e;
+		}
+		return;
+	}
+
+	enum { DIGITS = (sizeof(pgnum_t) * 8) / RSORT_BITS };
+	size_t cnt[DIGITS][RSORT_BUCKETS];
+	memset(cnt, 0, sizeof(cnt));
+	for (i = 0; i < n; i++) {
+		for (int d = 0; d < DIGITS; d++) {
+			cnt[d][DIGIT(a[i].pfn, d)]++;
+		}
+	}
+	struct ArenaPageEntry *src = a;
+	struct ArenaPageEntry *dst = tmp;
+	for (int d = 0; d < DIGITS; d++) {
+		/* Nothing to do if every key has the same digit */
+		if (cnt[d][DIGIT(a[0].pfn, d)] == n) {
+			continue;
+		}
+		size_t off = 0;
+		for (size_t b = 0; b < RSORT_BUCKETS; b++) {
+			size_t c = cnt[d][b];
+			cnt[d][b] = off;
+			off += c;
+		}
+		for (i = 0; i < n; i++) {
+			dst[cnt[d][DIGIT(src[i].pfn, d)]++] = src[i];
+		}
+		struct ArenaPageEntry *t = src;
+		src = dst;
+		dst = t;
+	}
+	if (src != a) {
+		memcpy(a, src, n * sizeof(*a));
+	}
+}
+
+void rsort_rowblocks(struct RowBlock *a, size_t n, struct RowBlock *tmp)
+{
+	size_t i;
+	for (i = 1; i < n && a[i - 1].data_pgcnt <= a[i].data_pgcnt; i++);
+	if (i >= n) {
+		return;
+	}
+	if (n < RSORT_SMALL) {
+		for (; i < n; i++) {
+			struct RowBlock e = a[i];
+			size_t j = i;
+			for (; j > 0 && a[j - 1].data_pgcnt > e.data_pgcnt; j--) {
+				a[j] = a[j - 1];
+			}
+			a[j] = e;
+		}
+		return;
+	}
+
+	/* Row blocks are small, so most high digits are skipped */
+	enum { DIGITS = (sizeof(size_t) * 8) / RSORT_BITS };
+	size_t cnt[DIGITS][RSORT_BUCKETS];
+	memset(cnt, 0, sizeof(cnt));
+	for (i = 0; i < n; i++) {
+		for (int d = 0; d < DIGITS; d++) {
+			cnt[d][DIGIT(a[i].data_pgcnt, d)]++;
+		}
+	}
+	struct RowBlock *src = a;
+	struct RowBlock *dst = tmp;
+	for (int d = 0; d < DIGITS; d++) {
+		if (cnt[d][DIGIT(a[0].data_pgcnt, d)] == n) {
+			continue;
+		}
+		size_t off = 0;
+		for (size_t b = 0; b < RSORT_BUCKETS; b++) {
+			size_t c = cnt[d][b];
+			cnt[d][b] = off;
+			off += c;
+		}
+		for (i = 0; i < n; i++) {
+			dst[cnt[d][DIGIT(src[i].data_pgcnt, d)]++] = src[i];
+		}
+		struct RowBlock *t = src;
+		src = dst;
+		dst = t;
+	}
+	if (src != a) {
+		memcpy(a, src, n * sizeof(*a));
+	}
+}
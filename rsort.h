@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_RSORT_H
+#define ALIS_RSORT_H 1
+
+#include "arena.h"
+
+#include <stddef.h>
+
+/*
+ * LSD radix sorts used while building arenas. Both are stable, return
+ * immediately on input that is already sorted and use insertion sort for
+ * short inputs. `tmp' must have room for `n' elements.
+ */
+
+/* Sort by pfn */
+void rsort_pgents(struct ArenaPageEntry *a, size_t n, struct ArenaPageEntry *tmp);
+/* Sort by data_pgcnt */
+void rsort_rowblocks(struct RowBlock *a, size_t n, struct RowBlock *tmp);
+
+#endif /* rsort.h */
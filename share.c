@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2017-2018 Vrije Universiteit Amsterdam
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE
+
+#include "share.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define SHARE_MAGIC	0x414c4953 /* "ALIS" */
+
+struct share_hdr {
+	uint32_t magic;
+	uint32_t _pad;
+	uint64_t page_size;
+	uint64_t chunk_count;
+};
+
+static int send_all(int sock, const void *buf, size_t len)
+{
+	const char *p = buf;
+	while (len) {
+		ssize_t r = send(sock, p, len, MSG_NOSIGNAL);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return 1;
+		}
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+static int recv_all(int sock, void *buf, size_t len)
+{
+	char *p = buf;
+	while (len) {
+		ssize_t r = recv(sock, p, len, MSG_WAITALL);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return 1;
+		} else if (r == 0) {
+			errno = ECONNRESET;
+			return 1;
+		}
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+int alis_ticket_export(int sock, struct Arena *a, ticketid_t ticket)
+{
+	size_t cnt = alis_arena_get_data(a, ticket, NULL, 0);
+	if (cnt == 0) {
+		errno = ENOENT;
+		return 1;
+	}
+	off_t *offs = malloc(cnt * sizeof(*offs));
+	if (offs == NULL) {
+		return 1;
+	}
+	alis_arena_get_data(a, ticket, offs, cnt);
+
+	struct share_hdr hdr = {
+		.magic = SHARE_MAGIC,
+		.page_size = a->page_size,
+		.chunk_count = cnt
+	};
+	struct iovec iov = {.iov_base = &hdr, .iov_len = sizeof(hdr)};
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} cbuf;
+	memset(&cbuf, 0, sizeof(cbuf));
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf.buf,
+		.msg_controllen = sizeof(cbuf.buf)
+	};
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm), &a->mfd, sizeof(int));
+
+	ssize_t r;
+	do {
+		r = sendmsg(sock, &msg, MSG_NOSIGNAL);
+	} while (r < 0 && errno == EINTR);
+	int ret = 1;
+	if (r >= 0) {
+		/* The fd went out with the first byte; finish the header plainly */
+		ret = send_all(sock, (char *)&hdr + r, sizeof(hdr) - r) ||
+		      send_all(sock, offs, cnt * sizeof(*offs));
+	}
+	free(offs);
+	return ret;
+}
+
+int alis_ticket_import(int sock, struct ImportedTicket *it)
+{
+	struct share_hdr hdr;
+	struct iovec iov = {.iov_base = &hdr, .iov_len = sizeof(hdr)};
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} cbuf;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf.buf,
+		.msg_controllen = sizeof(cbuf.buf)
+	};
+
+	ssize_t r;
+	do {
+		r = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (r < 0 && errno == EINTR);
+	if (r <= 0) {
+		if (r == 0) {
+			errno = ECONNRESET;
+		}
+		return 1;
+	}
+
+	/* The memfd comes alone; close any other fd that came along */
+	int mfd = -1;
+	for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+		if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+			continue;
+		}
+		const size_t fdcnt = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < fdcnt; i++) {
+			int fd;
+			memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+			if (fdcnt == 1 && mfd < 0) {
+				mfd = fd;
+			} else {
+				close(fd);
+			}
+		}
+	}
+	if (mfd < 0) {
+		errno = EBADMSG;
+		return 1;
+	}
+	if (recv_all(sock, (char *)&hdr + r, sizeof(hdr) - r)) {
+		goto err_close;
+	}
+	if (hdr.magic != SHARE_MAGIC || hdr.page_size == 0 || hdr.chunk_count == 0 ||
+	    hdr.chunk_count > SIZE_MAX / sizeof(off_t))
+	{
+		errno = EBADMSG;
+		goto err_close;
+	}
+
+	off_t *offs = malloc(hdr.chunk_count * sizeof(*offs));
+	if (offs == NULL) {
+		goto err_close;
+	}
+	if (recv_all(sock, offs, hdr.chunk_count * sizeof(*offs))) {
+		free(offs);
+		goto err_close;
+	}
+	it->mfd = mfd;
+	it->page_size = hdr.page_size;
+	it->chunk_count = hdr.chunk_count;
+	it->offsets = offs;
+	return 0;
+
+err_close:
+	close(mfd);
+	return 1;
+}
+
+void alis_ticket_import_free(struct ImportedTicket *it)
+{
+	free(it->offsets);
+	it->offsets = NULL;
+	it->chunk_count = 0;
+	if (it->mfd >= 0) {
+		close(it->mfd);
+		it->mfd = -1;
+	}
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2017-2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_SHARE_H
+#define ALIS_SHARE_H 1
+
+#include "arena.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct ImportedTicket {
+	int mfd;
+	size_t page_size;
+	size_t chunk_count;
+	off_t *offsets;
+};
+
+/*
+ * Send the data pages reserved by `ticket' over the UNIX domain socket `sock'.
+ * The arena mfd is passed along as SCM_RIGHTS, followed by the ticket's mfd
+ * offsets in physical address order.
+ * Note that the receiving process gains access to the whole backing file, so
+ * only export to peers trusted to map nothing but the offsets they are given.
+ *
+ * Returns 0 on success, 1 on failure (with errno set).
+ */
+int alis_ticket_export(int sock, struct Arena *arena, ticketid_t ticket);
+
+/*
+ * Receive a ticket exported with alis_ticket_export from `sock' into `*it'.
+ * The pages can then be mapped with
+ *   alis_map(addr, align, it->mfd, it->offsets, it->chunk_count, it->page_size)
+ *
+ * Returns 0 on success, 1 on failure (with errno set).
+ */
+int alis_ticket_import(int sock, struct ImportedTicket *it);
+/* Close the mfd and release the offsets of an imported ticket */
+void alis_ticket_import_free(struct ImportedTicket *it);
+
+#endif /* share.h */
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2017-2018 Vrije Universiteit Amsterdam
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "sizemodel.h"
+#include "ceildiv.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define SIZEMODEL_MAGIC	"alis-sizemodel-1"
+#define PRIOR_EDGE	0.5  /* Share of a range left after pass1, untrained */
+#define MIN_YIELD	0.01
+#define MIN_WEIGHT	0.25 /* EWMA weight once enough samples are in */
+#define HEADROOM	1.05
+#define BACKING_ALIGN	(2 * 1024 * 1024)
+
+void alis_sizemodel_init(struct ArenaSizeModel *m, struct MemorySystem *msys,
+                         size_t page_size, size_t max_cont_rows)
+{
+	const size_t rowlen = msys->mapping.props.col_cnt * msys->mapping.props.cell_size;
+	/* Each run of max_cont_rows rows costs at least one guard row */
+	const double guard_share = max_cont_rows ?
+	                           (double)max_cont_rows / (max_cont_rows + 1) : 1.0;
+	m->max_cont_rows = max_cont_rows;
+	m->row_pages = ceildiv(rowlen, page_size);
+	m->yield = PRIOR_EDGE * guard_share;
+	m->samples = 0;
+}
+
+size_t alis_sizemodel_predict(const struct ArenaSizeModel *m, size_t size,
+                              size_t page_size)
+{
+	const double y = (m->yield > MIN_YIELD) ? m->yield : MIN_YIELD;
+	const size_t pages = ceildiv(size, page_size) +
+	                     2 * (m->row_pages ? m->row_pages : 1);
+	size_t len = (size_t)((pages / y) * HEADROOM) * page_size;
+	return ceildiv(len, BACKING_ALIGN) * BACKING_ALIGN;
+}
+
+void alis_sizemodel_update(struct ArenaSizeModel *m, size_t pte_cnt,
+                           size_t data_pages)
+{
+	if (pte_cnt == 0) {
+		return;
+	}
+	const double y = (double)data_pages / pte_cnt;
+	double w = 1.0 / (m->samples + 1);
+	if (w < MIN_WEIGHT) {
+		w = MIN_WEIGHT;
+	}
+	/* The first real observation replaces the geometric prior */
+	m->yield = m->samples ? (1 - w) * m->yield + w * y : y;
+	m->samples++;
+}
+
+int alis_sizemodel_load(struct ArenaSizeModel *m, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return 1;
+	}
+	char magic[32];
+	struct ArenaSizeModel lm;
+	int n = fscanf(f, "%31s %zu %zu %lf %zu", magic, &lm.max_cont_rows,
+	               &lm.row_pages, &lm.yield, &lm.samples);
+	fclose(f);
+	if (n != 5 || strcmp(magic, SIZEMODEL_MAGIC) != 0 ||
+	    !(lm.yield > 0 && lm.yield <= 1))
+	{
+		return 1;
+	}
+	if (lm.max_cont_rows != m->max_cont_rows || lm.row_pages != m->row_pages) {
+		return 1;
+	}
+	*m = lm;
+	return 0;
+}
+
+int alis_sizemodel_save(const struct ArenaSizeModel *m, const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		return 1;
+	}
+	int r = fprintf(f, SIZEMODEL_MAGIC " %zu %zu %.6f %zu\n", m->max_cont_rows,
+	                m->row_pages, m->yield, m->samples) < 0;
+	r |= (fclose(f) != 0);
+	return r;
+}
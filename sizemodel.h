@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_SIZEMODEL_H
+#define ALIS_SIZEMODEL_H 1
+
+#include <ramses/msys.h>
+
+#include <stddef.h>
+
+/*
+ * Predicts how much backing memory an arena needs from the fraction of
+ * backing pages that end up as data pages ("yield").
+ * The initial estimate comes from the row geometry and max_cont_rows; every
+ * alis_arena_create iteration that uses the model refines it.
+ */
+struct ArenaSizeModel {
+	size_t max_cont_rows;
+	size_t row_pages;
+	double yield;
+	size_t samples;
+};
+
+void alis_sizemodel_init(struct ArenaSizeModel *m, struct MemorySystem *msys,
+                         size_t page_size, size_t max_cont_rows);
+/* Backing length expected to yield `size' bytes of data pages */
+size_t alis_sizemodel_predict(const struct ArenaSizeModel *m, size_t size,
+                              size_t page_size);
+/* Record that `pte_cnt' backing pages produced `data_pages' data pages */
+void alis_sizemodel_update(struct ArenaSizeModel *m, size_t pte_cnt,
+                           size_t data_pages);
+
+/*
+ * Load or save what the model has learned. A saved model only replaces `*m'
+ * on load if it was made for the same max_cont_rows and row size.
+ * Return 0 on success, 1 on failure.
+ */
+int alis_sizemodel_load(struct ArenaSizeModel *m, const char *path);
+int alis_sizemodel_save(const struct ArenaSizeModel *m, const char *path);
+
+#endif /* sizemodel.h */
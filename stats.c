@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2017-2018 Vrije Universiteit Amsterdam
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE
+
+#include "stats.h"
+#include "stats_int.h"
+#include "nstime.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+struct ThreadStats {
+	struct AlisStats st;
+	struct ThreadStats *next;
+	int in_use;
+};
+
+static int stats_timing_on;
+static __thread struct ThreadStats *tls_stats;
+static struct ThreadStats *all_stats;
+static pthread_mutex_t all_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t exit_key;
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+
+/* Blocks outlive their thread so its counts stay in the totals */
+static void thread_exit(void *p)
+{
+	pthread_mutex_lock(&all_lock);
+	((struct ThreadStats *)p)->in_use = 0;
+	pthread_mutex_unlock(&all_lock);
+}
+
+static void make_key(void)
+{
+	pthread_key_create(&exit_key, thread_exit);
+}
+
+static struct ThreadStats *local_stats(void)
+{
+	static struct ThreadStats fallback;
+	if (tls_stats == NULL) {
+		pthread_once(&exit_once, make_key);
+		pthread_mutex_lock(&all_lock);
+		struct ThreadStats *ts;
+		for (ts = all_stats; ts && ts->in_use; ts = ts->next);
+		if (ts == NULL && (ts = calloc(1, sizeof(*ts))) != NULL) {
+			ts->next = all_stats;
+			all_stats = ts;
+		}
+		if (ts != NULL) {
+			ts->in_use = 1;
+			pthread_setspecific(exit_key, ts);
+		}
+		pthread_mutex_unlock(&all_lock);
+		tls_stats = (ts != NULL) ? ts : &fallback;
+	}
+	return tls_stats;
+}
+
+/*
+ * Counters are only written by the thread they belong to, but read by
+ * alis_stats_collect from any thread
+ */
+static uint64_t load(const uint64_t *c)
+{
+	return __atomic_load_n(c, __ATOMIC_RELAXED);
+}
+
+static void add(uint64_t *c, uint64_t v)
+{
+	__atomic_store_n(c, load(c) + v, __ATOMIC_RELAXED);
+}
+
+uint64_t stats_begin(void)
+{
+	return __atomic_load_n(&stats_timing_on, __ATOMIC_RELAXED) ? nstime() : 0;
+}
+
+void stats_end(enum AlisOp op, uint64_t t0, int failed)
+{
+	struct AlisOpStats *os = &(local_stats()->st.ops[op]);
+	add(&(os->calls), 1);
+	add(&(os->failures), failed != 0);
+	if (t0) {
+		uint64_t d = nstime() - t0;
+		unsigned b = d ? (63 - __builtin_clzll(d)) : 0;
+		add(&(os->timed), 1);
+		add(&(os->total_ns), d);
+		add(&(os->lat_hist[(b < ALIS_LAT_BUCKETS) ? b : ALIS_LAT_BUCKETS - 1]), 1);
+	}
+}
+
+void stats_pages(size_t requested, size_t reserved)
+{
+	struct AlisStats *st = &(local_stats()->st);
+	add(&(st->pages_requested), requested);
+	add(&(st->pages_reserved), reserved);
+}
+
+void alis_stats_timing(int enable)
+{
+	__atomic_store_n(&stats_timing_on, enable, __ATOMIC_RELAXED);
+}
+
+void alis_stats_collect(struct AlisStats *st)
+{
+	memset(st, 0, sizeof(*st));
+	pthread_mutex_lock(&all_lock);
+	for (struct ThreadStats *ts = all_stats; ts; ts = ts->next) {
+		for (int op = 0; op < ALIS_OP_COUNT; op++) {
+			struct AlisOpStats *d = &(st->ops[op]);
+			const struct AlisOpStats *s = &(ts->st.ops[op]);
+			d->calls += load(&(s->calls));
+			d->failures += load(&(s->failures));
+			d->timed += load(&(s->timed));
+			d->total_ns += load(&(s->total_ns));
+			for (int b = 0; b < ALIS_LAT_BUCKETS; b++) {
+				d->lat_hist[b] += load(&(s->lat_hist[b]));
+			}
+		}
+		st->pages_requested += load(&(ts->st.pages_requested));
+		st->pages_reserved += load(&(ts->st.pages_reserved));
+	}
+	pthread_mutex_unlock(&all_lock);
+}
+
+void alis_stats_reset(void)
+{
+	struct AlisStats *st = &(local_stats()->st);
+	for (int op = 0; op < ALIS_OP_COUNT; op++) {
+		struct AlisOpStats *os = &(st->ops[op]);
+		__atomic_store_n(&(os->calls), 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&(os->failures), 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&(os->timed), 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&(os->total_ns), 0, __ATOMIC_RELAXED);
+		for (int b = 0; b < ALIS_LAT_BUCKETS; b++) {
+			__atomic_store_n(&(os->lat_hist[b]), 0, __ATOMIC_RELAXED);
+		}
+	}
+	__atomic_store_n(&(st->pages_requested), 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&(st->pages_reserved), 0, __ATOMIC_RELAXED);
+}
+
+void alis_arena_snapshot(const struct Arena *a, struct ArenaSnapshot *s)
+{
+	uint8_t seen[(TICKET_MAX + 1) / 8];
+	memset(seen, 0, sizeof(seen));
+	memset(s, 0, sizeof(*s));
+	s->data_pages = a->data_pgents_size;
+	s->row_blocks = a->rb_top;
+	for (size_t i = 0; i < a->rb_top; i++) {
+		const ticketid_t t = a->rb_tickmap[i];
+		const size_t pc = a->rb_stack[i].data_pgcnt;
+		if (t == 0) {
+			unsigned b = pc ? (63 - __builtin_clzll(pc)) : 0;
+			s->free_pages += pc;
+			s->free_row_blocks++;
+			s->free_block_hist[(b < ALIS_FRAG_BUCKETS) ? b : ALIS_FRAG_BUCKETS - 1]++;
+			if (pc > s->largest_free_block) {
+				s->largest_free_block = pc;
+			}
+		} else if (t == a->trim_ticket) {
+			s->trimmed_pages += pc;
+		} else if (!(seen[t / 8] & (1 << (t % 8)))) {
+			seen[t / 8] |= 1 << (t % 8);
+			s->live_tickets++;
+		}
+	}
+	s->fragmentation = s->free_pages ?
+	                   1.0 - ((double)s->largest_free_block / s->free_pages) : 0.0;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2017-2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_STATS_H
+#define ALIS_STATS_H 1
+
+#include "arena.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum AlisOp {
+	ALIS_OP_RESERVE,
+	ALIS_OP_RELEASE,
+	ALIS_OP_GET,
+	ALIS_OP_MAP,
+	ALIS_OP_UNMAP,
+	ALIS_OP_COUNT
+};
+
+/* Latency bucket i counts operations that took [2^i, 2^(i+1)) ns */
+#define ALIS_LAT_BUCKETS 32
+
+struct AlisOpStats {
+	uint64_t calls;
+	uint64_t failures;
+	uint64_t timed;
+	uint64_t total_ns;
+	uint64_t lat_hist[ALIS_LAT_BUCKETS];
+};
+
+struct AlisStats {
+	struct AlisOpStats ops[ALIS_OP_COUNT];
+	uint64_t pages_requested;
+	uint64_t pages_reserved; /* pages_reserved - pages_requested is overshoot */
+};
+
+/*
+ * Operation counters are kept per thread and always on; latencies are only
+ * measured while timing is enabled (it is off by default).
+ */
+void alis_stats_timing(int enable);
+/* Sum the counters of all threads that have used alis into `*st' */
+void alis_stats_collect(struct AlisStats *st);
+/*
+ * Zero the counters of the calling thread only; other threads keep theirs,
+ * so a later alis_stats_collect still includes them. A thread carries on the
+ * counters of an exited one, so those are zeroed along with its own.
+ */
+void alis_stats_reset(void);
+
+/* Free row blocks with data_pgcnt in [2^i, 2^(i+1)) land in bucket i */
+#define ALIS_FRAG_BUCKETS 32
+
+struct ArenaSnapshot {
+	size_t data_pages;
+	size_t free_pages;
+	size_t row_blocks;
+	size_t free_row_blocks;
+	size_t largest_free_block;
+	/* Tickets held by callers; trimmed blocks count toward neither this nor free_pages */
+	size_t live_tickets;
+	/* Pages of blocks given back to the kernel by alis_arena_trim */
+	size_t trimmed_pages;
+	size_t free_block_hist[ALIS_FRAG_BUCKETS];
+	/* 1 - largest_free_block / free_pages; 0 when there is nothing free */
+	double fragmentation;
+};
+
+/* Walk rb_stack and describe the current occupancy of `arena' */
+void alis_arena_snapshot(const struct Arena *arena, struct ArenaSnapshot *snap);
+
+#endif /* stats.h */
@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_STATS_INT_H
+#define ALIS_STATS_INT_H 1
+
+#include "stats.h"
+
+#include <stdint.h>
+
+/* Returns a timestamp to pass to stats_end, or 0 when timing is off */
+uint64_t stats_begin(void);
+void stats_end(enum AlisOp op, uint64_t t0, int failed);
+void stats_pages(size_t requested, size_t reserved);
+
+#endif /* stats_int.h */
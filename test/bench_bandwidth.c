@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "arena.h"
+#include "arena_mgmt.h"
+#include "map.h"
+#include "nstime.h"
+
+#include <ramses/msys.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+const size_t ARENA_SZ_ = 256L * 1024 * 1024;
+const size_t RESV_SZ_ = 32L * 1024 * 1024;
+const size_t REPS = 16;
+
+const char *MSYS_STR = "map:intel:ivyhaswell:2dimm:2rank:pcibase=0x7f800000:tom=0x200000000";
+
+static const char *POLICY_NAMES[] = {
+	[ARENA_POLICY_BESTFIT] = "bestfit",
+	[ARENA_POLICY_SPREAD] = "spread",
+	[ARENA_POLICY_MAXBW] = "maxbw"
+};
+
+static size_t banks_used(struct Arena *a, ticketid_t t)
+{
+	size_t n = 0;
+	char used[a->bank_cnt ? a->bank_cnt : 1];
+	memset(used, 0, sizeof(used));
+	for (size_t i = 0; i < a->rb_top; i++) {
+		if (a->rb_tickmap[i] == t && !used[a->rb_stack[i].bank]) {
+			used[a->rb_stack[i].bank] = 1;
+			n++;
+		}
+	}
+	return n;
+}
+
+/* Streaming read and write bandwidth over `len' bytes at `p', in GB/s */
+static void stream(void *p, size_t len, double *rd, double *wr)
+{
+	volatile uint64_t sink = 0;
+	uint64_t t = nstime();
+	for (size_t r = 0; r < REPS; r++) {
+		memset(p, (int)r, len);
+	}
+	*wr = (double)(REPS * len) / (nstime() - t);
+
+	t = nstime();
+	for (size_t r = 0; r < REPS; r++) {
+		const uint64_t *w = p;
+		uint64_t s = 0;
+		for (size_t i = 0; i < len / sizeof(*w); i++) {
+			s += w[i];
+		}
+		sink += s;
+	}
+	*rd = (double)(REPS * len) / (nstime() - t);
+	(void)sink;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t ARENA_SZ = (argc > 1) ? atoll(argv[1]) * 1024 * 1024 : ARENA_SZ_;
+	size_t RESV_SZ = (argc > 2) ? atoll(argv[2]) * 1024 * 1024 : RESV_SZ_;
+	size_t rows = (argc > 3) ? atoll(argv[3]) : 1;
+
+	struct MemorySystem msys;
+	int err = ramses_msys_load(MSYS_STR, &msys, NULL);
+	if (err) {
+		perror(ramses_msys_load_strerr(err));
+		return 1;
+	}
+
+	struct MasterArena ma;
+	struct ArenaStats st = {0};
+	if (alis_arena_create(&msys, ARENA_SZ, rows, &ma, &st)) {
+		puts("Arena create error");
+		return 1;
+	}
+	struct Arena *a = &(ma.arena);
+	printf("Arena: %zu data pages in %zu row blocks over %zu banks\n",
+	       st.data_pages, a->rb_top, a->bank_cnt);
+
+	off_t *offs = malloc(st.data_pages * sizeof(*offs));
+	if (offs == NULL) {
+		return 1;
+	}
+	for (int pol = ARENA_POLICY_BESTFIT; pol <= ARENA_POLICY_MAXBW; pol++) {
+		ticketid_t t = alis_arena_reserve_policy(a, RESV_SZ, pol);
+		if (!t) {
+			puts("Ticket reservation error");
+			return 1;
+		}
+		size_t cnt = alis_arena_get_data(a, t, offs, st.data_pages);
+		void *p = alis_map(NULL, 0, a->mfd, offs, cnt, a->page_size);
+		if (p == MAP_FAILED) {
+			puts("Mapping failed");
+			return 1;
+		}
+		double rd, wr;
+		stream(p, RESV_SZ, &rd, &wr);
+		printf("%-8s %6zu pages %4zu banks | read %6.2f GB/s write %6.2f GB/s\n",
+		       POLICY_NAMES[pol], cnt, banks_used(a, t), rd, wr);
+		alis_unmap(p, cnt * a->page_size);
+		/* Start each policy from the same arena state */
+		alis_arena_release(a, t);
+	}
+	free(offs);
+	alis_arena_destroy(&ma);
+	return 0;
+}
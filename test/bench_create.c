@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2017-2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "arena.h"
+#include "arena_mgmt.h"
+
+#include <ramses/msys.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MAX_ITERS 32
+
+const size_t SZ_ = 16L * 1024 * 1024;
+
+const char *MSYS_STR = "map:intel:ivyhaswell:2dimm:2rank:pcibase=0x7f800000:tom=0x200000000";
+
+static const char *PHASE_NAMES[ARENA_PHASE_COUNT] = {
+	[ARENA_PHASE_BACKING] = "backing",
+	[ARENA_PHASE_POPULATE] = "populate",
+	[ARENA_PHASE_BUFMAP] = "bufmap",
+	[ARENA_PHASE_PASS1] = "pass1",
+	[ARENA_PHASE_YIELD] = "yield",
+	[ARENA_PHASE_PASS2] = "pass2",
+	[ARENA_PHASE_SORT] = "sort",
+	[ARENA_PHASE_FILL] = "fill"
+};
+
+static void print_iter(const char *label, const struct ArenaIterStats *its)
+{
+	printf("%-6s %8zu MiB %9zu ptes %9zu usable %9zu data |", label,
+	       its->backing_bytes >> 20, its->pte_cnt, its->usable_pages, its->data_pages);
+	for (int p = 0; p < ARENA_PHASE_COUNT; p++) {
+		printf(" %s %.3f", PHASE_NAMES[p], its->phase_ns[p] * 1e-9);
+	}
+	putchar('\n');
+}
+
+int main(int argc, char *argv[])
+{
+	size_t SZ = (argc > 1) ? atoll(argv[1]) * 1024 * 1024 : SZ_;
+	size_t rows = (argc > 2) ? atoll(argv[2]) : 0;
+	const char *model_path = (argc > 3 && *argv[3]) ? argv[3] : NULL;
+	size_t threads = (argc > 4) ? atoll(argv[4]) : 0;
+	size_t window = (argc > 5) ? atoll(argv[5]) : 0;
+	unsigned hshift = (argc > 6) ? atoi(argv[6]) : 0;
+
+	struct MemorySystem msys;
+	int err = ramses_msys_load(MSYS_STR, &msys, NULL);
+	if (err) {
+		perror(ramses_msys_load_strerr(err));
+		return 1;
+	}
+
+	struct MasterArena ma;
+	struct ArenaIterStats iters[MAX_ITERS];
+	struct ArenaStats st = {0};
+	struct ArenaSizeModel model;
+	struct ArenaOptions opts = {
+		.numa_node = ARENA_NODE_ANY,
+		.prefault_threads = threads,
+		.stream_window = window,
+		.hugetlb_shift = hshift,
+		.iter_stats = iters,
+		.iter_stats_cap = MAX_ITERS
+	};
+	if (model_path != NULL) {
+		alis_sizemodel_init(&model, &msys, sysconf(_SC_PAGESIZE), rows);
+		if (alis_sizemodel_load(&model, model_path)) {
+			puts("Starting a new size model");
+		}
+		opts.size_model = &model;
+	}
+	if (alis_arena_create_opts(&msys, SZ, rows, &opts, &ma, &st)) {
+		puts("Arena create error");
+		return 1;
+	}
+	if (model_path != NULL) {
+		printf("Model yield: %.4f over %zu samples\n", model.yield, model.samples);
+		alis_sizemodel_save(&model, model_path);
+	}
+
+	char label[16];
+	for (size_t i = 0; i < st.alloc_iterations && i < MAX_ITERS; i++) {
+		snprintf(label, sizeof(label), "it%zu", i);
+		print_iter(label, &iters[i]);
+	}
+	print_iter("total", &st.total);
+	printf("Data: %zu Guard: %zu Dropped: %zu Iters: %zu\n",
+	       st.data_pages, st.guard_pages, st.dropped_pages, st.alloc_iterations);
+	printf("Create wall time: %.3f s\n", st.total_ns * 1e-9);
+	alis_arena_destroy(&ma);
+	return 0;
+}
@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "arena.h"
+#include "arena_mgmt.h"
+#include "map.h"
+#include "nstime.h"
+#include "uring.h"
+
+#include <ramses/msys.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+const size_t ARENA_SZ_ = 64L * 1024 * 1024;
+const size_t RESV_SZ_ = 16L * 1024 * 1024;
+const size_t CHUNK_ = 256L * 1024;
+const size_t REPS = 32;
+#define MAX_BUFS 4096
+
+const char *MSYS_STR = "map:intel:ivyhaswell:2dimm:2rank:pcibase=0x7f800000:tom=0x200000000";
+
+#define FILL_BYTE 0x5c
+
+/* Just enough of an io_uring to submit one request at a time */
+struct Ring {
+	int fd;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+static int ring_init(struct Ring *r, unsigned entries)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0) {
+		return 1;
+	}
+	size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	char *sq = mmap(NULL, sq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+	                r->fd, IORING_OFF_SQ_RING);
+	char *cq = mmap(NULL, cq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+	                r->fd, IORING_OFF_CQ_RING);
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(*(r->sqes)), PROT_READ|PROT_WRITE,
+	               MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (sq == MAP_FAILED || cq == MAP_FAILED || r->sqes == MAP_FAILED) {
+		return 1;
+	}
+	r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq + p.sq_off.array);
+	r->cq_head = (unsigned *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+/*
+ * Send `len' bytes at `p' on `sock', from fixed buffer `index' if it is not
+ * negative, and wait for the result; zero-copy notifications are counted in
+ * `*notifs' and reaped later. Returns the result.
+ */
+static int ring_send(struct Ring *r, int sock, int zc, int index, const void *p,
+                     size_t len, size_t *notifs)
+{
+	const unsigned tail = *(r->sq_tail);
+	struct io_uring_sqe *sqe = &(r->sqes[tail & *(r->sq_mask)]);
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = zc ? IORING_OP_SEND_ZC : IORING_OP_SEND;
+	sqe->fd = sock;
+	sqe->addr = (uintptr_t)p;
+	sqe->len = len;
+	if (index >= 0) {
+		sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+		sqe->buf_index = index;
+	}
+	r->sq_array[tail & *(r->sq_mask)] = tail & *(r->sq_mask);
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	int res = 0;
+	int done = 0;
+	unsigned to_submit = 1;
+	while (!done) {
+		if (syscall(__NR_io_uring_enter, r->fd, to_submit, 1,
+		            IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+			return -1;
+		}
+		to_submit = 0;
+		unsigned head = *(r->cq_head);
+		while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+			const struct io_uring_cqe *cqe = &(r->cqes[head & *(r->cq_mask)]);
+			if (cqe->flags & IORING_CQE_F_NOTIF) {
+				(*notifs)--;
+			} else {
+				res = cqe->res;
+				done = 1;
+				*notifs += (cqe->flags & IORING_CQE_F_MORE) != 0;
+			}
+			head++;
+		}
+		__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	}
+	return res;
+}
+
+static void ring_reap(struct Ring *r, size_t *notifs)
+{
+	while (*notifs > 0) {
+		syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		unsigned head = *(r->cq_head);
+		while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+			*notifs -= (r->cqes[head & *(r->cq_mask)].flags & IORING_CQE_F_NOTIF) != 0;
+			head++;
+		}
+		__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	}
+}
+
+struct Receiver {
+	int lsock;
+	size_t total;
+	size_t bad;
+};
+
+/* Drain one connection, counting reads with bytes other than FILL_BYTE */
+static void *receive(void *arg)
+{
+	struct Receiver *rc = arg;
+	static unsigned char buf[1 << 20];
+	static unsigned char ref[1 << 20];
+	memset(ref, FILL_BYTE, sizeof(ref));
+	int s = accept(rc->lsock, NULL, NULL);
+	ssize_t n;
+	while ((n = recv(s, buf, sizeof(buf), 0)) > 0) {
+		rc->total += n;
+		rc->bad += (memcmp(buf, ref, n) != 0);
+	}
+	close(s);
+	return NULL;
+}
+
+/* Fixed buffer holding `p', or NULL */
+static const struct UringBuf *find_buf(const struct UringBuf *bufs, size_t n,
+                                       const char *p)
+{
+	for (size_t k = 0; k < n; k++) {
+		if (p >= (char *)bufs[k].addr && p < (char *)bufs[k].addr + bufs[k].len) {
+			return &bufs[k];
+		}
+	}
+	return NULL;
+}
+
+static const char *MODE_NAMES[] = {"send", "send_zc", "send_zc fixed"};
+
+/* Send REPS rounds of `len' bytes at `p' over loopback TCP; returns GB/s */
+static double run(struct Ring *r, int mode, char *p, size_t len, size_t chunk,
+                  const struct UringBuf *bufs, size_t nbufs)
+{
+	struct sockaddr_in sa = {.sin_family = AF_INET};
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t sl = sizeof(sa);
+	struct Receiver rc = {.lsock = socket(AF_INET, SOCK_STREAM, 0)};
+	if (bind(rc.lsock, (struct sockaddr *)&sa, sl) || listen(rc.lsock, 1) ||
+	    getsockname(rc.lsock, (struct sockaddr *)&sa, &sl))
+	{
+		return -1;
+	}
+	pthread_t tid;
+	pthread_create(&tid, NULL, receive, &rc);
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	if (connect(s, (struct sockaddr *)&sa, sl)) {
+		return -1;
+	}
+
+	size_t notifs = 0;
+	int err = 0;
+	uint64_t t = nstime();
+	for (size_t rep = 0; rep < REPS && !err; rep++) {
+		for (size_t off = 0; off < len && !err;) {
+			size_t n = (len - off < chunk) ? len - off : chunk;
+			int index = -1;
+			if (mode == 2) {
+				const struct UringBuf *b = find_buf(bufs, nbufs, p + off);
+				index = b->index;
+				if ((char *)b->addr + b->len < p + off + n) {
+					n = (char *)b->addr + b->len - (p + off);
+				}
+			}
+			int res = ring_send(r, s, mode != 0, index, p + off, n, &notifs);
+			if (res <= 0) {
+				printf("%s: send failed: %s\n", MODE_NAMES[mode], strerror(-res));
+				err = 1;
+			}
+			off += (res > 0) ? (size_t)res : 0;
+		}
+	}
+	ring_reap(r, &notifs);
+	close(s);
+	pthread_join(tid, NULL);
+	const uint64_t ns = nstime() - t;
+	close(rc.lsock);
+	if (err || rc.total != REPS * len || rc.bad != 0) {
+		printf("%s: received %zu of %zu bytes, %zu bad reads\n", MODE_NAMES[mode],
+		       rc.total, REPS * len, rc.bad);
+		return -1;
+	}
+	return (double)rc.total / ns;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t ARENA_SZ = (argc > 1) ? atoll(argv[1]) * 1024 * 1024 : ARENA_SZ_;
+	size_t RESV_SZ = (argc > 2) ? atoll(argv[2]) * 1024 * 1024 : RESV_SZ_;
+	size_t CHUNK = (argc > 3) ? atoll(argv[3]) * 1024 : CHUNK_;
+
+	struct MemorySystem msys;
+	int err = ramses_msys_load(MSYS_STR, &msys, NULL);
+	if (err) {
+		perror(ramses_msys_load_strerr(err));
+		return 1;
+	}
+	struct MasterArena ma;
+	struct ArenaStats st = {0};
+	if (alis_arena_create(&msys, ARENA_SZ, 0, &ma, &st)) {
+		puts("Arena create error");
+		return 1;
+	}
+	struct Arena *a = &(ma.arena);
+	ticketid_t t = alis_arena_reserve(a, RESV_SZ);
+	size_t cnt = alis_arena_get_data(a, t, NULL, 0);
+	off_t *offs = malloc(cnt * sizeof(*offs));
+	if (!t || offs == NULL) {
+		puts("Ticket reservation error");
+		return 1;
+	}
+	alis_arena_get_data(a, t, offs, cnt);
+	char *p = alis_map(NULL, 0, a->mfd, offs, cnt, a->page_size);
+	if (p == MAP_FAILED) {
+		puts("Mapping failed");
+		return 1;
+	}
+	const size_t len = cnt * a->page_size;
+	memset(p, FILL_BYTE, len);
+
+	struct Ring r;
+	struct UringBufTable tab;
+	static struct UringBuf bufs[MAX_BUFS];
+	if (ring_init(&r, 8) || alis_uring_init(&tab, r.fd, MAX_BUFS)) {
+		perror("io_uring setup");
+		return 1;
+	}
+	size_t nbufs = alis_uring_register(&tab, a, t, p, bufs, MAX_BUFS);
+	if (nbufs == 0) {
+		perror("alis_uring_register");
+		return 1;
+	}
+	printf("%zu bytes in %zu fixed buffers, %zu byte sends\n", len, nbufs, CHUNK);
+
+	int ret = 0;
+	for (int mode = 0; mode < 3; mode++) {
+		double bw = run(&r, mode, p, len, CHUNK, bufs, nbufs);
+		if (bw < 0) {
+			ret = 1;
+			continue;
+		}
+		printf("%-14s %6.2f GB/s\n", MODE_NAMES[mode], bw);
+	}
+
+	alis_uring_unregister(&tab, bufs, nbufs);
+	alis_uring_destroy(&tab);
+	close(r.fd);
+	alis_unmap(p, len);
+	free(offs);
+	alis_arena_release(a, t);
+	alis_arena_destroy(&ma);
+	return ret;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "arena.h"
+#include "arena_mgmt.h"
+
+#include <ramses/msys.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+const size_t SZ = 16L * 1024 * 1024;
+#define NTICKETS 256
+
+const char *MSYS_STR = "map:intel:ivyhaswell:2dimm:2rank:pcibase=0x7f800000:tom=0x200000000";
+
+static size_t free_pages(const struct Arena *a)
+{
+	return a->rb_pgtotals[a->rb_top - 1];
+}
+
+int main(void)
+{
+	struct MemorySystem msys;
+	struct MasterArena ma;
+	struct ArenaStats st = {0};
+
+	int err = ramses_msys_load(MSYS_STR, &msys, NULL);
+	if (err) {
+		perror(ramses_msys_load_strerr(err));
+		return 1;
+	}
+	if (alis_arena_create(&msys, SZ, 0, &ma, &st)) {
+		puts("Arena create error");
+		return 1;
+	}
+	struct Arena *a = &(ma.arena);
+	const size_t rb_top = a->rb_top;
+	const size_t free0 = free_pages(a);
+	int ret = 0;
+
+	size_t sizes[NTICKETS];
+	ticketid_t ticks[NTICKETS];
+	for (size_t i = 0; i < NTICKETS; i++) {
+		sizes[i] = (1 + (i % 3)) * a->page_size;
+	}
+	size_t n = alis_arena_reserve_batch(a, sizes, NTICKETS, ticks);
+	size_t got = 0;
+	for (size_t i = 0; i < NTICKETS; i++) {
+		const size_t pgcnt = ticks[i] ? alis_arena_get_data(a, ticks[i], NULL, 0) : 0;
+		if (ticks[i] && pgcnt * a->page_size < sizes[i]) {
+			printf("Ticket %u: %zu pages for %zu bytes\n", ticks[i], pgcnt, sizes[i]);
+			ret = 1;
+		}
+		got += pgcnt;
+	}
+	printf("%zu of %d tickets, %zu pages, %zu -> %zu row blocks\n",
+	       n, NTICKETS, got, rb_top, a->rb_top);
+	ret |= (n == 0 || free_pages(a) != free0 - got);
+	for (size_t i = 0; i < NTICKETS; i++) {
+		alis_arena_release(a, ticks[i]);
+	}
+
+	/* An atomic batch that cannot be satisfied must leave the arena as it was */
+	const ticketid_t last = a->last_ticket;
+	sizes[NTICKETS - 1] = (free0 + 1) * a->page_size;
+	if (!alis_arena_reserve_batch_all(a, sizes, NTICKETS, ticks) || ticks[0] != 0) {
+		puts("Oversized atomic batch succeeded");
+		ret = 1;
+	}
+	if (a->rb_top != rb_top || free_pages(a) != free0 || a->last_ticket != last) {
+		printf("Not rolled back: %zu row blocks, %zu free pages\n",
+		       a->rb_top, free_pages(a));
+		ret = 1;
+	}
+
+	/*
+	 * One-page requests cut guard rows out of the free blocks, so a last
+	 * request for the pages left passes the up-front check but fails in
+	 * reserve(), once the others are placed
+	 */
+	for (size_t i = 0; i < NTICKETS - 1; i++) {
+		sizes[i] = a->page_size;
+	}
+	sizes[NTICKETS - 1] = (free0 - (NTICKETS - 1)) * a->page_size;
+	n = alis_arena_reserve_batch(a, sizes, NTICKETS, ticks);
+	if (n != NTICKETS - 1 || ticks[NTICKETS - 1] != 0) {
+		printf("Fragmenting batch placed %zu tickets\n", n);
+		ret = 1;
+	}
+	for (size_t i = 0; i < NTICKETS; i++) {
+		alis_arena_release(a, ticks[i]);
+	}
+	const ticketid_t last2 = a->last_ticket;
+	if (!alis_arena_reserve_batch_all(a, sizes, NTICKETS, ticks) || ticks[0] != 0) {
+		puts("Fragmenting atomic batch succeeded");
+		ret = 1;
+	}
+	if (a->rb_top != rb_top || free_pages(a) != free0 || a->last_ticket != last2) {
+		printf("Not rolled back part-way: %zu row blocks, %zu free pages\n",
+		       a->rb_top, free_pages(a));
+		ret = 1;
+	}
+	alis_arena_destroy(&ma);
+	return ret;
+}
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "arena.h"
+#include "arena_int.h"
+#include "arena_mgmt.h"
+#include "compact.h"
+#include "map.h"
+
+#include <ramses/msys.h>
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const size_t SZ = 16L * 1024 * 1024;
+
+const char *MSYS_STR = "map:intel:ivyhaswell:2dimm:2rank:pcibase=0x7f800000:tom=0x200000000";
+
+static size_t free_blocks(const struct Arena *a)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < a->rb_top; i++) {
+		n += (a->rb_tickmap[i] == 0);
+	}
+	return n;
+}
+
+static size_t largest_free(const struct Arena *a)
+{
+	for (size_t i = a->rb_top; i --> 0;) {
+		if (a->rb_tickmap[i] == 0) {
+			return a->rb_stack[i].data_pgcnt;
+		}
+	}
+	return 0;
+}
+
+static void *map_ticket(struct Arena *a, ticketid_t t, size_t *len)
+{
+	const size_t cnt = alis_arena_get_data(a, t, NULL, 0);
+	off_t offs[cnt];
+	alis_arena_get_data(a, t, offs, cnt);
+	*len = cnt * a->page_size;
+	return alis_map(NULL, 0, a->mfd, offs, cnt, a->page_size);
+}
+
+static int check_fill(const unsigned char *p, size_t len, unsigned char c)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (p[i] != c) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+struct writer {
+	unsigned char *addr;
+	size_t len;
+	int stop;
+	unsigned char last;
+};
+
+/* Keeps rewriting a movable range while it is being moved */
+static void *write_loop(void *arg)
+{
+	struct writer *w = arg;
+	unsigned char v = 0;
+	while (!__atomic_load_n(&(w->stop), __ATOMIC_ACQUIRE)) {
+		/* Skip 0, which stands for nothing written yet */
+		v = (v == UCHAR_MAX) ? 1 : v + 1;
+		memset(w->addr, v, w->len);
+		__atomic_store_n(&(w->last), v, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	struct MemorySystem msys;
+	struct MasterArena ma;
+	struct ArenaStats st = {0};
+
+	int err = ramses_msys_load(MSYS_STR, &msys, NULL);
+	if (err) {
+		perror(ramses_msys_load_strerr(err));
+		return 1;
+	}
+	if (alis_arena_create(&msys, SZ, 0, &ma, &st)) {
+		puts("Arena create error");
+		return 1;
+	}
+	struct Arena *a = &(ma.arena);
+	const size_t rb_top = a->rb_top;
+	int ret = 0;
+
+	/*
+	 * Fill the arena with single-page tickets, which cuts up the larger row
+	 * blocks, then free every other one
+	 */
+	const size_t n = a->rb_pgtotals[a->rb_top - 1];
+	size_t *sizes = malloc(n * sizeof(*sizes));
+	ticketid_t *ticks = malloc(n * sizeof(*ticks));
+	void **addrs = malloc(n * sizeof(*addrs));
+	size_t *lens = malloc(n * sizeof(*lens));
+	if (sizes == NULL || ticks == NULL || addrs == NULL || lens == NULL) {
+		return 1;
+	}
+	for (size_t i = 0; i < n; i++) {
+		sizes[i] = a->page_size;
+	}
+	const size_t nt = alis_arena_reserve_batch(a, sizes, n, ticks);
+	for (size_t i = 0; i < nt; i++) {
+		if (i % 2) {
+			alis_arena_release(a, ticks[i]);
+			addrs[i] = NULL;
+			continue;
+		}
+		addrs[i] = map_ticket(a, ticks[i], &lens[i]);
+		if (addrs[i] == MAP_FAILED) {
+			puts("Mapping failed");
+			return 1;
+		}
+		memset(addrs[i], (int)i, lens[i]);
+	}
+
+	/* Writes racing with a move must block, not fault or get lost */
+	size_t wi = 0;
+	size_t wmerges = 0;
+	for (size_t i = 0; i < nt; i += 2) {
+		const size_t m = arena_release_merges(a, ticks[i]);
+		if (m > wmerges) {
+			wi = i;
+			wmerges = m;
+		}
+	}
+	struct Compactor wc;
+	alis_compact_init(&wc, a);
+	struct writer w = {.addr = addrs[wi], .len = lens[wi], .stop = 0};
+	pthread_t wt;
+	if (alis_compact_register(&wc, ticks[wi], addrs[wi]) ||
+	    pthread_create(&wt, NULL, write_loop, &w) != 0)
+	{
+		return 1;
+	}
+	while (__atomic_load_n(&(w.last), __ATOMIC_ACQUIRE) == 0);
+	const size_t wmoved = alis_compact(&wc, 0, NULL);
+	__atomic_store_n(&(w.stop), 1, __ATOMIC_RELEASE);
+	pthread_join(wt, NULL);
+	ticks[wi] = alis_compact_unregister(&wc, addrs[wi]);
+	alis_compact_destroy(&wc);
+	if (wmoved != 1 || check_fill(addrs[wi], lens[wi], w.last)) {
+		puts("Ticket not moved under a writer, or writes lost");
+		ret = 1;
+	}
+
+	struct Compactor c;
+	alis_compact_init(&c, a);
+	for (size_t i = 0; i < nt; i += 2) {
+		if (alis_compact_register(&c, ticks[i], addrs[i])) {
+			puts("Registration failed");
+			return 1;
+		}
+	}
+	const size_t before = free_blocks(a);
+	const size_t largest = largest_free(a);
+	size_t copied;
+	size_t moved = alis_compact(&c, 0, &copied);
+	printf("Moved %zu tickets (%zu bytes): %zu -> %zu free row blocks, "
+	       "largest %zu -> %zu pages\n", moved, copied, before, free_blocks(a),
+	       largest, largest_free(a));
+	if (moved == 0 || free_blocks(a) >= before) {
+		puts("Compaction did not merge free row blocks");
+		ret = 1;
+	}
+
+	for (size_t i = 0; i < nt; i += 2) {
+		if (check_fill(addrs[i], lens[i], (i == wi) ? w.last : (unsigned char)i)) {
+			printf("Ticket %zu lost its data\n", i);
+			ret = 1;
+		}
+		/* The range must still be writable after a move */
+		memset(addrs[i], 0, lens[i]);
+		ticketid_t t = alis_compact_unregister(&c, addrs[i]);
+		alis_unmap(addrs[i], lens[i]);
+		alis_arena_release(a, t);
+	}
+	alis_compact_destroy(&c);
+	free(sizes);
+	free(ticks);
+	free(addrs);
+	free(lens);
+	if (a->rb_top != rb_top) {
+		printf("Not coalesced: %zu row blocks, expected %zu\n", a->rb_top, rb_top);
+		ret = 1;
+	}
+	alis_arena_destroy(&ma);
+	return ret;
+}
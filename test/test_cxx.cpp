@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#include "alis.hpp"
+
+#include <ramses/msys.h>
+
+#include <cstdio>
+#include <cstring>
+
+const size_t SZ = 16L * 1024 * 1024;
+
+const char *MSYS_STR = "map:intel:ivyhaswell:2dimm:2rank:pcibase=0x7f800000:tom=0x200000000";
+
+int main()
+{
+	struct MemorySystem msys;
+	int err = ramses_msys_load(MSYS_STR, &msys, NULL);
+	if (err) {
+		perror(ramses_msys_load_strerr(err));
+		return 1;
+	}
+	try {
+		alis::Arena arena(&msys, SZ);
+		const size_t free_pages = arena.free_pages();
+		{
+			alis::Reservation r = arena.reserve(SZ / 4);
+			alis::View v = r.map();
+			std::memset(v.data(), 0x5c, v.size());
+			alis::Reservation moved = std::move(r);
+			if (r || !moved || v.size() != moved.size()) {
+				std::puts("Bad reservation state after move");
+				return 1;
+			}
+		}
+		#ifdef ALIS_HAVE_PMR
+		{
+			alis::MemoryResource mr(arena, 1024 * 1024);
+			std::pmr::vector<int> vec(&mr);
+			for (int i = 0; i < 1000000; i++) {
+				vec.push_back(i);
+			}
+			for (int i = 0; i < 1000000; i++) {
+				if (vec[i] != i) {
+					std::puts("Bad vector contents");
+					return 1;
+				}
+			}
+			std::printf("pmr: %zu bytes mapped\n", mr.mapped());
+		}
+		#endif
+		if (arena.free_pages() != free_pages) {
+			std::printf("Leaked pages: %zu free, expected %zu\n",
+			            arena.free_pages(), free_pages);
+			return 1;
+		}
+	} catch (const std::exception &e) {
+		std::printf("Error: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
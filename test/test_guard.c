@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "arena.h"
+#include "guard.h"
+#include "guard_int.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUF_LEN 4096
+#define MAX_KERNELS 4
+
+static void tassert(int c, const char *what)
+{
+	if (!c) {
+		printf("Failed: %s\n", what);
+		exit(1);
+	}
+}
+
+#define SCAN_PAGES 4
+#define SHARED_PAGE 2
+
+/*
+ * Scan a hand-built arena over a plain buffer whose guard page SHARED_PAGE is
+ * a data page too: its data must be neither reported nor refilled
+ */
+static void scan_shared(void)
+{
+	static struct ArenaPageEntry gpgents[SCAN_PAGES];
+	uint64_t shared = (uint64_t)1 << SHARED_PAGE;
+	struct MasterArena ma;
+	struct GuardScanner gs = {0};
+	struct GuardFault faults[SCAN_PAGES];
+
+	memset(&ma, 0, sizeof(ma));
+	tassert(posix_memalign(&ma.backing.buf, 64, SCAN_PAGES * BUF_LEN) == 0,
+	        "backing allocation");
+	unsigned char *buf = ma.backing.buf;
+	memset(buf, ARENA_GUARD_BYTE, SCAN_PAGES * BUF_LEN);
+	for (size_t i = 0; i < SCAN_PAGES; i++) {
+		gpgents[i] = ((struct ArenaPageEntry){.pfn = 100 + i, .mfd_pgoff = i});
+	}
+	ma.arena.page_size = BUF_LEN;
+	ma.arena.guard_pgents = gpgents;
+	ma.arena.guard_pgents_size = SCAN_PAGES;
+	ma.arena.guard_shared = &shared;
+
+	buf[SHARED_PAGE * BUF_LEN + 7] = 0x11;
+	buf[BUF_LEN + 5] = 0x22;
+	tassert(alis_guard_scan(&ma, &gs, 0, 0, 1, faults, SCAN_PAGES) == 1 &&
+	        faults[0].mfd_off == BUF_LEN && faults[0].bad_bytes == 1,
+	        "only the unshared guard page reported");
+	tassert(buf[BUF_LEN + 5] == ARENA_GUARD_BYTE, "guard page refilled");
+	tassert(buf[SHARED_PAGE * BUF_LEN + 7] == 0x11, "shared page left alone");
+	tassert(gs.pages_scanned == SCAN_PAGES - 1, "shared page skipped");
+	free(buf);
+}
+
+/* Every kernel this CPU runs must agree with guard_count_bad on every byte */
+int main(void)
+{
+	const size_t lens[] = {64, 128, 192, BUF_LEN};
+	const unsigned char bad[] = {0, ARENA_GUARD_BYTE ^ 0x01, ARENA_GUARD_BYTE ^ 0x80};
+	guard_kernel_t kernels[MAX_KERNELS];
+	const size_t kcnt = guard_kernels(kernels, MAX_KERNELS);
+	tassert(kcnt > 0, "kernel available");
+
+	unsigned char *buf;
+	tassert(posix_memalign((void **)&buf, 64, BUF_LEN) == 0, "buffer allocation");
+	memset(buf, ARENA_GUARD_BYTE, BUF_LEN);
+	for (size_t k = 0; k < kcnt; k++) {
+		for (size_t l = 0; l < sizeof(lens) / sizeof(*lens); l++) {
+			const size_t len = lens[l];
+			tassert(guard_count_bad(buf, len) == 0, "clean count");
+			tassert(!kernels[k](buf, len), "clean buffer");
+			for (size_t i = 0; i < len; i++) {
+				for (size_t b = 0; b < sizeof(bad); b++) {
+					buf[i] = bad[b];
+					tassert(guard_count_bad(buf, len) == 1, "dirty count");
+					tassert(kernels[k](buf, len), "dirty byte found");
+				}
+				buf[i] = ARENA_GUARD_BYTE;
+			}
+			/* Bytes past `len' are not looked at */
+			if (len < BUF_LEN) {
+				buf[len] = 0;
+				tassert(!kernels[k](buf, len), "bytes past the end ignored");
+				buf[len] = ARENA_GUARD_BYTE;
+			}
+		}
+	}
+	free(buf);
+	scan_shared();
+	printf("%zu guard kernels OK\n", kcnt);
+	return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2017-2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "lazymap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static void tassert(int c) {if (!c) exit(1);}
+
+int main(int argc, char *argv[])
+{
+	const size_t cnt = (argc > 1) ? atoi(argv[1]) : 1024;
+	const size_t batch = (argc > 2) ? atoi(argv[2]) : 16;
+	const size_t ps = sysconf(_SC_PAGESIZE);
+
+	int mfd = syscall(SYS_memfd_create, "AlisLazyTest", 0);
+	tassert(mfd >= 0 && ftruncate(mfd, 2 * cnt * ps) == 0);
+	char *file = mmap(NULL, 2 * cnt * ps, PROT_READ|PROT_WRITE, MAP_SHARED, mfd, 0);
+	tassert(file != MAP_FAILED);
+
+	/* Every other page, backwards, so no two chunks are mfd-contiguous */
+	off_t *offs = malloc(cnt * sizeof(*offs));
+	for (size_t i = 0; i < cnt; i++) {
+		offs[i] = (2 * (cnt - i) - 1) * ps;
+		file[offs[i]] = (char)i;
+	}
+
+	struct LazyMap lm;
+	if (alis_lazymap_create(&lm, NULL, 0, mfd, offs, cnt, ps, batch)) {
+		perror("userfaultfd unavailable");
+		return 0;
+	}
+	char *p = lm.addr;
+	for (size_t i = cnt; i --> 0;) {
+		tassert(p[i * ps] == (char)i);
+	}
+	p[ps + 1] = 0x5a;
+	tassert(file[offs[1] + 1] == 0x5a);
+	tassert(alis_lazymap_destroy(&lm) == 0);
+	return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "arena.h"
+#include "arena_mgmt.h"
+#include "guard.h"
+#include "map.h"
+
+#include <ramses/msys.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const size_t SZ = 16L * 1024 * 1024;
+
+const char *MSYS_STR = "map:intel:ivyhaswell:2dimm:2rank:pcibase=0x7f800000:tom=0x200000000";
+
+static int pa_cmp(const void *a, const void *b)
+{
+	physaddr_t x = *(const physaddr_t *)a;
+	physaddr_t y = *(const physaddr_t *)b;
+	return (x == y) ? 0 : ((x < y) ? -1 : 1);
+}
+
+/*
+ * Whether the data pages of `t' overlap its own guard pages or, if `u' is not
+ * 0, the data pages of ticket `u'
+ */
+static int overlap(struct Arena *a, ticketid_t t, ticketid_t u)
+{
+	const size_t nd = alis_arena_get_data_physaddr(a, t, NULL, 0);
+	const size_t ng = alis_arena_get_guard_physaddr(a, t, NULL, 0);
+	const size_t nu = u ? alis_arena_get_data_physaddr(a, u, NULL, 0) : 0;
+	physaddr_t *d = calloc(nd + ng + nu, sizeof(*d));
+	if (d == NULL) {
+		return 1;
+	}
+	physaddr_t *g = d + nd;
+	alis_arena_get_data_physaddr(a, t, d, nd);
+	alis_arena_get_guard_physaddr(a, t, g, ng);
+	if (u) {
+		alis_arena_get_data_physaddr(a, u, g + ng, nu);
+	}
+	qsort(d, nd, sizeof(*d), pa_cmp);
+	int ret = 0;
+	for (size_t i = 0; i < ng + nu && !ret; i++) {
+		ret = (g[i] != 0 && bsearch(&g[i], d, nd, sizeof(*d), pa_cmp) != NULL);
+	}
+	free(d);
+	return ret;
+}
+
+int main(void)
+{
+	struct MemorySystem msys;
+	struct MasterArena ma;
+	struct ArenaStats st = {0};
+	struct GuardScanner gs = {0};
+
+	int err = ramses_msys_load(MSYS_STR, &msys, NULL);
+	if (err) {
+		perror(ramses_msys_load_strerr(err));
+		return 1;
+	}
+	/* Single-row blocks, so neighbouring blocks are one guard row apart */
+	if (alis_arena_create(&msys, SZ, 1, &ma, &st)) {
+		puts("Arena create error");
+		return 1;
+	}
+	struct Arena *a = &(ma.arena);
+	const size_t rb_top = a->rb_top;
+	const size_t free_pages = a->rb_pgtotals[a->rb_top - 1];
+	int ret = 0;
+
+	ticketid_t t = alis_arena_reserve(a, free_pages / 2 * a->page_size);
+	if (!t) {
+		puts("Ticket reservation error");
+		return 1;
+	}
+	size_t blocks = 0;
+	for (size_t i = 0; i < a->rb_top; i++) {
+		blocks += (a->rb_tickmap[i] == t) ? a->rb_stack[i].data_pgcnt : 0;
+	}
+	const size_t cnt = alis_arena_get_data(a, t, NULL, 0);
+	printf("%zu data pages, %zu from lent guard rows\n", cnt, cnt - blocks);
+	if (cnt < blocks || overlap(a, t, 0)) {
+		puts("Lent rows still handed out as guards");
+		ret = 1;
+	}
+
+	/* No page may be data of two tickets, lent or not */
+	ticketid_t u = alis_arena_reserve(a, 0);
+	if (!u) {
+		puts("Second ticket reservation error");
+		return 1;
+	}
+	if (overlap(a, u, 0) || overlap(a, t, u) || overlap(a, u, t)) {
+		puts("Data pages shared between tickets");
+		ret = 1;
+	}
+	alis_arena_release(a, u);
+
+	/* Writing the lent rows must not show up as guard corruption */
+	off_t *offs = malloc(cnt * sizeof(*offs));
+	if (offs == NULL) {
+		return 1;
+	}
+	alis_arena_get_data(a, t, offs, cnt);
+	void *p = alis_map(NULL, 0, a->mfd, offs, cnt, a->page_size);
+	if (p == MAP_FAILED) {
+		puts("Mapping failed");
+		return 1;
+	}
+	memset(p, 0x5c, cnt * a->page_size);
+	alis_unmap(p, cnt * a->page_size);
+	free(offs);
+	if (alis_guard_scan(&ma, &gs, 0, 0, 0, NULL, 0) != 0) {
+		puts("Guard faults in lent rows");
+		ret = 1;
+	}
+
+	/* Releasing the ticket turns the lent rows back into clean guards */
+	alis_arena_release(a, t);
+	if (alis_guard_scan(&ma, &gs, 0, 0, 0, NULL, 0) != 0) {
+		puts("Lent rows not restored as guards");
+		ret = 1;
+	}
+	for (size_t r = 0; r < a->row_cnt; r++) {
+		if (a->rows[r].flags & ARENA_ROW_LENT) {
+			printf("Row %zu still lent\n", r);
+			ret = 1;
+			break;
+		}
+	}
+	if (a->rb_top != rb_top || a->rb_pgtotals[a->rb_top - 1] != free_pages) {
+		printf("Not coalesced: %zu row blocks, %zu free pages\n",
+		       a->rb_top, a->rb_pgtotals[a->rb_top - 1]);
+		ret = 1;
+	}
+	alis_arena_destroy(&ma);
+	return ret;
+}
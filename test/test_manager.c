@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "manager.h"
+
+#include <ramses/msys.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+const size_t SZ = 16L * 1024 * 1024;
+
+const char *MSYS_STR = "map:intel:ivyhaswell:2dimm:2rank:pcibase=0x7f800000:tom=0x200000000";
+
+static void tassert(int c, const char *what)
+{
+	if (!c) {
+		printf("Failed: %s\n", what);
+		exit(1);
+	}
+}
+
+int main(void)
+{
+	struct MemorySystem msys;
+	struct ArenaManager *m = malloc(sizeof(*m));
+
+	int err = ramses_msys_load(MSYS_STR, &msys, NULL);
+	if (err) {
+		perror(ramses_msys_load_strerr(err));
+		return 1;
+	}
+	tassert(m != NULL, "manager allocation");
+	/* Keep no empty arenas, so the last release drops the arena */
+	tassert(alis_mgr_init(m, &msys, SZ, 0, NULL, 0) == 0, "manager init");
+
+	const mgr_ticket_t t = alis_mgr_reserve(m, 4096);
+	const mgr_ticket_t u = alis_mgr_reserve(m, 4096);
+	tassert(t != 0 && u != 0, "reservations");
+	tassert(m->arena_cnt == 1, "both tickets in one arena");
+	const size_t ucnt = alis_mgr_get_data(m, u, NULL, 0);
+
+	/* A second release of t must leave u and its arena alone */
+	alis_mgr_release(m, t);
+	alis_mgr_release(m, t);
+	tassert(m->arena_cnt == 1, "arena kept while a ticket is live");
+	tassert(alis_mgr_get_data(m, u, NULL, 0) == ucnt, "live ticket intact");
+
+	alis_mgr_release(m, u);
+	tassert(m->arena_cnt == 0, "empty arena dropped");
+	/* Stale tickets no longer match anything */
+	alis_mgr_release(m, u);
+	tassert(alis_mgr_get_data(m, u, NULL, 0) == 0, "stale ticket");
+
+	/* Nor after the slot has been reused 256 times */
+	m->slots[0].gen += 255;
+	tassert(alis_mgr_reserve(m, 4096) != 0 && alis_mgr_reserve(m, 4096) != 0,
+	        "reservations in the reused slot");
+	tassert(alis_mgr_get_data(m, u, NULL, 0) == 0, "stale ticket after 256 reuses");
+
+	alis_mgr_destroy(m);
+	free(m);
+	puts("Double release OK");
+	return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "arena.h"
+#include "mapcache.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* Pages held by tickets 1 to 4, one single-row block each */
+static const size_t TICKET_PAGES[] = {2, 3, 12, 1};
+#define TICKETS (sizeof(TICKET_PAGES) / sizeof(*TICKET_PAGES))
+#define WINDOW_PAGES 4
+
+static void tassert(int c, const char *what)
+{
+	if (!c) {
+		printf("Failed: %s\n", what);
+		exit(1);
+	}
+}
+
+/*
+ * Hand-built arena over a memfd, so no pagemap access is needed: data rows
+ * alternate with empty guard rows and each block holds every other page of
+ * the memfd, backwards, so no two pages are mfd-contiguous.
+ */
+static void fake_arena(struct Arena *a, int mfd, size_t ps)
+{
+	static struct RowBlock rbs[TICKETS];
+	static ticketid_t tickmap[TICKETS];
+	static size_t totals[TICKETS];
+	static struct ArenaRow rows[2 * TICKETS + 1];
+	static struct ArenaPageEntry pgents[64];
+
+	memset(a, 0, sizeof(*a));
+	size_t pgcnt = 0;
+	for (size_t i = 0; i < TICKETS; i++) {
+		rows[2 * i] = ((struct ArenaRow){0, 0, ARENA_ROW_GUARD});
+		rows[2 * i + 1] = ((struct ArenaRow){pgcnt, TICKET_PAGES[i], 0});
+		rbs[i] = ((struct RowBlock){
+			.data_pgcnt = TICKET_PAGES[i],
+			.data_pgents_off = pgcnt,
+			.row_off = 2 * i + 1,
+			.row_cnt = 1
+		});
+		for (size_t j = 0; j < TICKET_PAGES[i]; j++, pgcnt++) {
+			pgents[pgcnt].pfn = 1000 + pgcnt;
+			pgents[pgcnt].mfd_pgoff = 2 * (64 - pgcnt) - 1;
+		}
+		tickmap[i] = i + 1;
+	}
+	rows[2 * TICKETS] = ((struct ArenaRow){0, 0, ARENA_ROW_GUARD});
+	a->page_size = ps;
+	a->rb_stack = rbs;
+	a->rb_top = TICKETS;
+	a->rb_cap = TICKETS;
+	a->rb_tickmap = tickmap;
+	a->rb_pgtotals = totals;
+	a->data_pgents = pgents;
+	a->data_pgents_size = pgcnt;
+	a->rows = rows;
+	a->row_cnt = 2 * TICKETS + 1;
+	a->last_ticket = TICKETS;
+	a->mfd = mfd;
+}
+
+/* Whether the mapping `p' of ticket `t' shows the ticket's pages, in order */
+static int shows_pages(struct Arena *a, ticketid_t t, const char *p, size_t len)
+{
+	off_t offs[64];
+	const size_t cnt = alis_arena_get_data(a, t, offs, 64);
+	if (cnt * a->page_size != len) {
+		return 0;
+	}
+	for (size_t i = 0; i < cnt; i++) {
+		if (p[i * a->page_size] != (char)(offs[i] / a->page_size)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static uint64_t map_calls(void)
+{
+	struct AlisStats st;
+	alis_stats_collect(&st);
+	return st.ops[ALIS_OP_MAP].calls;
+}
+
+int main(void)
+{
+	const size_t ps = sysconf(_SC_PAGESIZE);
+	int mfd = syscall(SYS_memfd_create, "AlisMapCacheTest", 0);
+	tassert(mfd >= 0 && ftruncate(mfd, 128 * ps) == 0, "memfd");
+	for (size_t i = 0; i < 128; i++) {
+		const char c = (char)i;
+		tassert(pwrite(mfd, &c, 1, i * ps) == 1, "memfd fill");
+	}
+
+	struct Arena a;
+	struct MapCache mc;
+	fake_arena(&a, mfd, ps);
+	tassert(alis_mapcache_init(&mc, WINDOW_PAGES * ps, 0, 1) == 0, "init");
+
+	/* Ticket 1 takes the only window, 2 and 3 get mappings of their own */
+	const uint64_t calls = map_calls();
+	void *m[TICKETS];
+	size_t len[TICKETS];
+	for (size_t i = 0; i < 3; i++) {
+		m[i] = alis_mapcache_map(&mc, &a, i + 1, &len[i]);
+		tassert(m[i] != MAP_FAILED, "map");
+		tassert(shows_pages(&a, i + 1, m[i], len[i]), "mapped pages");
+	}
+	tassert(mc.maps[0].windowed && !mc.maps[1].windowed && !mc.maps[2].windowed,
+	        "window placement");
+	tassert(alis_mapcache_map(&mc, &a, 1, NULL) == m[0], "cached mapping");
+	tassert(map_calls() - calls == 4, "each map recorded once");
+
+	/* Writes go to the memfd */
+	char c = 0;
+	((char *)m[1])[ps + 1] = 0x5a;
+	off_t offs[3];
+	alis_arena_get_data(&a, 2, offs, 3);
+	tassert(pread(mfd, &c, 1, offs[1] + 1) == 1 && c == 0x5a, "write through");
+
+	/* An evicted window is reserved again and reused */
+	tassert(alis_mapcache_evict(&mc, &a, 1) == 0, "evict");
+	tassert(alis_mapcache_evict(&mc, &a, 1) == 1, "evict twice");
+	unsigned char vec;
+	tassert(mincore(m[0], ps, &vec) == 0, "window kept reserved");
+	m[3] = alis_mapcache_map(&mc, &a, 4, &len[3]);
+	tassert(m[3] == m[0] && shows_pages(&a, 4, m[3], len[3]), "window reused");
+	tassert(alis_mapcache_map(&mc, &a, TICKETS + 1, NULL) == MAP_FAILED, "unknown ticket");
+
+	alis_mapcache_destroy(&mc);
+	close(mfd);
+	puts("Map cache OK");
+	return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "arena.h"
+#include "arena_int.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* Three 2 MiB chunks and a partial one, followed by pages left alone */
+#define CHUNK (2 * 1024 * 1024)
+#define TAIL_PAGES 5
+#define SPARE (1024 * 1024)
+
+static void tassert(int c, const char *what)
+{
+	if (!c) {
+		printf("Failed: %s\n", what);
+		exit(1);
+	}
+}
+
+/* Number of resident pages among the `cnt' pages at `p' */
+static size_t resident(void *p, size_t cnt)
+{
+	unsigned char *vec = malloc(cnt);
+	tassert(vec != NULL && mincore(p, cnt * sysconf(_SC_PAGESIZE), vec) == 0, "mincore");
+	size_t n = 0;
+	for (size_t i = 0; i < cnt; i++) {
+		n += vec[i] & 1;
+	}
+	free(vec);
+	return n;
+}
+
+/* Every thread count must fault in exactly the requested range of a memfd */
+int main(void)
+{
+	const size_t ps = sysconf(_SC_PAGESIZE);
+	const size_t len = 3 * CHUNK + TAIL_PAGES * ps;
+	const size_t threads[] = {1, 2, 3, 4, 16};
+	for (size_t i = 0; i < sizeof(threads) / sizeof(*threads); i++) {
+		int mfd = syscall(SYS_memfd_create, "AlisPrefaultTest", 0);
+		tassert(mfd >= 0 && ftruncate(mfd, len + SPARE) == 0, "memfd");
+		char *buf = mmap(NULL, len + SPARE, PROT_READ|PROT_WRITE, MAP_SHARED, mfd, 0);
+		tassert(buf != MAP_FAILED, "mmap");
+		tassert(resident(buf, (len + SPARE) / ps) == 0, "fresh memfd");
+
+		arena_prefault(buf, len, ps, threads[i]);
+		tassert(resident(buf, len / ps) == len / ps, "range faulted in");
+		tassert(resident(buf + len, SPARE / ps) == 0, "nothing faulted past the range");
+		munmap(buf, len + SPARE);
+		close(mfd);
+	}
+	puts("Prefault OK");
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "async.h"
+
+#include <ramses/msys.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+const size_t SZ = 16L * 1024 * 1024;
+
+const char *MSYS_STR = "map:intel:ivyhaswell:2dimm:2rank:pcibase=0x7f800000:tom=0x200000000";
+
+static void tassert(int c, const char *what)
+{
+	if (!c) {
+		printf("Failed: %s\n", what);
+		exit(1);
+	}
+}
+
+static size_t free_pages(struct Arena *a)
+{
+	return a->rb_top ? a->rb_pgtotals[a->rb_top - 1] : 0;
+}
+
+int main(void)
+{
+	struct MemorySystem msys;
+	int err = ramses_msys_load(MSYS_STR, &msys, NULL);
+	if (err) {
+		perror(ramses_msys_load_strerr(err));
+		return 1;
+	}
+
+	/* A background build hands over a usable arena and its stats */
+	struct ArenaBuild *b = alis_arena_create_async(&msys, SZ, 0, NULL);
+	tassert(b != NULL, "build start");
+	struct MasterArena ma;
+	struct ArenaStats st;
+	tassert(alis_arena_build_wait(b, &ma, &st) == 0, "build");
+	tassert(free_pages(&(ma.arena)) == st.data_pages && st.data_pages > 0, "built arena");
+	ticketid_t t = alis_arena_reserve(&(ma.arena), ma.arena.page_size);
+	tassert(t != 0 && alis_arena_release(&(ma.arena), t) != 0, "built arena in use");
+	alis_arena_destroy(&ma);
+
+	/* A watermark above any arena keeps a standby build going */
+	struct ArenaReplenisher r;
+	tassert(alis_repl_init(&r, &msys, SZ, 0, NULL, SIZE_MAX) == 0, "replenisher init");
+	tassert(r.standby != NULL, "standby build started");
+	struct ReplArena *first = r.active;
+	const struct ReplTicket u = alis_repl_reserve(&r, 4096);
+	const struct ReplTicket v = alis_repl_reserve(&r, 4096);
+	tassert(u.ticket != 0 && v.ticket != 0 && u.ra == first, "reservations");
+	struct ReplTicket w;
+	do {
+		w = alis_repl_reserve(&r, SZ / 4);
+	} while (w.ticket != 0 && r.active == first);
+	tassert(r.active != first && r.draining_cnt == 1, "swapped to the standby");
+
+	/* A drained arena lives until its last ticket goes, however often released */
+	alis_repl_release(&r, u);
+	alis_repl_release(&r, u);
+	tassert(r.draining_cnt == 1 && first->live_tickets > 0, "double release");
+	for (size_t i = 0; i < 64 && r.draining_cnt > 0; i++) {
+		/* Tickets of the first arena handed out while filling it */
+		alis_repl_release(&r, (struct ReplTicket){first, u.arena_id, i + 1});
+	}
+	tassert(r.draining_cnt == 0, "drained arena destroyed");
+
+	/*
+	 * A stale ticket must not match a newer arena that got the same address
+	 * and hands out the same ticket ids
+	 */
+	const struct ReplTicket live = alis_repl_reserve(&r, 4096);
+	tassert(live.ticket != 0, "reservation in the new arena");
+	const size_t held = r.active->live_tickets;
+	alis_repl_release(&r, (struct ReplTicket){live.ra, v.arena_id, live.ticket});
+	tassert(r.active->live_tickets == held &&
+	        alis_arena_get_data(&(r.active->ma.arena), live.ticket, NULL, 0) != 0,
+	        "stale ticket ignored");
+	alis_repl_release(&r, live);
+	tassert(r.active->live_tickets == held - 1, "live ticket released");
+
+	tassert(alis_repl_destroy(&r) == 0, "replenisher destroy");
+	puts("Replenisher OK");
+	return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#include "rsort.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void tassert(int c, const char *what)
+{
+	if (!c) {
+		printf("Failed: %s\n", what);
+		exit(1);
+	}
+}
+
+static void check_pgents(size_t n, pgnum_t mask, int presorted)
+{
+	struct ArenaPageEntry *a = malloc(n * sizeof(*a));
+	struct ArenaPageEntry *tmp = malloc(n * sizeof(*tmp));
+	for (size_t i = 0; i < n; i++) {
+		a[i].pfn = presorted ? (pgnum_t)i : ((pgnum_t)rand() ^ ((pgnum_t)rand() << 16)) & mask;
+		a[i].mfd_pgoff = i;
+	}
+	rsort_pgents(a, n, tmp);
+	for (size_t i = 1; i < n; i++) {
+		tassert(a[i - 1].pfn <= a[i].pfn, "pgents order");
+		/* Stability: equal keys keep their input order */
+		tassert(a[i - 1].pfn < a[i].pfn || a[i - 1].mfd_pgoff < a[i].mfd_pgoff,
+		        "pgents stability");
+	}
+	free(a);
+	free(tmp);
+}
+
+static void check_rowblocks(size_t n, size_t max)
+{
+	struct RowBlock *a = malloc(n * sizeof(*a));
+	struct RowBlock *tmp = malloc(n * sizeof(*tmp));
+	size_t sum = 0;
+	for (size_t i = 0; i < n; i++) {
+		a[i] = ((struct RowBlock){.data_pgcnt = (size_t)rand() % max, .row_off = i});
+		sum += a[i].data_pgcnt;
+	}
+	rsort_rowblocks(a, n, tmp);
+	for (size_t i = 0; i < n; i++) {
+		sum -= a[i].data_pgcnt;
+		if (i) {
+			tassert(a[i - 1].data_pgcnt <= a[i].data_pgcnt, "rowblock order");
+			tassert(a[i - 1].data_pgcnt < a[i].data_pgcnt ||
+			        a[i - 1].row_off < a[i].row_off, "rowblock stability");
+		}
+	}
+	tassert(sum == 0, "rowblock contents");
+	free(a);
+	free(tmp);
+}
+
+int main(void)
+{
+	srand(0x1337);
+	const size_t sizes[] = {0, 1, 2, 7, 31, 32, 33, 100, 4096, 100000};
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		check_pgents(sizes[i], PGNUM_MAX, 0);
+		check_pgents(sizes[i], 0xff00ff, 0);
+		check_pgents(sizes[i], 0xf, 0);
+		check_pgents(sizes[i], PGNUM_MAX, 1);
+		check_rowblocks(sizes[i], 16);
+		check_rowblocks(sizes[i], 100000);
+	}
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2017-2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "arena.h"
+#include "arena_mgmt.h"
+#include "map.h"
+#include "share.h"
+
+#include <ramses/msys.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+const size_t SZ = 16L * 1024 * 1024;
+const size_t ALIGN = 2 * 1024 * 1024;
+const unsigned char PATTERN = 0x5c;
+
+const char *MSYS_STR = "map:intel:ivyhaswell:2dimm:2rank:pcibase=0x7f800000:tom=0x200000000";
+
+static int child(int sock)
+{
+	struct ImportedTicket it;
+	if (alis_ticket_import(sock, &it)) {
+		perror("Import failed");
+		return 1;
+	}
+	size_t len = it.chunk_count * it.page_size;
+	unsigned char *p = alis_map(NULL, ALIGN, it.mfd, it.offsets,
+	                            it.chunk_count, it.page_size);
+	if (p == MAP_FAILED) {
+		perror("Mapping failed");
+		return 1;
+	}
+	int ret = 0;
+	for (size_t i = 0; i < len; i += it.page_size) {
+		if (p[i] != PATTERN) {
+			ret = 1;
+			break;
+		}
+	}
+	/* Acknowledge through shared memory */
+	p[0] = ~PATTERN;
+	alis_unmap(p, len);
+	alis_ticket_import_free(&it);
+	return ret;
+}
+
+/* Lowest free fd number */
+static int lowest_free_fd(void)
+{
+	int fd = dup(0);
+	close(fd);
+	return fd;
+}
+
+/* A message carrying two fds is rejected, and neither fd is kept */
+static int extra_fds(void)
+{
+	int sv[2];
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) || pipe(fds)) {
+		perror("extra fds setup");
+		return 1;
+	}
+	char byte = 0;
+	struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+	union {
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} cbuf;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf.buf,
+		.msg_controllen = sizeof(cbuf.buf)
+	};
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+	if (sendmsg(sv[0], &msg, 0) != 1) {
+		perror("extra fds send");
+		return 1;
+	}
+	close(fds[0]);
+	close(fds[1]);
+
+	const int lowest = lowest_free_fd();
+	struct ImportedTicket it;
+	const int ret = !(alis_ticket_import(sv[1], &it) != 0 && errno == EBADMSG &&
+	                  lowest_free_fd() == lowest);
+	if (ret) {
+		puts("Extra fds kept open");
+	}
+	close(sv[0]);
+	close(sv[1]);
+	return ret;
+}
+
+int main(void)
+{
+	if (extra_fds()) {
+		return 1;
+	}
+
+	struct MemorySystem msys;
+	struct MasterArena ma;
+	struct ArenaStats st = {0};
+
+	int err = ramses_msys_load(MSYS_STR, &msys, NULL);
+	if (err) {
+		perror(ramses_msys_load_strerr(err));
+		return 1;
+	}
+	if (alis_arena_create(&msys, SZ, 0, &ma, &st)) {
+		puts("Arena create error");
+		return 1;
+	}
+	ticketid_t tick = alis_arena_reserve(&(ma.arena), SZ);
+	if (!tick) {
+		puts("Ticket reservation error");
+		return 1;
+	}
+	size_t cnt = alis_arena_get_data(&(ma.arena), tick, NULL, 0);
+	off_t *offs = malloc(cnt * sizeof(*offs));
+	alis_arena_get_data(&(ma.arena), tick, offs, cnt);
+	size_t len = cnt * ma.arena.page_size;
+	unsigned char *p = alis_map(NULL, ALIGN, ma.arena.mfd, offs, cnt, ma.arena.page_size);
+	if (p == MAP_FAILED) {
+		puts("Mapping failed");
+		return 1;
+	}
+	memset(p, PATTERN, len);
+
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		perror("socketpair");
+		return 1;
+	}
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(sv[0]);
+		exit(child(sv[1]));
+	}
+	close(sv[1]);
+	if (alis_ticket_export(sv[0], &(ma.arena), tick)) {
+		perror("Export failed");
+		return 1;
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	int ret = !(WIFEXITED(status) && WEXITSTATUS(status) == 0 && p[0] == (unsigned char)~PATTERN);
+	printf("Shared %zu pages: %s\n", cnt, ret ? "mismatch" : "ok");
+
+	alis_unmap(p, len);
+	free(offs);
+	alis_arena_destroy(&ma);
+	return ret;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "sizemodel.h"
+
+#include <ramses/msys.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+const char *MSYS_STR = "map:intel:ivyhaswell:2dimm:2rank:pcibase=0x7f800000:tom=0x200000000";
+
+#define ROWS 4
+#define BACKING_ALIGN (2 * 1024 * 1024)
+
+static void tassert(int c, const char *what)
+{
+	if (!c) {
+		printf("Failed: %s\n", what);
+		exit(1);
+	}
+}
+
+static int near(double x, double y)
+{
+	return x - y < 1e-6 && y - x < 1e-6;
+}
+
+int main(void)
+{
+	struct MemorySystem msys;
+	int err = ramses_msys_load(MSYS_STR, &msys, NULL);
+	if (err) {
+		perror(ramses_msys_load_strerr(err));
+		return 1;
+	}
+	const size_t ps = sysconf(_SC_PAGESIZE);
+	struct ArenaSizeModel m;
+	alis_sizemodel_init(&m, &msys, ps, ROWS);
+	tassert(m.samples == 0 && m.row_pages > 0, "init");
+	tassert(near(m.yield, 0.5 * ROWS / (ROWS + 1)), "geometric prior");
+
+	/* The first sample replaces the prior, then weights fall to a floor of 1/4 */
+	alis_sizemodel_update(&m, 0, 10);
+	tassert(m.samples == 0, "empty sample ignored");
+	alis_sizemodel_update(&m, 1000, 400);
+	tassert(m.samples == 1 && near(m.yield, 0.4), "first sample");
+	alis_sizemodel_update(&m, 1000, 600);
+	tassert(near(m.yield, 0.5), "second sample");
+	double y = m.yield;
+	for (size_t i = 2; i < 8; i++) {
+		const double w = (i < 4) ? 1.0 / (i + 1) : 0.25;
+		alis_sizemodel_update(&m, 1000, 800);
+		y = (1 - w) * y + w * 0.8;
+		tassert(near(m.yield, y), "weighted sample");
+	}
+	tassert(m.samples == 8, "sample count");
+
+	/* Predictions are aligned and, at the modelled yield, hold the data */
+	for (size_t sz = ps; sz < (64UL << 20); sz *= 3) {
+		const size_t len = alis_sizemodel_predict(&m, sz, ps);
+		tassert(len % BACKING_ALIGN == 0, "aligned prediction");
+		tassert((double)len * m.yield >= sz, "prediction holds the data");
+	}
+
+	char path[] = "/tmp/alis-sizemodel-XXXXXX";
+	const int fd = mkstemp(path);
+	tassert(fd >= 0, "temporary file");
+	close(fd);
+	tassert(alis_sizemodel_save(&m, path) == 0, "save");
+	struct ArenaSizeModel l;
+	alis_sizemodel_init(&l, &msys, ps, ROWS);
+	tassert(alis_sizemodel_load(&l, path) == 0, "load");
+	tassert(l.max_cont_rows == m.max_cont_rows && l.row_pages == m.row_pages &&
+	        l.samples == m.samples && near(l.yield, m.yield), "round trip");
+
+	/* A model made for other geometry is left alone */
+	struct ArenaSizeModel o;
+	alis_sizemodel_init(&o, &msys, ps, ROWS + 1);
+	const struct ArenaSizeModel before = o;
+	tassert(alis_sizemodel_load(&o, path) != 0, "other geometry rejected");
+	tassert(memcmp(&o, &before, sizeof(o)) == 0, "rejected load leaves model");
+
+	FILE *f = fopen(path, "w");
+	tassert(f != NULL && fputs("not-a-model 4 2 0.5 1\n", f) >= 0 && fclose(f) == 0,
+	        "overwrite");
+	tassert(alis_sizemodel_load(&l, path) != 0, "bad magic rejected");
+	unlink(path);
+	tassert(alis_sizemodel_load(&l, path) != 0, "missing file");
+	puts("Size model OK");
+	return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "arena.h"
+#include "arena_mgmt.h"
+
+#include <ramses/msys.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+const size_t SZ = 16L * 1024 * 1024;
+const size_t NTICKETS = 64;
+
+const char *MSYS_STR = "map:intel:ivyhaswell:2dimm:2rank:pcibase=0x7f800000:tom=0x200000000";
+
+int main(void)
+{
+	struct MemorySystem msys;
+	struct MasterArena ma;
+	struct ArenaStats st = {0};
+
+	int err = ramses_msys_load(MSYS_STR, &msys, NULL);
+	if (err) {
+		perror(ramses_msys_load_strerr(err));
+		return 1;
+	}
+	if (alis_arena_create(&msys, SZ, 0, &ma, &st)) {
+		puts("Arena create error");
+		return 1;
+	}
+	struct Arena *a = &(ma.arena);
+	const size_t rb_top = a->rb_top;
+	const size_t free_pages = a->rb_pgtotals[a->rb_top - 1];
+
+	/* Single-page tickets out of large row blocks should split them */
+	ticketid_t ticks[NTICKETS];
+	size_t got = 0;
+	size_t n = 0;
+	for (; n < NTICKETS; n++) {
+		ticks[n] = alis_arena_reserve(a, a->page_size);
+		if (!ticks[n]) {
+			break;
+		}
+		got += alis_arena_get_data(a, ticks[n], NULL, 0);
+	}
+	printf("%zu tickets, %zu pages, %zu -> %zu row blocks\n", n, got, rb_top, a->rb_top);
+	int ret = (n == 0);
+
+	/* Releasing everything must merge the pieces back together */
+	while (n --> 0) {
+		alis_arena_release(a, ticks[n]);
+	}
+	if (a->rb_top != rb_top || a->rb_pgtotals[a->rb_top - 1] != free_pages) {
+		printf("Not coalesced: %zu row blocks, %zu free pages\n",
+		       a->rb_top, a->rb_pgtotals[a->rb_top - 1]);
+		ret = 1;
+	}
+	alis_arena_destroy(&ma);
+	return ret;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "arena.h"
+#include "stats.h"
+#include "stats_int.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THREADS 4
+#define CALLS 100000
+
+static void tassert(int c, const char *what)
+{
+	if (!c) {
+		printf("Failed: %s\n", what);
+		exit(1);
+	}
+}
+
+static void *worker(void *arg)
+{
+	(void) arg;
+	for (size_t i = 0; i < CALLS; i++) {
+		stats_end(ALIS_OP_GET, stats_begin(), i % 4 == 0);
+		stats_pages(1, 2);
+	}
+	return NULL;
+}
+
+static uint64_t get_calls(void)
+{
+	struct AlisStats st;
+	alis_stats_collect(&st);
+	return st.ops[ALIS_OP_GET].calls;
+}
+
+/* Row blocks of the hand-built arena and the tickets holding them; 3 is trimmed */
+static const size_t SNAP_PAGES[] = {4, 2, 1, 3, 5, 6, 1};
+static const ticketid_t SNAP_TICKETS[] = {0, 1, 0, 3, 1, 2, 3};
+#define SNAP_BLOCKS (sizeof(SNAP_PAGES) / sizeof(*SNAP_PAGES))
+
+/* Trimmed blocks are neither free nor a live ticket */
+static void snapshot(void)
+{
+	struct RowBlock rbs[SNAP_BLOCKS];
+	ticketid_t tickmap[SNAP_BLOCKS];
+	struct Arena a;
+	memset(&a, 0, sizeof(a));
+	for (size_t i = 0; i < SNAP_BLOCKS; i++) {
+		rbs[i] = ((struct RowBlock){.data_pgcnt = SNAP_PAGES[i]});
+		tickmap[i] = SNAP_TICKETS[i];
+		a.data_pgents_size += SNAP_PAGES[i];
+	}
+	a.rb_stack = rbs;
+	a.rb_top = SNAP_BLOCKS;
+	a.rb_cap = SNAP_BLOCKS;
+	a.rb_tickmap = tickmap;
+	a.last_ticket = 3;
+	a.trim_ticket = 3;
+
+	struct ArenaSnapshot s;
+	alis_arena_snapshot(&a, &s);
+	tassert(s.data_pages == 22 && s.row_blocks == SNAP_BLOCKS, "snapshot totals");
+	tassert(s.free_pages == 5 && s.free_row_blocks == 2 && s.largest_free_block == 4,
+	        "snapshot free blocks");
+	tassert(s.free_block_hist[0] == 1 && s.free_block_hist[2] == 1, "snapshot histogram");
+	tassert(s.trimmed_pages == 4, "snapshot trimmed pages");
+	tassert(s.live_tickets == 2, "snapshot live tickets");
+}
+
+int main(void)
+{
+	pthread_t th[THREADS];
+	alis_stats_timing(1);
+	/* Take a counter block before the workers, so it holds none of their counts */
+	stats_end(ALIS_OP_GET, 0, 0);
+	for (size_t i = 0; i < THREADS; i++) {
+		tassert(pthread_create(&th[i], NULL, worker, NULL) == 0, "thread start");
+	}
+	/* Collecting while the workers count must never go backwards */
+	uint64_t seen = 0;
+	for (size_t i = 0; i < 1000; i++) {
+		const uint64_t c = get_calls();
+		tassert(c >= seen && c <= THREADS * CALLS + 1, "counts while running");
+		seen = c;
+	}
+	for (size_t i = 0; i < THREADS; i++) {
+		pthread_join(th[i], NULL);
+	}
+
+	/* Counts of exited threads stay in the totals */
+	struct AlisStats st;
+	alis_stats_collect(&st);
+	const struct AlisOpStats *os = &(st.ops[ALIS_OP_GET]);
+	tassert(os->calls == THREADS * CALLS + 1, "calls");
+	tassert(os->failures == THREADS * CALLS / 4, "failures");
+	tassert(os->timed == THREADS * CALLS, "timed calls");
+	uint64_t hist = 0;
+	for (size_t b = 0; b < ALIS_LAT_BUCKETS; b++) {
+		hist += os->lat_hist[b];
+	}
+	tassert(hist == os->timed, "latency histogram");
+	tassert(st.pages_requested == THREADS * CALLS &&
+	        st.pages_reserved == 2 * THREADS * CALLS, "page counts");
+
+	/* Resetting only drops the counts of the calling thread */
+	alis_stats_reset();
+	tassert(get_calls() == THREADS * CALLS, "reset of the calling thread");
+	snapshot();
+	puts("Stats OK");
+	return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "arena.h"
+#include "arena_mgmt.h"
+#include "bitset.h"
+
+#include <ramses/msys.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+const size_t SZ = 16L * 1024 * 1024;
+#define HUGE_SHIFT 21
+
+const char *MSYS_STR = "map:intel:ivyhaswell:2dimm:2rank:pcibase=0x7f800000:tom=0x200000000";
+
+static size_t free_pages(const struct Arena *a)
+{
+	return a->rb_top ? a->rb_pgtotals[a->rb_top - 1] : 0;
+}
+
+/*
+ * Make the first guard page the first data page of `rb' too, as pass2 allows
+ * for pages that serve two rows. Returns 0 on allocation failure.
+ */
+static int share_page(struct Arena *a, const struct RowBlock *rb)
+{
+	if (a->guard_shared == NULL) {
+		a->guard_shared = calloc(bitset_words(a->guard_pgents_size), sizeof(bitword_t));
+		if (a->guard_shared == NULL) {
+			return 0;
+		}
+	}
+	a->guard_pgents[0].pfn = a->data_pgents[rb->data_pgents_off].pfn;
+	bitset_set(a->guard_shared, 0);
+	return 1;
+}
+
+int main(void)
+{
+	struct MemorySystem msys;
+	struct MasterArena ma;
+	struct ArenaStats st = {0};
+
+	int err = ramses_msys_load(MSYS_STR, &msys, NULL);
+	if (err) {
+		perror(ramses_msys_load_strerr(err));
+		return 1;
+	}
+	if (alis_arena_create(&msys, SZ, 0, &ma, &st)) {
+		puts("Arena create error");
+		return 1;
+	}
+	struct Arena *a = &(ma.arena);
+	const size_t free0 = free_pages(a);
+	int ret = 0;
+
+	/* A live ticket is left alone */
+	ticketid_t t = alis_arena_reserve(a, 4 * a->page_size);
+	const size_t held = alis_arena_get_data(a, t, NULL, 0);
+
+	/* Blocks freed just now are not idle enough */
+	struct ArenaTrimPolicy pol = {.min_idle_ns = 3600ULL * 1000000000, .keep_pages = 0};
+	if (alis_arena_trim(&ma, &pol) != 0) {
+		puts("Trimmed blocks that were not idle");
+		ret = 1;
+	}
+	pol.min_idle_ns = 0;
+	pol.keep_pages = free_pages(a) / 2;
+	size_t trimmed = alis_arena_trim(&ma, &pol);
+	if (free_pages(a) < pol.keep_pages) {
+		printf("Kept %zu free pages, wanted %zu\n", free_pages(a), pol.keep_pages);
+		ret = 1;
+	}
+	trimmed += alis_arena_trim(&ma, NULL);
+	printf("Trimmed %zu of %zu free pages\n", trimmed, free0 - held);
+	if (trimmed != free0 - held || free_pages(a) != 0 ||
+	    alis_arena_get_data(a, a->trim_ticket, NULL, 0) != trimmed ||
+	    alis_arena_reserve(a, a->page_size) != 0)
+	{
+		puts("Trimmed blocks still free");
+		ret = 1;
+	}
+	if (alis_arena_release(a, a->trim_ticket) != 0 || free_pages(a) != 0) {
+		puts("Trimmed blocks released as a ticket");
+		ret = 1;
+	}
+	alis_arena_release(a, t);
+
+	/* Blocks come back unless the kernel put their pages on other frames */
+	size_t dropped = 0;
+	const size_t restored = alis_arena_repopulate(&ma, 0, &dropped);
+	printf("Restored %zu pages, dropped %zu\n", restored, dropped);
+	if (restored + dropped != trimmed || free_pages(a) != restored + held ||
+	    alis_arena_get_data(a, a->trim_ticket, NULL, 0) != 0)
+	{
+		printf("Lost pages: %zu free\n", free_pages(a));
+		ret = 1;
+	}
+
+	/* A block with a page that is also a guard page keeps its frames */
+	const struct RowBlock *rb = &(a->rb_stack[a->rb_top - 1]);
+	if (a->rb_tickmap[a->rb_top - 1] != 0 || !share_page(a, rb)) {
+		puts("No free block to share a guard page with");
+		return 1;
+	}
+	const size_t shared_row = rb->row_off;
+	const size_t shared_pages = rb->data_pgcnt;
+	alis_arena_trim(&ma, NULL);
+	for (size_t i = 0; i < a->rb_top; i++) {
+		if (a->rb_stack[i].row_off == shared_row && a->rb_tickmap[i] != 0) {
+			puts("Trimmed a block holding a guard page");
+			ret = 1;
+		}
+	}
+	if (free_pages(a) != shared_pages) {
+		printf("%zu free pages left, wanted %zu\n", free_pages(a), shared_pages);
+		ret = 1;
+	}
+	alis_arena_destroy(&ma);
+
+	/* The huge page pool hands the trimmed pages straight back out */
+	const struct ArenaOptions opts = {.numa_node = ARENA_NODE_ANY, .hugetlb_shift = HUGE_SHIFT};
+	if (alis_arena_create_opts(&msys, SZ, 0, &opts, &ma, &st) ||
+	    ma.arena.page_size != (1UL << HUGE_SHIFT))
+	{
+		puts("No huge page arena; skipping hugetlb trim");
+		return ret;
+	}
+	const size_t hfree = free_pages(a);
+	trimmed = alis_arena_trim(&ma, NULL);
+	dropped = 0;
+	const size_t hrestored = alis_arena_repopulate(&ma, 0, &dropped);
+	printf("Huge pages: trimmed %zu, restored %zu, dropped %zu\n", trimmed, hrestored, dropped);
+	if (trimmed != hfree || hrestored != trimmed || free_pages(a) != hfree) {
+		puts("Huge pages not restored");
+		ret = 1;
+	}
+	alis_arena_destroy(&ma);
+	return ret;
+}
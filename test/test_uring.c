@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+#define _GNU_SOURCE
+
+#include "arena.h"
+#include "mapcache.h"
+#include "uring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* Pages held by tickets 1 and 2, one single-row block each */
+static const size_t TICKET_PAGES[] = {3, 2};
+#define TICKETS (sizeof(TICKET_PAGES) / sizeof(*TICKET_PAGES))
+#define MAX_BUFS 8
+#define FILL_BYTE 0x5c
+
+static void tassert(int c, const char *what)
+{
+	if (!c) {
+		printf("Failed: %s\n", what);
+		exit(1);
+	}
+}
+
+/*
+ * Hand-built arena over a memfd, so no pagemap access is needed: each block
+ * holds every other page of the memfd, backwards, so no two pages are
+ * mfd-contiguous.
+ */
+static void fake_arena(struct Arena *a, int mfd, size_t ps)
+{
+	static struct RowBlock rbs[TICKETS];
+	static ticketid_t tickmap[TICKETS];
+	static size_t totals[TICKETS];
+	static struct ArenaRow rows[TICKETS];
+	static struct ArenaPageEntry pgents[16];
+
+	memset(a, 0, sizeof(*a));
+	size_t pgcnt = 0;
+	for (size_t i = 0; i < TICKETS; i++) {
+		rows[i] = ((struct ArenaRow){pgcnt, TICKET_PAGES[i], 0});
+		rbs[i] = ((struct RowBlock){
+			.data_pgcnt = TICKET_PAGES[i],
+			.data_pgents_off = pgcnt,
+			.row_off = i,
+			.row_cnt = 1
+		});
+		for (size_t j = 0; j < TICKET_PAGES[i]; j++, pgcnt++) {
+			pgents[pgcnt].pfn = 1000 + pgcnt;
+			pgents[pgcnt].mfd_pgoff = 2 * (16 - pgcnt) - 1;
+		}
+		tickmap[i] = i + 1;
+	}
+	a->page_size = ps;
+	a->rb_stack = rbs;
+	a->rb_top = TICKETS;
+	a->rb_cap = TICKETS;
+	a->rb_tickmap = tickmap;
+	a->rb_pgtotals = totals;
+	a->data_pgents = pgents;
+	a->data_pgents_size = pgcnt;
+	a->rows = rows;
+	a->row_cnt = TICKETS;
+	a->last_ticket = TICKETS;
+	a->mfd = mfd;
+}
+
+/* Just enough of an io_uring to run one request at a time */
+struct Ring {
+	int fd;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+static int ring_init(struct Ring *r, unsigned entries)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0) {
+		return 1;
+	}
+	size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	char *sq = mmap(NULL, sq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+	                r->fd, IORING_OFF_SQ_RING);
+	char *cq = mmap(NULL, cq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+	                r->fd, IORING_OFF_CQ_RING);
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(*(r->sqes)), PROT_READ|PROT_WRITE,
+	               MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (sq == MAP_FAILED || cq == MAP_FAILED || r->sqes == MAP_FAILED) {
+		return 1;
+	}
+	r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq + p.sq_off.array);
+	r->cq_head = (unsigned *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+/* Read `b->len' bytes of `fd' into fixed buffer `b' and return the result */
+static int ring_read_fixed(struct Ring *r, int fd, const struct UringBuf *b)
+{
+	const unsigned tail = *(r->sq_tail);
+	struct io_uring_sqe *sqe = &(r->sqes[tail & *(r->sq_mask)]);
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ_FIXED;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)b->addr;
+	sqe->len = b->len;
+	sqe->buf_index = b->index;
+	r->sq_array[tail & *(r->sq_mask)] = tail & *(r->sq_mask);
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	if (syscall(__NR_io_uring_enter, r->fd, 1, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+		return -1;
+	}
+	const unsigned head = *(r->cq_head);
+	tassert(head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE), "completion");
+	const int res = r->cqes[head & *(r->cq_mask)].res;
+	__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+	return res;
+}
+
+/* Whether `a' and `b' share a fixed buffer index */
+static int indices_overlap(const struct UringBuf *a, size_t na,
+                           const struct UringBuf *b, size_t nb)
+{
+	for (size_t i = 0; i < na; i++) {
+		for (size_t j = 0; j < nb; j++) {
+			if (a[i].index == b[j].index) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+int main(void)
+{
+	const size_t ps = sysconf(_SC_PAGESIZE);
+	int mfd = syscall(SYS_memfd_create, "AlisUringTest", 0);
+	int src = syscall(SYS_memfd_create, "AlisUringSource", 0);
+	tassert(mfd >= 0 && ftruncate(mfd, 32 * ps) == 0, "memfd");
+	tassert(src >= 0 && ftruncate(src, 32 * ps) == 0, "source memfd");
+	char *fill = malloc(32 * ps);
+	tassert(fill != NULL, "fill allocation");
+	memset(fill, FILL_BYTE, 32 * ps);
+	tassert(pwrite(src, fill, 32 * ps, 0) == (ssize_t)(32 * ps), "source fill");
+	free(fill);
+
+	struct Ring r;
+	struct UringBufTable t;
+	if (ring_init(&r, 4) != 0 || alis_uring_init(&t, r.fd, MAX_BUFS) != 0) {
+		/* Needs Linux 5.19 for sparse buffer tables */
+		perror("io_uring unavailable, skipped");
+		return 0;
+	}
+
+	struct Arena a;
+	struct MapCache mc;
+	fake_arena(&a, mfd, ps);
+	tassert(alis_mapcache_init(&mc, 4 * ps, 0, 1) == 0, "map cache init");
+
+	/* Ticket 1 gets the window; its buffers stay put while it stays mapped */
+	size_t len;
+	void *p = alis_mapcache_map(&mc, &a, 1, &len);
+	tassert(p != MAP_FAILED, "map");
+	struct UringBuf b1[MAX_BUFS];
+	const size_t n1 = alis_uring_register(&t, &a, 1, p, b1, MAX_BUFS);
+	tassert(n1 > 0 && b1[0].addr == p, "register");
+	size_t total = 0;
+	for (size_t i = 0; i < n1; i++) {
+		total += b1[i].len;
+	}
+	tassert(total == len, "buffers cover the mapping");
+
+	alis_mapcache_unmap(&mc, p);
+	tassert(alis_mapcache_map(&mc, &a, 1, NULL) == p, "mapping kept");
+
+	/* Ticket 2 gets a mapping of its own and other slots */
+	void *q = alis_mapcache_map(&mc, &a, 2, NULL);
+	tassert(q != MAP_FAILED, "second map");
+	struct UringBuf b2[MAX_BUFS];
+	const size_t n2 = alis_uring_register(&t, &a, 2, q, b2, MAX_BUFS);
+	tassert(n2 > 0 && !indices_overlap(b1, n1, b2, n2), "distinct indices");
+
+	/* The slots of ticket 1 still point at its pages */
+	for (size_t i = 0; i < n1; i++) {
+		tassert(ring_read_fixed(&r, src, &b1[i]) == (int)b1[i].len, "fixed read");
+	}
+	off_t offs[3];
+	tassert(alis_arena_get_data(&a, 1, offs, 3) == 3, "ticket pages");
+	for (size_t i = 0; i < 3; i++) {
+		char c = 0;
+		tassert(pread(mfd, &c, 1, offs[i] + ps - 1) == 1 && c == FILL_BYTE,
+		        "read lands in the ticket's pages");
+	}
+
+	alis_uring_unregister(&t, b2, n2);
+	alis_uring_unregister(&t, b1, n1);
+	tassert(t.free_cnt == MAX_BUFS, "slots returned");
+	alis_uring_destroy(&t);
+	alis_mapcache_destroy(&mc);
+	close(r.fd);
+	close(src);
+	close(mfd);
+	printf("Registered %zu + %zu fixed buffers OK\n", n1, n2);
+	return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#include "xlate.h"
+
+#include <ramses/msys.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* The PCI hole below 4 GiB makes the mapping non-affine above pcibase */
+const char *MSYS_STR = "map:intel:ivyhaswell:2dimm:2rank:pcibase=0x7f800000:tom=0x200000000";
+
+#define ROW_BITS 15
+#define ROW_STEP 7
+
+static void tassert(int c, const char *what)
+{
+	if (!c) {
+		printf("Failed: %s\n", what);
+		exit(1);
+	}
+}
+
+int main(void)
+{
+	struct MemorySystem msys;
+	int err = ramses_msys_load(MSYS_STR, &msys, NULL);
+	if (err) {
+		perror(ramses_msys_load_strerr(err));
+		return 1;
+	}
+	const unsigned col_cnt = msys.mapping.props.col_cnt;
+	unsigned col_bits = 0;
+	while ((1U << col_bits) < col_cnt) {
+		col_bits++;
+	}
+	const unsigned bits[XLATE_FIELDS] = {
+		[XLATE_CHAN] = 0,
+		[XLATE_DIMM] = 1,
+		[XLATE_RANK] = 1,
+		[XLATE_BANK] = 3,
+		[XLATE_ROW] = ROW_BITS,
+		[XLATE_COL] = col_bits
+	};
+	struct XlateKernel *k = malloc(sizeof(*k));
+	tassert(k != NULL, "kernel allocation");
+	/* Whatever the sampling says, rows the kernel gets wrong must be caught */
+	const int affine = (xlate_learn(k, &msys, bits) == 0);
+
+	const unsigned cols[4] = {0, 1, col_cnt / 2 + 1, col_cnt - 1};
+	size_t accepted = 0;
+	size_t rejected = 0;
+	for (unsigned row = 0; row < (1U << ROW_BITS); row += ROW_STEP) {
+		for (unsigned f = 0; f < 32; f++) {
+			struct DRAMAddr da = {0};
+			da.dimm = f & 1;
+			da.rank = (f >> 1) & 1;
+			da.bank = f >> 2;
+			da.row = row;
+			physaddr_t row_pa;
+			if (xlate_row(k, &msys, &da, &row_pa) != 0) {
+				rejected++;
+				continue;
+			}
+			accepted++;
+			for (unsigned c = 0; c < sizeof(cols) / sizeof(*cols); c++) {
+				da.col = cols[c];
+				tassert(xlate_col(k, row_pa, da.col) == ramses_resolve_reverse(&msys, da),
+				        "column translation");
+			}
+		}
+	}
+	printf("Kernel %s; %zu rows translated, %zu left to the generic path\n",
+	       affine ? "affine" : "not affine", accepted, rejected);
+	tassert(accepted > 0, "rows translated");
+	free(k);
+	return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE
+
+#include "uring.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* Sparse tables and slot updates appeared in Linux 5.19 */
+#if defined(__NR_io_uring_register) && defined(IORING_RSRC_REGISTER_SPARSE)
+#define URING_SPARSE 1
+#endif
+
+#ifdef URING_SPARSE
+static int update_slot(struct UringBufTable *t, unsigned index, void *addr,
+                       size_t len)
+{
+	struct iovec iov = {.iov_base = addr, .iov_len = len};
+	__u64 tag = 0;
+	struct io_uring_rsrc_update2 up;
+	memset(&up, 0, sizeof(up));
+	up.offset = index;
+	up.data = (uintptr_t)&iov;
+	up.tags = (uintptr_t)&tag;
+	up.nr = 1;
+	return syscall(__NR_io_uring_register, t->ring_fd,
+	               IORING_REGISTER_BUFFERS_UPDATE, &up, sizeof(up)) != 1;
+}
+#endif
+
+int alis_uring_init(struct UringBufTable *t, int ring_fd, unsigned nr)
+{
+	memset(t, 0, sizeof(*t));
+	#ifdef URING_SPARSE
+	t->free_idx = malloc(nr * sizeof(*(t->free_idx)));
+	if (t->free_idx == NULL) {
+		return 1;
+	}
+	struct io_uring_rsrc_register reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.nr = nr;
+	reg.flags = IORING_RSRC_REGISTER_SPARSE;
+	if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS2,
+	            &reg, sizeof(reg)) != 0)
+	{
+		free(t->free_idx);
+		t->free_idx = NULL;
+		return 1;
+	}
+	t->ring_fd = ring_fd;
+	t->nr = nr;
+	/* Hand out low indices first */
+	for (unsigned i = nr; i --> 0;) {
+		t->free_idx[t->free_cnt++] = i;
+	}
+	return 0;
+	#else
+	(void) ring_fd;
+	(void) nr;
+	errno = ENOSYS;
+	return 1;
+	#endif
+}
+
+void alis_uring_destroy(struct UringBufTable *t)
+{
+	#ifdef URING_SPARSE
+	if (t->free_idx != NULL) {
+		syscall(__NR_io_uring_register, t->ring_fd, IORING_UNREGISTER_BUFFERS,
+		        NULL, 0);
+	}
+	#endif
+	free(t->free_idx);
+	memset(t, 0, sizeof(*t));
+}
+
+/*
+ * Cut the `cnt' chunks at `offsets' into pieces of at most URING_BUF_MAX
+ * bytes, ending pieces at breaks in the offsets too if `by_run'. Stores up to
+ * `max' of them in `bufs' and returns how many there are.
+ */
+static size_t cut_pieces(const off_t *offsets, size_t cnt, size_t chunk_size,
+                         char *addr, int by_run, struct UringBuf *bufs, size_t max)
+{
+	const size_t max_chunks = URING_BUF_MAX / chunk_size;
+	size_t n = 0;
+	for (size_t i = 0, j; i < cnt; i = j) {
+		for (j = i + 1; j < cnt && j - i < max_chunks; j++) {
+			if (by_run && offsets[j] != offsets[j - 1] + (off_t)chunk_size) {
+				break;
+			}
+		}
+		if (n < max) {
+			bufs[n] = ((struct UringBuf){
+				.addr = addr + i * chunk_size,
+				.len = (j - i) * chunk_size
+			});
+		}
+		n++;
+	}
+	return n;
+}
+
+size_t alis_uring_register(struct UringBufTable *t, struct Arena *arena,
+                           ticketid_t ticket, void *addr,
+                           struct UringBuf *bufs, size_t max_bufs)
+{
+	#ifdef URING_SPARSE
+	const size_t cnt = alis_arena_get_data(arena, ticket, NULL, 0);
+	off_t *offsets = cnt ? malloc(cnt * sizeof(*offsets)) : NULL;
+	if (offsets == NULL) {
+		errno = cnt ? ENOMEM : EINVAL;
+		return 0;
+	}
+	alis_arena_get_data(arena, ticket, offsets, cnt);
+
+	size_t n = 0;
+	for (int by_run = 0; by_run <= 1; by_run++) {
+		n = cut_pieces(offsets, cnt, arena->page_size, addr, by_run,
+		               bufs, max_bufs);
+		if (n > max_bufs || n > t->free_cnt) {
+			errno = ENOSPC;
+			n = 0;
+			break;
+		}
+		size_t k = 0;
+		for (; k < n; k++) {
+			bufs[k].index = t->free_idx[--t->free_cnt];
+			if (update_slot(t, bufs[k].index, bufs[k].addr, bufs[k].len)) {
+				t->free_cnt++;
+				break;
+			}
+		}
+		if (k == n) {
+			break;
+		}
+		/* Older kernels only take buffers within a single mapping */
+		const int err = errno;
+		alis_uring_unregister(t, bufs, k);
+		errno = err;
+		n = 0;
+		if (by_run || (err != EOPNOTSUPP && err != EFAULT)) {
+			break;
+		}
+	}
+	free(offsets);
+	return n;
+	#else
+	(void) t;
+	(void) arena;
+	(void) ticket;
+	(void) addr;
+	(void) bufs;
+	(void) max_bufs;
+	errno = ENOSYS;
+	return 0;
+	#endif
+}
+
+void alis_uring_unregister(struct UringBufTable *t, const struct UringBuf *bufs,
+                           size_t n)
+{
+	#ifdef URING_SPARSE
+	for (size_t k = n; k --> 0;) {
+		/* An empty iovec clears the slot and drops its pins */
+		update_slot(t, bufs[k].index, NULL, 0);
+		t->free_idx[t->free_cnt++] = bufs[k].index;
+	}
+	#else
+	(void) t;
+	(void) bufs;
+	(void) n;
+	#endif
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_URING_H
+#define ALIS_URING_H 1
+
+#include "arena.h"
+
+#include <stddef.h>
+
+/* io_uring refuses fixed buffers larger than this */
+#define URING_BUF_MAX (1UL << 30)
+
+/* One fixed buffer: `len' bytes at `addr', registered at `index' */
+struct UringBuf {
+	void *addr;
+	size_t len;
+	unsigned index;
+};
+
+/*
+ * A sparse fixed buffer table registered with an io_uring instance, whose
+ * slots are handed out to mapped tickets. Pages are pinned once, when a
+ * ticket is registered, instead of on every operation using them. A slot
+ * keeps its index until the buffer in it is unregistered, so mappings that
+ * stay up across alis_mapcache_map and alis_mapcache_unmap keep their
+ * indices too; unregister before alis_mapcache_evict or alis_unmap.
+ */
+struct UringBufTable {
+	int ring_fd;
+	unsigned nr;
+	unsigned *free_idx;
+	unsigned free_cnt;
+};
+
+/*
+ * Register a table of `nr' empty fixed buffer slots with the io_uring
+ * instance `ring_fd', which must not have buffers registered yet.
+ * Returns 0 on success, 1 on failure (with errno set).
+ */
+int alis_uring_init(struct UringBufTable *t, int ring_fd, unsigned nr);
+/* Unregister all of `t''s buffers from the ring */
+void alis_uring_destroy(struct UringBufTable *t);
+
+/*
+ * Register the data pages of `ticket', mapped at `addr' in the order given by
+ * alis_arena_get_data (as done by alis_map), as fixed buffers. The mapping
+ * is cut into buffers of at most URING_BUF_MAX bytes and, on kernels that
+ * refuse buffers spanning several mappings, at the runs of consecutive mfd
+ * offsets alis_map maps at once.
+ * Stores the buffers in `bufs' in address order, if there are at most
+ * `max_bufs' of them.
+ *
+ * Returns the number of buffers, or 0 on failure (with errno set).
+ */
+size_t alis_uring_register(struct UringBufTable *t, struct Arena *arena,
+                           ticketid_t ticket, void *addr,
+                           struct UringBuf *bufs, size_t max_bufs);
+/* Unregister `n' buffers and return their slots to the table */
+void alis_uring_unregister(struct UringBufTable *t, const struct UringBuf *bufs,
+                           size_t n);
+
+#endif /* uring.h */
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE
+
+#include "xlate.h"
+#include "ceildiv.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define XLATE_CHECKS 64 /* Random addresses checked by xlate_learn */
+
+static uint64_t get_field(const struct DRAMAddr *da, unsigned f)
+{
+	switch (f) {
+	case XLATE_CHAN: return da->chan;
+	case XLATE_DIMM: return da->dimm;
+	case XLATE_RANK: return da->rank;
+	case XLATE_BANK: return da->bank;
+	case XLATE_ROW:  return da->row;
+	default:         return da->col;
+	}
+}
+
+static void set_field(struct DRAMAddr *da, unsigned f, uint64_t v)
+{
+	switch (f) {
+	case XLATE_CHAN: da->chan = v; break;
+	case XLATE_DIMM: da->dimm = v; break;
+	case XLATE_RANK: da->rank = v; break;
+	case XLATE_BANK: da->bank = v; break;
+	case XLATE_ROW:  da->row = v; break;
+	default:         da->col = v; break;
+	}
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+int xlate_learn(struct XlateKernel *k, struct MemorySystem *msys,
+                const unsigned bits[XLATE_FIELDS])
+{
+	struct DRAMAddr zero;
+	memset(&zero, 0, sizeof(zero));
+	memset(k, 0, sizeof(*k));
+	k->base = ramses_resolve_reverse(msys, zero);
+
+	for (unsigned f = 0; f < XLATE_FIELDS; f++) {
+		physaddr_t cols[8 * XLATE_MAX_BYTES];
+		unsigned nb = 0;
+		for (; nb < bits[f] && nb < 8 * XLATE_MAX_BYTES; nb++) {
+			struct DRAMAddr da = zero;
+			set_field(&da, f, 1ULL << nb);
+			if (get_field(&da, f) != 1ULL << nb) {
+				break; /* Field is narrower */
+			}
+			cols[nb] = ramses_resolve_reverse(msys, da) ^ k->base;
+		}
+		k->bytes[f] = ceildiv(nb, 8);
+		k->limit[f] = 1ULL << nb;
+		for (unsigned b = 0; b < k->bytes[f]; b++) {
+			for (unsigned v = 0; v < 256; v++) {
+				physaddr_t t = 0;
+				for (unsigned i = 0; i < 8 && 8 * b + i < nb; i++) {
+					if (v & (1U << i)) {
+						t ^= cols[8 * b + i];
+					}
+				}
+				k->tab[f][b][v] = t;
+			}
+		}
+	}
+
+	uint64_t s = 0x2545f4914f6cdd1dULL;
+	for (unsigned c = 0; c < XLATE_CHECKS; c++) {
+		struct DRAMAddr da = zero;
+		for (unsigned f = 0; f < XLATE_FIELDS; f++) {
+			set_field(&da, f, xorshift(&s) & (k->limit[f] - 1));
+		}
+		physaddr_t pa;
+		if (xlate_pa(k, &da, &pa) || pa != ramses_resolve_reverse(msys, da)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int xlate_row(const struct XlateKernel *k, struct MemorySystem *msys,
+              const struct DRAMAddr *row, physaddr_t *pa)
+{
+	struct DRAMAddr da = *row;
+	da.col = 0;
+	physaddr_t kpa;
+	*pa = ramses_resolve_reverse(msys, da);
+	return xlate_pa(k, &da, &kpa) != 0 || kpa != *pa;
+}
+
+size_t xlate_range(const struct XlateKernel *k, struct BufferMap *bm, size_t ri,
+                   size_t off, size_t n, physaddr_t *pas)
+{
+	const struct MappingProps mprops = bm->msys->mapping.props;
+	const uint64_t step = bm->entry_len / mprops.cell_size;
+	struct DRAMAddr da;
+	physaddr_t row_pa = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (i == 0 || (da.col += step) >= mprops.col_cnt) {
+			da = ramses_bufmap_addr(bm, ri, off + i);
+			if (xlate_row(k, bm->msys, &da, &row_pa)) {
+				return i;
+			}
+		}
+		if (da.col >= k->limit[XLATE_COL]) {
+			return i;
+		}
+		pas[i] = xlate_col(k, row_pa, da.col);
+	}
+	return n;
+}
+
+int ptehash_build(struct PteHash *h, const struct BufferMap *bm)
+{
+	unsigned lg = 1;
+	if (bm->pte_cnt >= UINT32_MAX) {
+		errno = EOVERFLOW;
+		return 1;
+	}
+	while ((1ULL << lg) < 2 * (uint64_t)bm->pte_cnt) {
+		lg++;
+	}
+	h->slots = calloc(1ULL << lg, sizeof(*(h->slots)));
+	if (h->slots == NULL) {
+		return 1;
+	}
+	h->mask = (1ULL << lg) - 1;
+	h->shift = 64 - lg;
+	h->ptes = bm->ptes;
+	h->page_size = bm->page_size;
+	for (size_t i = 0; i < bm->pte_cnt; i++) {
+		const uint64_t pfn = bm->ptes[i].pa / h->page_size;
+		size_t s = (pfn * 0x9e3779b97f4a7c15ULL) >> h->shift;
+		while (h->slots[s] != 0) {
+			s = (s + 1) & h->mask;
+		}
+		h->slots[s] = i + 1;
+	}
+	return 0;
+}
+
+void ptehash_free(struct PteHash *h)
+{
+	free(h->slots);
+	h->slots = NULL;
+}
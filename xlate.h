@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2018 Vrije Universiteit Amsterdam
+ *
+ * This program is licensed under the GPL2+.
+ */
+
+#ifndef ALIS_XLATE_H
+#define ALIS_XLATE_H 1
+
+#include <ramses/msys.h>
+#include <ramses/bufmap.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fast paths for translating bufmap entries while building arenas.
+ *
+ * Memory controllers map DRAM addresses to physical addresses with bit
+ * permutations and XORs of address bits (bank and channel hashes, rank
+ * mirroring), i.e. GF(2)-affine maps. An XlateKernel is such a map learnt
+ * from ramses_resolve_reverse by flipping one bit of a DRAM address at a
+ * time; it stores what each byte of each field contributes, so a translation
+ * costs one table lookup per byte instead of a walk of the generic mapping.
+ * Mappings with offsets, such as the remapping of memory above the PCI hole,
+ * are not affine over all addresses, so callers check the kernel against the
+ * generic path for the addresses they use it on.
+ */
+
+enum XlateField {
+	XLATE_CHAN,
+	XLATE_DIMM,
+	XLATE_RANK,
+	XLATE_BANK,
+	XLATE_ROW,
+	XLATE_COL,
+	XLATE_FIELDS
+};
+
+#define XLATE_MAX_BYTES 4
+
+struct XlateKernel {
+	physaddr_t base;
+	unsigned bytes[XLATE_FIELDS];
+	uint64_t limit[XLATE_FIELDS]; /* Values at or above are not covered */
+	physaddr_t tab[XLATE_FIELDS][XLATE_MAX_BYTES][256];
+};
+
+/*
+ * Learn `k' from `msys', covering the low `bits[f]' bits of field f (at most
+ * 8 * XLATE_MAX_BYTES). Returns 0 if ramses_resolve_reverse behaves affinely
+ * on a sample of covered addresses, 1 if `k' must not be used.
+ */
+int xlate_learn(struct XlateKernel *k, struct MemorySystem *msys,
+                const unsigned bits[XLATE_FIELDS]);
+
+/* Translate `da'; returns 1 if it lies outside what `k' covers */
+static inline int xlate_pa(const struct XlateKernel *k, const struct DRAMAddr *da,
+                           physaddr_t *pa)
+{
+	const uint64_t v[XLATE_FIELDS] = {
+		da->chan, da->dimm, da->rank, da->bank, da->row, da->col
+	};
+	physaddr_t r = k->base;
+	for (unsigned f = 0; f < XLATE_FIELDS; f++) {
+		if (v[f] >= k->limit[f]) {
+			return 1;
+		}
+		for (unsigned b = 0; b < k->bytes[f]; b++) {
+			r ^= k->tab[f][b][(v[f] >> (8 * b)) & 0xff];
+		}
+	}
+	*pa = r;
+	return 0;
+}
+
+/*
+ * Store the physical address of the row `row' is in (its column taken as 0)
+ * in `*pa', as given by ramses_resolve_reverse. Returns 1 if `k' disagrees
+ * on it, e.g. past a PCI hole remap, in which case xlate_col must not be used
+ * on the row.
+ */
+int xlate_row(const struct XlateKernel *k, struct MemorySystem *msys,
+              const struct DRAMAddr *row, physaddr_t *pa);
+
+/*
+ * Physical address of column `col' of the row at `row_pa'; `col' must lie
+ * below k->limit[XLATE_COL]. Remaps are assumed not to split a row.
+ */
+static inline physaddr_t xlate_col(const struct XlateKernel *k, physaddr_t row_pa,
+                                   uint64_t col)
+{
+	for (unsigned b = 0; b < k->bytes[XLATE_COL]; b++) {
+		row_pa ^= k->tab[XLATE_COL][b][(col >> (8 * b)) & 0xff];
+	}
+	return row_pa;
+}
+
+/*
+ * Translate the `n' entries of range `ri' of `bm' from `off' on into
+ * physical addresses. Each row's first entry is looked up in `bm' and its
+ * address resolved through the generic path and checked with xlate_row; the
+ * row's further entries are taken to follow it column by column.
+ * Returns the number of leading entries translated, which is less than `n'
+ * if an entry lies outside what `k' covers or in a row it gets wrong.
+ */
+size_t xlate_range(const struct XlateKernel *k, struct BufferMap *bm, size_t ri,
+                   size_t off, size_t n, physaddr_t *pas);
+
+/* Open-addressing table from frame numbers to bufmap PTE indexes */
+struct PteHash {
+	uint32_t *slots; /* PTE index + 1, or 0 if free */
+	size_t mask;
+	unsigned shift;
+	const struct BMPte *ptes;
+	size_t page_size;
+};
+
+/* Returns 0 on success, 1 on allocation failure or too many PTEs */
+int ptehash_build(struct PteHash *h, const struct BufferMap *bm);
+void ptehash_free(struct PteHash *h);
+
+/* Store the index of the PTE holding `pa' in `*idx'; returns 1 if none does */
+static inline int ptehash_find(const struct PteHash *h, physaddr_t pa, size_t *idx)
+{
+	const uint64_t pfn = pa / h->page_size;
+	for (size_t s = (pfn * 0x9e3779b97f4a7c15ULL) >> h->shift; ; s = (s + 1) & h->mask) {
+		const uint32_t e = h->slots[s];
+		if (e == 0) {
+			return 1;
+		}
+		if (h->ptes[e - 1].pa / h->page_size == pfn) {
+			*idx = e - 1;
+			return 0;
+		}
+	}
+}
+
+#endif /* xlate.h */